@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include "radar_ops.h"
+#include "xcom.h"
+#include "msg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Checks radar_open_baud() against a pty stand-in of the device. The device
+// side reads the rate the host set on the shared pty and only understands
+// the host when it matches its own rate; otherwise it echoes garbled bytes,
+// the way a UART at the wrong rate sees the line.
+#define DEV_WAIT_US             (10000)
+
+typedef struct {
+    TU32  nDevBaud;         // rate of the stand-in device
+    TU32  nOpenBaud;        // rate given to radar_open_baud
+    TBool bExpectOk;
+    TU32  nExpectBaud;      // rate radar_get_baud should report
+} TProbeCase;
+
+static const TProbeCase g_tCases[] = {
+    { 115200,  RADAR_BAUD_AUTO, TTrue,  115200  },
+    { 921600,  RADAR_BAUD_AUTO, TTrue,  921600  },
+    { 3000000, RADAR_BAUD_AUTO, TTrue,  3000000 },
+    { 9600,    RADAR_BAUD_AUTO, TTrue,  9600    },
+    { 250000,  250000,          TTrue,  250000  },  // not a Bxxx rate: termios2/BOTHER
+    { 250000,  115200,          TFalse, 0       },
+    { 250000,  RADAR_BAUD_AUTO, TFalse, 0       },  // not in the probe list
+};
+
+static int           g_fdMaster = -1;
+static UTIL_HANDLE   g_hSlave = INVALID_UTIL_HANDLE;
+static TXcomPortCtx  g_tDevPort;
+static TXcomCtx      g_tDevXcom;
+static TU32          g_nDevBaud = 0;
+static volatile int  g_bDevRun = 0;
+static volatile int  g_bDevDone = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+static void OnDevRequest(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    // Any request gets an empty response
+    xcom_send(&g_tDevXcom, nId, (TU8)(nCmd & ~CMD_MASK_REQ_RSP), NULL, 0);
+}
+
+static void * DeviceThread(void *pParam)
+{
+    TU8  cBuf[256];
+    TU32 nLen, i;
+
+    while (g_bDevRun)
+    {
+        if (!(UART_Wait((UTIL_HANDLE)g_fdMaster, UART_EV_READ, DEV_WAIT_US) & UART_EV_READ)) continue;
+
+        // The slave side of the pty holds the rate the host set
+        if (UART_GetBaud(g_hSlave) == g_nDevBaud)
+        {
+            xcom_fsm(&g_tDevXcom);
+        }
+        else
+        {
+            nLen = UART_Read((UTIL_HANDLE)g_fdMaster, cBuf, sizeof(cBuf));
+            for (i=0; i<nLen; i++) cBuf[i] ^= 0x5A;
+            if (nLen > 0) UART_Write((UTIL_HANDLE)g_fdMaster, cBuf, nLen);
+        }
+    }
+
+    g_bDevDone = 1;
+
+    return NULL;
+}
+
+static TBool OpenDevice(TU32 nBaud, char *szSlave, TU32 nSlaveLen)
+{
+    char *szName;
+
+    g_fdMaster = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (g_fdMaster < 0 || grantpt(g_fdMaster) < 0 || unlockpt(g_fdMaster) < 0) return TFalse;
+
+    szName = ptsname(g_fdMaster);
+    if (!szName) return TFalse;
+
+    strncpy(szSlave, szName, nSlaveLen - 1);
+    szSlave[nSlaveLen - 1] = '\0';
+
+    // Kept open to read the rate; it never reads data
+    g_hSlave = UART_Init(szSlave);
+    if (g_hSlave == INVALID_UTIL_HANDLE) return TFalse;
+
+    xcom_port_init(&g_tDevPort);
+    g_tDevPort.hPort = (UTIL_HANDLE)g_fdMaster;
+    xcom_init(&g_tDevXcom, &g_tDevPort, OnDevRequest, NULL);
+
+    g_nDevBaud = nBaud;
+    g_bDevRun  = 1;
+    g_bDevDone = 0;
+
+    return (TBool)(THREAD_Create(DeviceThread, NULL) != INVALID_UTIL_HANDLE);
+}
+
+static void CloseDevice(void)
+{
+    g_bDevRun = 0;
+    while (!g_bDevDone) UTIL_Sleep(1);
+
+    UART_Close(g_hSlave);
+    close(g_fdMaster);
+}
+
+static TBool RunCase(const TProbeCase *pCase)
+{
+    TRadarCtx *pCtx = (TRadarCtx *)calloc(1, sizeof(TRadarCtx));
+    char  szSlave[64];
+    TU32  nStart, nBaud;
+    int   nRet;
+    TBool bPass;
+
+    if (!pCtx || !OpenDevice(pCase->nDevBaud, szSlave, sizeof(szSlave)))
+    {
+        printf("device stand-in failed\n");
+        free(pCtx);
+        return TFalse;
+    }
+
+    nStart = TIMER_GetNow();
+    nRet   = radar_open_baud_ex(pCtx, szSlave, pCase->nOpenBaud);
+    nBaud  = radar_get_baud_ex(pCtx);
+
+    bPass = (pCase->bExpectOk ? (nRet == RADAR_ERROR_SUCCESS) : (nRet != RADAR_ERROR_SUCCESS))
+         && (nBaud == pCase->nExpectBaud);
+
+    // The port must really run at the rate reported
+    if (bPass && nRet == RADAR_ERROR_SUCCESS)
+    {
+        bPass = (TBool)(UART_GetBaud(pCtx->tPort.hPort) == nBaud);
+    }
+
+    printf("device %7lu, open %7lu: ret %d, baud %7lu, %5lu ms  %s\n",
+           pCase->nDevBaud, pCase->nOpenBaud, nRet, nBaud,
+           TIMER_GetNow() - nStart, bPass ? "PASS" : "FAIL");
+
+    if (nRet == RADAR_ERROR_SUCCESS) xcom_port_close(&pCtx->tPort);
+
+    CloseDevice();
+    free(pCtx);
+
+    return bPass;
+}
+
+int main(int argc, char *argv[])
+{
+    TU32 i, nFail = 0;
+
+    for (i=0; i<UTIL_TAB_SIZE(g_tCases); i++)
+    {
+        if (!RunCase(&g_tCases[i])) nFail++;
+    }
+
+    printf("%lu of %lu cases failed\n", nFail, (TU32)UTIL_TAB_SIZE(g_tCases));
+
+    return nFail ? 1 : 0;
+}
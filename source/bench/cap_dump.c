@@ -0,0 +1,78 @@
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+
+// Prints a capture written by CAP_Init()/CAP_Write() as text, one line per
+// chunk, with the time since the first chunk and the link it belongs to:
+//
+//     0.012345 L3 UART RX: A5 04 01 00 00 00
+//
+// usage: cap_dump file
+#define CAP_FILE_HDR_LEN        (16)
+#define CAP_REC_HDR_LEN         (12)
+
+int main(int argc, char *argv[])
+{
+    FILE *fp;
+    TU8   cHdr[CAP_FILE_HDR_LEN];
+    TU8   cData[TU16_MAX];
+    TU64  nTime, nFirst = 0;
+    TU16  nLen, i;
+    TU32  nRecs = 0;
+    TU8   nDir, nLink;
+
+    if (argc < 2)
+    {
+        printf("usage: cap_dump file\n");
+        return 1;
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (!fp)
+    {
+        printf("open [%s] failed!\n", argv[1]);
+        return 1;
+    }
+
+    if (fread(cHdr, 1, CAP_FILE_HDR_LEN, fp) != CAP_FILE_HDR_LEN || memcmp(cHdr, "XCAP", 4) != 0)
+    {
+        printf("[%s] is not a capture file!\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+
+    // Skip header fields added by later versions
+    fseek(fp, (long)UTIL_DEC_TU16_LSBF(&cHdr[6]), SEEK_SET);
+
+    while (fread(cHdr, 1, CAP_REC_HDR_LEN, fp) == CAP_REC_HDR_LEN)
+    {
+        nTime = ((TU64)UTIL_DEC_TU32_LSBF(&cHdr[4]) << 32) | UTIL_DEC_TU32_LSBF(&cHdr[0]);
+        nLen  = UTIL_DEC_TU16_LSBF(&cHdr[8]);
+        nDir  = cHdr[10];
+        nLink = cHdr[11];
+
+        if (fread(cData, 1, nLen, fp) != nLen)
+        {
+            printf("truncated record!\n");
+            break;
+        }
+
+        if (nRecs++ == 0) nFirst = nTime;
+
+        printf("%10.6f L%u ", (nTime - nFirst) / 1e6, nLink);
+
+        if (nDir == CAP_DIR_LOST)
+        {
+            printf("LOST: %lu bytes\n", (unsigned long)UTIL_DEC_TU32_LSBF(&cData[0]));
+            continue;
+        }
+
+        printf("UART %s: ", (nDir == CAP_DIR_TX) ? "TX" : "RX");
+        for (i=0; i<nLen; i++) printf("%02X ", cData[i]);
+        printf("\n");
+    }
+
+    fclose(fp);
+
+    return 0;
+}
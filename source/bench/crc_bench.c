@@ -0,0 +1,103 @@
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest frame on the wire: header(6) + MAX_PAYLOAD_LEN(2100) + CRC(1)
+#define BENCH_FRAME_LEN         (2107)
+#define BENCH_CHECK_ROUNDS      (4096)
+#define BENCH_RUN_TIME          (500)       // ms per variant and size
+
+static TU8 g_cBenchBuf[BENCH_FRAME_LEN];
+
+////////////////////////////////////////////////////////////////////////////////
+static TBool CheckImpl(TU8 nImpl)
+{
+    TU32 i;
+    TU16 nLen, nOff;
+    TU8  nPrev, nRef, nGot;
+
+    for (i=0; i<BENCH_CHECK_ROUNDS; i++)
+    {
+        nOff  = (TU16)(rand() % 16);
+        nLen  = (TU16)(rand() % (BENCH_FRAME_LEN - nOff + 1));
+        nPrev = (TU8)rand();
+
+        CRC_SelectImpl(CRC8_IMPL_BITWISE);
+        nRef = CRC_CalCrc8(&g_cBenchBuf[nOff], nLen, nPrev);
+
+        CRC_SelectImpl(nImpl);
+        nGot = CRC_CalCrc8(&g_cBenchBuf[nOff], nLen, nPrev);
+
+        if (nRef != nGot)
+        {
+            printf("%-8s MISMATCH: off=%d, len=%d, prev=0x%02X, ref=0x%02X, got=0x%02X\n",
+                   CRC_GetImplName(nImpl), nOff, nLen, nPrev, nRef, nGot);
+            return TFalse;
+        }
+    }
+
+    return TTrue;
+}
+
+static void RunImpl(TU8 nImpl, TU16 nLen)
+{
+    TU32 nStart, nElapse;
+    TU32 nCalls = 0;
+    TU8  nCrc = 0;
+    double fBytesPerSec;
+
+    CRC_SelectImpl(nImpl);
+
+    nStart = TIMER_GetNow();
+    do
+    {
+        for (nElapse=0; nElapse<64; nElapse++)
+        {
+            nCrc = CRC_CalCrc8(g_cBenchBuf, nLen, nCrc);
+        }
+        nCalls += 64;
+        nElapse = TIMER_GetNow() - nStart;
+    } while (nElapse < BENCH_RUN_TIME);
+
+    fBytesPerSec = (double)nCalls * nLen * 1000.0 / nElapse;
+
+    printf("%-8s len=%4d: %14.0f bytes/s (%8.1f MB/s) [crc=0x%02X]\n",
+           CRC_GetImplName(nImpl), nLen, fBytesPerSec, fBytesPerSec / 1e6, nCrc);
+}
+
+int main(int argc, char *argv[])
+{
+    static const TU16 nLenTab[] = { 7, 64, 512, BENCH_FRAME_LEN };
+    TU32 i;
+    TU8  nImpl;
+    int  nRet = 0;
+
+    srand(820);
+    for (i=0; i<BENCH_FRAME_LEN; i++) g_cBenchBuf[i] = (TU8)rand();
+
+    for (nImpl=CRC8_IMPL_BITWISE; nImpl<CRC8_IMPL_NUM; nImpl++)
+    {
+        if (!CRC_IsImplSupported(nImpl))
+        {
+            printf("%-8s not supported on this CPU\n", CRC_GetImplName(nImpl));
+            continue;
+        }
+
+        if (!CheckImpl(nImpl))
+        {
+            nRet = -1;
+            continue;
+        }
+
+        for (i=0; i<UTIL_TAB_SIZE(nLenTab); i++)
+        {
+            RunImpl(nImpl, nLenTab[i]);
+        }
+    }
+
+    CRC_SelectImpl(CRC8_IMPL_AUTO);
+    printf("auto selects: %s\n", CRC_GetImplName(CRC_GetImpl()));
+
+    return nRet;
+}
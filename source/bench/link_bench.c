@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include "xcom.h"
+#include "xcom_port.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// CPU use of one polling thread serving N links, each fed by a pty stand-in
+// streaming depth reports at BENCH_FPS.
+#define BENCH_MAX_LINKS         (64)
+#define BENCH_FPS               (30)
+#define BENCH_DEPTH_POINTS      (480)
+#define BENCH_RUN_TIME          (2000)      // ms per link count
+
+#define CMD_REPORT_DEPTH        (0x7E)
+
+typedef struct {
+    int          fdMaster;
+    TXcomPortCtx tPort;
+    TXcomCtx     tXcom;
+    TU32         nFrames;
+} TBenchLink;
+
+static TBenchLink   g_tLinks[BENCH_MAX_LINKS];
+static TU32         g_nLinks = 0;
+static volatile int g_bDevRun = 0;
+static TU8          g_cFrame[XCOM_MAX_MSG_LEN];
+static TU16         g_nFrameLen = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+static void BuildDepthFrame(void)
+{
+    TU16 nLen = (TU16)(4 + 2 * BENCH_DEPTH_POINTS);
+    TU16 i;
+
+    g_cFrame[0] = 0xA5;
+    g_cFrame[1] = 0x04;
+    g_cFrame[2] = 0;
+    g_cFrame[3] = CMD_REPORT_DEPTH;
+    g_cFrame[4] = (TU8)(nLen & 0xFF);
+    g_cFrame[5] = (TU8)(nLen >> 8);
+
+    for (i=0; i<nLen; i++) g_cFrame[6+i] = (TU8)(i * 7);
+
+    g_cFrame[6+nLen] = CRC_CalCrc8(g_cFrame, (TU16)(6+nLen), 0);
+    g_nFrameLen = (TU16)(7 + nLen);
+}
+
+static void OnFrame(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    ((TBenchLink *)pParam)->nFrames++;
+}
+
+static void * DeviceThread(void *pParam)
+{
+    TU32 i;
+
+    while (g_bDevRun)
+    {
+        for (i=0; i<g_nLinks; i++)
+        {
+            if (write(g_tLinks[i].fdMaster, g_cFrame, g_nFrameLen) < 0) {}
+        }
+
+        UTIL_Sleep(1000 / BENCH_FPS);
+    }
+
+    return NULL;
+}
+
+static TBool OpenLink(TBenchLink *pLink)
+{
+    struct termios tOpt;
+    char *szSlave;
+
+    pLink->fdMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pLink->fdMaster < 0 || grantpt(pLink->fdMaster) < 0 || unlockpt(pLink->fdMaster) < 0) return TFalse;
+
+    tcgetattr(pLink->fdMaster, &tOpt);
+    cfmakeraw(&tOpt);
+    tcsetattr(pLink->fdMaster, TCSANOW, &tOpt);
+
+    szSlave = ptsname(pLink->fdMaster);
+
+    xcom_port_init(&pLink->tPort);
+    if (!szSlave || !xcom_port_open(&pLink->tPort, (const TU8 *)szSlave)) return TFalse;
+
+    pLink->nFrames = 0;
+
+    return xcom_init(&pLink->tXcom, &pLink->tPort, OnFrame, pLink);
+}
+
+static void CloseLink(TBenchLink *pLink)
+{
+    xcom_port_close(&pLink->tPort);
+    close(pLink->fdMaster);
+}
+
+static double ThreadCpuMs(void)
+{
+    struct rusage tUsage;
+
+    getrusage(RUSAGE_THREAD, &tUsage);
+
+    return (tUsage.ru_utime.tv_sec + tUsage.ru_stime.tv_sec) * 1000.0
+         + (tUsage.ru_utime.tv_usec + tUsage.ru_stime.tv_usec) / 1000.0;
+}
+
+static void RunLinks(TU32 nLinks)
+{
+    TU32   i, nStart, nElapse, nFrames = 0;
+    double fCpuStart, fCpu;
+    UTIL_HANDLE hDev;
+
+    for (g_nLinks=0; g_nLinks<nLinks; g_nLinks++)
+    {
+        if (!OpenLink(&g_tLinks[g_nLinks]))
+        {
+            printf("links=%3lu: open failed\n", nLinks);
+            goto exit;
+        }
+    }
+
+    g_bDevRun = 1;
+    hDev = THREAD_Create(DeviceThread, NULL);
+
+    nStart = TIMER_GetNow();
+    fCpuStart = ThreadCpuMs();
+
+    // One thread polls every link, as the host application would
+    do
+    {
+        for (i=0; i<nLinks; i++) xcom_fsm(&g_tLinks[i].tXcom);
+
+        UTIL_Sleep(1);
+        nElapse = TIMER_GetNow() - nStart;
+    } while (nElapse < BENCH_RUN_TIME);
+
+    fCpu = ThreadCpuMs() - fCpuStart;
+
+    g_bDevRun = 0;
+    UTIL_Sleep(2 * 1000 / BENCH_FPS);
+    THREAD_Terminate(hDev);
+
+    for (i=0; i<nLinks; i++) nFrames += g_tLinks[i].nFrames;
+
+    printf("links=%3lu: %8.1f frames/s, cpu %6.2f%% of a core, %6.3f%% per link, %6.1f us per frame\n",
+           nLinks, nFrames * 1000.0 / nElapse,
+           fCpu * 100.0 / nElapse, fCpu * 100.0 / nElapse / nLinks,
+           nFrames ? fCpu * 1000.0 / nFrames : 0.0);
+
+exit:
+    for (i=0; i<g_nLinks; i++) CloseLink(&g_tLinks[i]);
+    g_nLinks = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    TU32 nMax = (argc > 1) ? (TU32)atoi(argv[1]) : BENCH_MAX_LINKS;
+    TU32 n;
+
+    if (nMax > BENCH_MAX_LINKS) nMax = BENCH_MAX_LINKS;
+
+    BuildDepthFrame();
+
+    printf("%d fps per link, %d bytes per frame, %d ms per run\n", BENCH_FPS, g_nFrameLen, BENCH_RUN_TIME);
+
+    for (n=1; n<=nMax; n*=2)
+    {
+        RunLinks(n);
+    }
+
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include "xcom.h"
+#include "xcom_port.h"
+#include "xcom_loop.h"
+#include "msg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Depth throughput and command latency over an emulated line, from clean to
+// faulty, at 115200 to 3M baud. A device model on the far end of an
+// xcom_loop streams depth reports at half the line rate and answers
+// GET_INFO, which the host sends every REQ_PERIOD. All times are those of
+// the line clock, so each run covers many link-seconds in little wall time.
+//
+// usage: loop_bench [seconds] [seed]
+#define LOOP_DEF_SECONDS        (100)
+#define LOOP_DEF_SEED           (1)
+#define LOOP_MAX_SAMPLES        (1 << 16)
+
+#define LOOP_DEPTH_RES          (480)
+#define LOOP_REPORT_LEN         (MSG_LEN_ReportDepthReq + LOOP_DEPTH_RES * 2)
+#define LOOP_LOAD_PCT           (50)
+#define LOOP_FRAME_OVERHEAD     (7)         // SYNC VER ID CMD LEN LEN ... CRC
+#define LOOP_BITS_PER_BYTE      (10)
+
+#define REQ_PERIOD              (20000)     // us
+#define REQ_TIMEOUT             (100000)    // us
+
+typedef struct {
+    const char * szName;
+    TU32         nLatencyUs;
+    TU32         nJitterUs;
+    TFloat       fBitErrorRate;
+    TFloat       fDropRate;
+    TFloat       fStallRate;
+    TU32         nStallUs;
+} TLoopFaults;
+
+static const TLoopFaults g_tFaults[] = {
+    { "clean",  200, 100, 0,    0,    0,    0    },
+    { "noisy",  200, 100, 1e-6, 0,    0,    0    },
+    { "bad",    200, 500, 1e-5, 1e-5, 1e-4, 5000 },
+};
+
+static const TU32 g_nBauds[] = { 115200, 921600, 3000000 };
+
+// Device model
+typedef struct {
+    TXcomPortCtx tPort;
+    TXcomCtx     tXcom;
+    TU64         nNextReportUs;
+    TU64         nPeriodUs;
+    TU8          nReportId;
+    TU32         nReports;
+} TLoopDevice;
+
+// Host side of a run
+typedef struct {
+    TXcomPortCtx tPort;
+    TXcomCtx     tXcom;
+    TBool        bPending;
+    TU8          nReqId;
+    TU64         nReqUs;
+    TU32         nFrames;
+    TU32         nSamples;
+    TU32         nLost;
+} TLoopHost;
+
+static TLoopDevice g_tDev;
+static TLoopHost   g_tHost;
+static TU32        g_nRtt[LOOP_MAX_SAMPLES];
+
+////////////////////////////////////////////////////////////////////////////////
+static int CompareU32(const void *a, const void *b)
+{
+    TU32 x = *(const TU32 *)a;
+    TU32 y = *(const TU32 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void OnDevRequest(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    TU8 cRsp[MSG_LEN_GetInfoRsp];
+
+    if ((nCmd & CMD_MASK_REQ_RSP) != CMD_BIT_REQ) return;
+
+    nCmd &= ~CMD_MASK_REQ_RSP;
+    memset(cRsp, 0, sizeof(cRsp));
+
+    xcom_send(&g_tDev.tXcom, nId, nCmd, cRsp, (TU16)((nCmd == RADAR_CMD_GET_INFO) ? MSG_LEN_GetInfoRsp : 0));
+}
+
+static TU64 RunDevice(void *pParam, TU64 nNowUs)
+{
+    TU8 cReport[LOOP_REPORT_LEN];
+
+    xcom_fsm(&g_tDev.tXcom);
+
+    while (nNowUs >= g_tDev.nNextReportUs)
+    {
+        memset(cReport, 0, sizeof(cReport));
+        MSG_ReportDepthReq_SetTimestamp(cReport, (TU32)(nNowUs / 1000));
+
+        // A full TX queue drops the frame, as the device would
+        if (xcom_send(&g_tDev.tXcom, g_tDev.nReportId++, (TU8)(RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ), cReport, LOOP_REPORT_LEN))
+        {
+            g_tDev.nReports++;
+        }
+        g_tDev.nNextReportUs += g_tDev.nPeriodUs;
+    }
+
+    xcom_flush(&g_tDev.tXcom);
+
+    return g_tDev.nNextReportUs;
+}
+
+static void OnHostFrame(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    if (nCmd == (TU8)(RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ))
+    {
+        if (nLen == LOOP_REPORT_LEN) g_tHost.nFrames++;
+    }
+    else if (g_tHost.bPending && nId == g_tHost.nReqId && nCmd == RADAR_CMD_GET_INFO)
+    {
+        if (g_tHost.nSamples < LOOP_MAX_SAMPLES)
+        {
+            g_nRtt[g_tHost.nSamples++] = (TU32)(xcom_loop_now(&g_tHost.tPort) - g_tHost.nReqUs);
+        }
+        g_tHost.bPending = TFalse;
+    }
+}
+
+static TBool RunLink(const TLoopFaults *pFaults, TU32 nBaud, TU32 nSeconds, TU32 nSeed)
+{
+    XCOM_LOOP_CONFIG tCfg;
+    TXcomLoopStats   tLoop;
+    TXcomStats       tStats;
+    TU64 nEndUs = (TU64)nSeconds * 1000000;
+    TU64 nNow, nNextReq = 0, nWait;
+    TU64 nWallStart = TIMER_GetNowUs(), nWallUs;
+    TU32 nExpected;
+
+    memset(&tCfg, 0, sizeof(tCfg));
+    tCfg.nBaud         = nBaud;
+    tCfg.nLatencyUs    = pFaults->nLatencyUs;
+    tCfg.nJitterUs     = pFaults->nJitterUs;
+    tCfg.fBitErrorRate = pFaults->fBitErrorRate;
+    tCfg.fDropRate     = pFaults->fDropRate;
+    tCfg.fStallRate    = pFaults->fStallRate;
+    tCfg.nStallUs      = pFaults->nStallUs;
+    tCfg.nSeed         = nSeed;
+    tCfg.fnDevice      = RunDevice;
+
+    memset(&g_tDev, 0, sizeof(g_tDev));
+    memset(&g_tHost, 0, sizeof(g_tHost));
+    xcom_port_init(&g_tDev.tPort);
+    xcom_port_init(&g_tHost.tPort);
+
+    if (!xcom_loop_open(&g_tHost.tPort, &g_tDev.tPort, &tCfg)) return TFalse;
+
+    xcom_init(&g_tDev.tXcom, &g_tDev.tPort, OnDevRequest, NULL);
+    xcom_init(&g_tHost.tXcom, &g_tHost.tPort, OnHostFrame, NULL);
+    xcom_set_baud(&g_tHost.tXcom, nBaud);
+
+    // Reports take LOOP_LOAD_PCT of the line
+    g_tDev.nPeriodUs = (TU64)(LOOP_REPORT_LEN + LOOP_FRAME_OVERHEAD) * LOOP_BITS_PER_BYTE * 1000000 * 100 / nBaud / LOOP_LOAD_PCT;
+
+    while ((nNow = xcom_loop_now(&g_tHost.tPort)) < nEndUs)
+    {
+        if (g_tHost.bPending && nNow - g_tHost.nReqUs >= REQ_TIMEOUT)
+        {
+            g_tHost.nLost++;
+            g_tHost.bPending = TFalse;
+        }
+
+        if (!g_tHost.bPending && nNow >= nNextReq)
+        {
+            g_tHost.nReqId++;
+            g_tHost.nReqUs   = nNow;
+            g_tHost.bPending = xcom_send(&g_tHost.tXcom, g_tHost.nReqId, (TU8)(RADAR_CMD_GET_INFO | CMD_BIT_REQ), NULL, 0);
+            nNextReq = nNow + REQ_PERIOD;
+        }
+
+        nWait = g_tHost.bPending ? (g_tHost.nReqUs + REQ_TIMEOUT) : nNextReq;
+        nWait = UTIL_MIN(nWait, nEndUs);
+        nWait = (nWait > nNow) ? (nWait - nNow) : 0;
+
+        xcom_wait(&g_tHost.tXcom, (TU32)nWait);
+        xcom_fsm(&g_tHost.tXcom);
+    }
+
+    nWallUs = UTIL_MAX(TIMER_GetNowUs() - nWallStart, 1);
+
+    xcom_get_stats(&g_tHost.tXcom, &tStats);
+    xcom_loop_get_stats(&g_tHost.tPort, &tLoop);
+
+    nExpected = UTIL_MAX(g_tDev.nReports, 1);
+    qsort(g_nRtt, g_tHost.nSamples, sizeof(TU32), CompareU32);
+
+    printf("%-6s %7lu: frames %5.1f%%  lost req %3lu  rtt us p50 %6lu p99 %6lu max %6lu  crc err %4lu  %6.0f link-s/s\n",
+           pFaults->szName, nBaud, g_tHost.nFrames * 100.0 / nExpected, g_tHost.nLost,
+           g_tHost.nSamples ? g_nRtt[g_tHost.nSamples / 2] : 0,
+           g_tHost.nSamples ? g_nRtt[(g_tHost.nSamples * 99) / 100] : 0,
+           g_tHost.nSamples ? g_nRtt[g_tHost.nSamples - 1] : 0,
+           tStats.nRxCrcErrors, nSeconds * 1e6 / nWallUs);
+
+    if (tLoop.nBitErrors || tLoop.nDropped || tLoop.nStalls)
+    {
+        printf("%15s faults: %lu bit errors, %lu dropped, %lu stalls in %lu bytes\n", "",
+               tLoop.nBitErrors, tLoop.nDropped, tLoop.nStalls, tLoop.nBytes);
+    }
+
+    xcom_port_close(&g_tHost.tPort);
+    xcom_port_close(&g_tDev.tPort);
+
+    return TTrue;
+}
+
+int main(int argc, char *argv[])
+{
+    TU32 nSeconds = (argc > 1) ? (TU32)atol(argv[1]) : LOOP_DEF_SECONDS;
+    TU32 nSeed    = (argc > 2) ? (TU32)atol(argv[2]) : LOOP_DEF_SEED;
+    TU32 i, j;
+
+    printf("%lu link-s per run, seed %lu, depth %u at %u%% of the line, GET_INFO every %u ms\n",
+           nSeconds, nSeed, LOOP_DEPTH_RES, LOOP_LOAD_PCT, REQ_PERIOD / 1000);
+
+    for (i=0; i<UTIL_TAB_SIZE(g_tFaults); i++)
+    {
+        for (j=0; j<UTIL_TAB_SIZE(g_nBauds); j++)
+        {
+            if (!RunLink(&g_tFaults[i], g_nBauds[j], nSeconds, nSeed))
+            {
+                printf("loop open failed!\n");
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
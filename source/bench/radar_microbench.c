@@ -0,0 +1,463 @@
+#include "xcom.h"
+#include "xcom_port.h"
+#include "msg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Microbenchmarks of the host hot paths, as JSON on stdout so that runs can
+// be kept and compared. Each case runs on fixed inputs, calibrated to take
+// about the given time per repetition, then repeated: ns/op is the median
+// and the min of the repetitions, bytes/s is taken from the median.
+// Allocations are counted by wrapping malloc, on glibc only; null elsewhere.
+//
+// The xcom cases run on a port with no device: sends go nowhere, and the
+// parser reads a prebuilt stream of depth reports from memory, either as
+// much as the ring takes or in small chunks.
+//
+// usage: radar_microbench [ms per rep] [reps] [name filter]
+#define MB_DEF_REP_MS           (200)
+#define MB_DEF_REPS             (5)
+#define MB_MAX_REPS             (64)
+#define MB_CALIBRATE_MS         (10)
+
+#define MB_DEPTH_RES            (480)
+#define MB_DEPTH_LEN            (MSG_LEN_ReportDepthReq + MB_DEPTH_RES * 2)
+#define MB_SYNC                 (0xA5)
+#define MB_VER                  (0x04)
+#define MB_HEADER_LEN           (6)         // SYNC VER ID CMD LEN LEN
+#define MB_FRAME_OVERHEAD       (MB_HEADER_LEN + 1)
+#define MB_STREAM_FRAMES        (64)
+#define MB_SMALL_CHUNK          (64)
+
+typedef struct {
+    const char * szName;
+    const char * szParam;
+    TU32         nParam;
+    void  (*fnSetup)(TU32 nParam);
+    void  (*fnRun)(TU32 nOps);
+    TU32  (*fnBytes)(TU32 nParam);   // bytes per op
+} TMicroCase;
+
+// Keeps results alive past the optimizer
+static volatile TU32 g_nSink;
+
+static TU8    g_cData[XCOM_MAX_MSG_LEN];
+static TU16   g_nDepth[MB_DEPTH_RES];
+static TU16   g_nDecoded[MB_DEPTH_RES];
+static TFloat g_fX[MB_DEPTH_RES];
+static TFloat g_fY[MB_DEPTH_RES];
+static TU32   g_nLen;
+
+static TXcomCtx     g_tXcom;
+static TXcomPortCtx g_tPort;
+static TU8          g_nId;
+
+// Depth reports read back by the parser
+static TU8  g_cStream[MB_STREAM_FRAMES * (MB_DEPTH_LEN + MB_FRAME_OVERHEAD)];
+static TU32 g_nStreamPos;
+static TU32 g_nRxLeft;          // bytes the port still hands out in this run
+static TU32 g_nRxChunk;
+static TU32 g_nRxFrames;
+
+static TBool g_bLogOpen = TFalse;
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+#ifdef __GLIBC__
+extern void * __libc_malloc(size_t nSize);
+extern void * __libc_calloc(size_t nCount, size_t nSize);
+extern void * __libc_realloc(void *p, size_t nSize);
+extern void   __libc_free(void *p);
+
+static TU32 g_nAllocs;
+
+void * malloc(size_t nSize)
+{
+    g_nAllocs++;
+    return __libc_malloc(nSize);
+}
+
+void * calloc(size_t nCount, size_t nSize)
+{
+    g_nAllocs++;
+    return __libc_calloc(nCount, nSize);
+}
+
+void * realloc(void *p, size_t nSize)
+{
+    g_nAllocs++;
+    return __libc_realloc(p, nSize);
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+
+#define MB_ALLOCS()             (g_nAllocs)
+#define MB_HAS_ALLOCS           (1)
+#else
+#define MB_ALLOCS()             (0)
+#define MB_HAS_ALLOCS           (0)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// A port with no device
+static TU16 NullSend(void *pBackend, const TU8 *pBuf, TU16 nLen)
+{
+    return nLen;
+}
+
+static TU16 StreamRecv(void *pBackend, TU8 *pBuf, TU16 nBufLen)
+{
+    TU32 nLen = UTIL_MIN(UTIL_MIN((TU32)nBufLen, g_nRxChunk), g_nRxLeft);
+    TU32 nPart;
+
+    g_nRxLeft -= nLen;
+
+    // The stream goes round
+    for (nPart=0; nPart<nLen; )
+    {
+        TU32 n = UTIL_MIN(nLen - nPart, (TU32)sizeof(g_cStream) - g_nStreamPos);
+
+        memcpy(pBuf + nPart, &g_cStream[g_nStreamPos], n);
+        nPart += n;
+        g_nStreamPos = (g_nStreamPos + n) % sizeof(g_cStream);
+    }
+
+    return (TU16)nLen;
+}
+
+static TU32 NullWait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    return nEvents & (UART_EV_READ | UART_EV_WRITE);
+}
+
+static TBool NullSetBaud(void *pBackend, TU32 nBaud)
+{
+    return TTrue;
+}
+
+static void NullClose(void *pBackend)
+{
+}
+
+static const TXcomPortOps g_tNullOps = {
+    NullSend,
+    StreamRecv,
+    NullWait,
+    NullSetBaud,
+    NullClose
+};
+
+static void OnFrame(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    g_nRxFrames++;
+}
+
+static void OpenNullPort(void)
+{
+    xcom_port_init(&g_tPort);
+    g_tPort.pOps = &g_tNullOps;
+    g_tPort.pBackend = NULL;
+    xcom_init(&g_tXcom, &g_tPort, OnFrame, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void FillData(void)
+{
+    TU32 i;
+
+    srand(820);
+    for (i=0; i<sizeof(g_cData); i++) g_cData[i] = (TU8)rand();
+
+    // Depth in the range LOG_PrintData keeps
+    for (i=0; i<MB_DEPTH_RES; i++) g_nDepth[i] = (TU16)(300 + (i * 7) % 1000);
+}
+
+static TU32 BytesParam(TU32 nParam)
+{
+    return nParam;
+}
+
+static TU32 BytesFrame(TU32 nParam)
+{
+    return nParam + MB_FRAME_OVERHEAD;
+}
+
+static TU32 BytesDepth(TU32 nParam)
+{
+    return MB_DEPTH_LEN;
+}
+
+static TU32 BytesDepthFrame(TU32 nParam)
+{
+    return MB_DEPTH_LEN + MB_FRAME_OVERHEAD;
+}
+
+static TU32 BytesLen(TU32 nParam)
+{
+    return g_nLen;
+}
+
+static void SetupNone(TU32 nParam)
+{
+}
+
+// CRC_CalCrc8 over nParam bytes
+static void RunCrc8(TU32 nOps)
+{
+    TU8 nCrc = 0;
+
+    while (nOps--) nCrc = CRC_CalCrc8(g_cData, (TU16)g_nLen, nCrc);
+
+    g_nSink = nCrc;
+}
+
+static void SetupLen(TU32 nParam)
+{
+    g_nLen = nParam;
+}
+
+// xcom_send of an nParam byte payload
+static void SetupSend(TU32 nParam)
+{
+    g_nLen = nParam;
+    OpenNullPort();
+}
+
+static void RunSend(TU32 nOps)
+{
+    while (nOps--) xcom_send(&g_tXcom, g_nId++, RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ, g_cData, (TU16)g_nLen);
+
+    g_nSink = g_tXcom.tStats.nTxFrames;
+}
+
+// xcom_fsm parsing depth reports, nParam bytes a read at most
+static void SetupParse(TU32 nParam)
+{
+    TU8 *p = g_cStream;
+    TU32 i;
+
+    for (i=0; i<MB_STREAM_FRAMES; i++)
+    {
+        p[0] = MB_SYNC;
+        p[1] = MB_VER;
+        p[2] = (TU8)i;
+        p[3] = RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ;
+        p[4] = (TU8)(MB_DEPTH_LEN & 0xFF);
+        p[5] = (TU8)(MB_DEPTH_LEN >> 8);
+        memcpy(&p[MB_HEADER_LEN], g_cData, MB_DEPTH_LEN);
+        MSG_ReportDepthReq_SetTimestamp(&p[MB_HEADER_LEN], i);
+        p[MB_HEADER_LEN + MB_DEPTH_LEN] = CRC_CalCrc8(p, MB_HEADER_LEN + MB_DEPTH_LEN, 0);
+
+        p += MB_DEPTH_LEN + MB_FRAME_OVERHEAD;
+    }
+
+    g_nRxChunk   = nParam;
+    g_nStreamPos = 0;
+    OpenNullPort();
+}
+
+static void RunParse(TU32 nOps)
+{
+    TU32 nFrames = g_nRxFrames + nOps;
+
+    // Whole frames, so that each run ends on a frame boundary
+    g_nRxLeft = nOps * (MB_DEPTH_LEN + MB_FRAME_OVERHEAD);
+    while (g_nRxLeft > 0) xcom_fsm(&g_tXcom);
+
+    if (g_nRxFrames != nFrames) fprintf(stderr, "parse: %lu frames short\n", nFrames - g_nRxFrames);
+}
+
+// UTIL_DEC_* of a depth report, as the wire has it
+static void RunDecode(TU32 nOps)
+{
+    const TU8 *pTail = MSG_TAIL(ReportDepthReq, g_cData);
+    TU32 nSum = 0;
+    TU32 i;
+
+    while (nOps--)
+    {
+        nSum += MSG_ReportDepthReq_Timestamp(g_cData);
+        for (i=0; i<MB_DEPTH_RES; i++) g_nDecoded[i] = UTIL_DEC_TU16_LSBF(pTail + 2 * i);
+        nSum += g_nDecoded[nOps % MB_DEPTH_RES];
+    }
+
+    g_nSink = nSum;
+}
+
+// The conversion of LOG_PrintData, without the file
+static void RunPolar(TU32 nOps)
+{
+    TFloat Delta = 3.1416 / 2 / MB_DEPTH_RES;
+    TU32 i;
+
+    while (nOps--)
+    {
+        for (i=0; i<MB_DEPTH_RES; i++)
+        {
+            g_fX[i] = (TFloat)(g_nDepth[i] * cos(i * Delta));
+            g_fY[i] = (TFloat)(g_nDepth[i] * sin(i * Delta));
+        }
+    }
+
+    g_nSink = (TU32)(g_fX[MB_DEPTH_RES / 2] + g_fY[MB_DEPTH_RES / 2]);
+}
+
+// Logging into /dev/null: formatting and stdio, no disk
+static void SetupLog(TU32 nParam)
+{
+    if (!g_bLogOpen)
+    {
+        LOG_Init(TFalse, "/dev/null", TTrue, LOG_LEVEL_TRACE);
+        g_bLogOpen = TTrue;
+    }
+
+    g_nLen = nParam;
+}
+
+static void RunLogData(TU32 nOps)
+{
+    while (nOps--) LOG_PrintData(g_nDepth, MB_DEPTH_RES, (TU16)nOps);
+}
+
+static void SetupLogPrint(TU32 nParam)
+{
+    char cLine[256];
+
+    SetupLog(nParam);
+    g_nLen = (TU32)snprintf(cLine, sizeof(cLine), "radar_get_info: sn %s, hw %d.%d, fw %d.%d\n", "LM820A00001234", 1, 2, 3, 14);
+}
+
+static void RunLogPrint(TU32 nOps)
+{
+    while (nOps--) LOG_Print(LOG_LEVEL_INFO, "radar_get_info: sn %s, hw %d.%d, fw %d.%d\n", "LM820A00001234", 1, 2, 3, 14);
+}
+
+static void RunLogFrame(TU32 nOps)
+{
+    while (nOps--) LOG_PrintFrame(LOG_LEVEL_TRACE, "UART RX: ", g_cData, (TU16)g_nLen);
+}
+
+// The logging cases come last: they turn the log on, which xcom would use
+static const TMicroCase g_tCases[] = {
+    { "crc8",             "len=7",          7,                      SetupLen,      RunCrc8,     BytesParam      },
+    { "crc8",             "len=64",         64,                     SetupLen,      RunCrc8,     BytesParam      },
+    { "crc8",             "len=2107",       XCOM_MAX_MSG_LEN,       SetupLen,      RunCrc8,     BytesParam      },
+    { "xcom_send",        "payload=0",      0,                      SetupSend,     RunSend,     BytesFrame      },
+    { "xcom_send",        "payload=964",    MB_DEPTH_LEN,           SetupSend,     RunSend,     BytesFrame      },
+    { "xcom_send",        "payload=2100",   XCOM_MAX_PAYLOAD_LEN,   SetupSend,     RunSend,     BytesFrame      },
+    { "xcom_rx_fsm",      "chunk=ring",     TU16_MAX,               SetupParse,    RunParse,    BytesDepthFrame },
+    { "xcom_rx_fsm",      "chunk=64",       MB_SMALL_CHUNK,         SetupParse,    RunParse,    BytesDepthFrame },
+    { "util_dec_depth",   "res=480",        MB_DEPTH_RES,           SetupNone,     RunDecode,   BytesDepth      },
+    { "polar_to_cart",    "res=480",        MB_DEPTH_RES,           SetupNone,     RunPolar,    BytesDepth      },
+    { "log_print_data",   "res=480",        MB_DEPTH_RES,           SetupLog,      RunLogData,  BytesDepth      },
+    { "log_print",        "info",           0,                      SetupLogPrint, RunLogPrint, BytesLen        },
+    { "log_print_frame",  "len=64",         64,                     SetupLog,      RunLogFrame, BytesParam      },
+    { "log_print_frame",  "len=2107",       XCOM_MAX_MSG_LEN,       SetupLog,      RunLogFrame, BytesParam      },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static int CompareDouble(const void *a, const void *b)
+{
+    TDouble x = *(const TDouble *)a;
+    TDouble y = *(const TDouble *)b;
+
+    return (x > y) - (x < y);
+}
+
+static TU64 TimeRun(const TMicroCase *pCase, TU32 nOps)
+{
+    TU64 nStart = TIMER_GetNowNs();
+
+    pCase->fnRun(nOps);
+
+    return TIMER_GetNowNs() - nStart;
+}
+
+// Ops for one repetition of nRepMs, from runs doubling up to MB_CALIBRATE_MS
+static TU32 Calibrate(const TMicroCase *pCase, TU32 nRepMs)
+{
+    TU64 nNs;
+    TU32 nOps = 1;
+
+    while (TTrue)
+    {
+        nNs = TimeRun(pCase, nOps);
+        if (nNs >= (TU64)MB_CALIBRATE_MS * 1000000 || nOps >= TU32_MAX / 2 / 1024) break;
+        nOps *= 2;
+    }
+
+    nNs = UTIL_MAX(nNs, 1);
+
+    return (TU32)UTIL_MAX((TU64)nOps * nRepMs * 1000000 / nNs, 1);
+}
+
+static void RunCase(const TMicroCase *pCase, TU32 nRepMs, TU32 nReps, TBool bFirst)
+{
+    TDouble fNsPerOp[MB_MAX_REPS];
+    TDouble fMedian, fBytes;
+    TU32 nOps, nAllocs, i;
+
+    pCase->fnSetup(pCase->nParam);
+
+    nOps = Calibrate(pCase, nRepMs);
+
+    nAllocs = MB_ALLOCS();
+    for (i=0; i<nReps; i++) fNsPerOp[i] = (TDouble)TimeRun(pCase, nOps) / nOps;
+    nAllocs = MB_ALLOCS() - nAllocs;
+
+    qsort(fNsPerOp, nReps, sizeof(TDouble), CompareDouble);
+    fMedian = fNsPerOp[nReps / 2];
+    fBytes  = (TDouble)pCase->fnBytes(pCase->nParam);
+
+    printf("%s    {\"name\": \"%s\", \"param\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, "
+           "\"bytes_per_op\": %.0f, \"bytes_per_s\": %.0f, \"allocs_per_op\": ",
+           bFirst ? "" : ",\n", pCase->szName, pCase->szParam, nOps, fMedian, fNsPerOp[0],
+           fBytes, fBytes * 1e9 / fMedian);
+
+    if (MB_HAS_ALLOCS) printf("%.4f}", (TDouble)nAllocs / nOps / nReps);
+    else               printf("null}");
+
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    TU32 nRepMs = (argc > 1) ? (TU32)atol(argv[1]) : MB_DEF_REP_MS;
+    TU32 nReps  = (argc > 2) ? (TU32)atol(argv[2]) : MB_DEF_REPS;
+    const char *szFilter = (argc > 3) ? argv[3] : NULL;
+    TBool bFirst = TTrue;
+    TU32 i;
+
+    if (nRepMs == 0 || nReps == 0 || nReps > MB_MAX_REPS)
+    {
+        printf("usage: radar_microbench [ms per rep] [reps, up to %d] [name filter]\n", MB_MAX_REPS);
+        return 1;
+    }
+
+    FillData();
+
+    // The one the cases get, named
+    CRC_SelectImpl(CRC8_IMPL_AUTO);
+
+    printf("{\n  \"bench\": \"radar_microbench\",\n  \"crc8_impl\": \"%s\",\n"
+           "  \"ms_per_rep\": %lu,\n  \"reps\": %lu,\n  \"results\": [\n",
+           CRC_GetImplName(CRC_GetImpl()), nRepMs, nReps);
+
+    for (i=0; i<UTIL_TAB_SIZE(g_tCases); i++)
+    {
+        if (szFilter && !strstr(g_tCases[i].szName, szFilter)) continue;
+
+        RunCase(&g_tCases[i], nRepMs, nReps, bFirst);
+        bFirst = TFalse;
+    }
+
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,449 @@
+#define _GNU_SOURCE
+#include "xcom.h"
+#include "xcom_port.h"
+#include "msg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// LM820 stand-in on a pseudo-terminal: radar_open("/dev/pts/N") talks to it
+// as to the device. It answers every RADAR_CMD_* of msg.h and, once started,
+// streams RADAR_CMD_REPORT_DEPTH at a given rate. The depth is a synthetic
+// pattern, or the frames of a capture written by LOG_Data: "x;y;frame" per
+// point, the points spread over a quarter turn.
+//
+// usage: radar_sim [-l link] [-n max_res] [-f fps] [-p flat|ramp|wave]
+//                  [-c capture] [-e n] [-b baud] [-s serial_num]
+//   -l  also reach the pty through this symlink, e.g. for a fixed name
+//   -e  report an error after every n-th depth frame
+//   -b  pace the depth frames at this line rate, as a real UART would
+#define SIM_DEF_MAX_RES         (480)
+#define SIM_DEF_FPS             (30)
+#define SIM_MAX_RES             ((XCOM_MAX_PAYLOAD_LEN - MSG_LEN_ReportDepthReq) / 2)
+#define SIM_FOV                 (900)       // 0.1 degree, the quarter turn of LOG_Data
+#define SIM_BASE_DEPTH          (1000)      // mm
+#define SIM_DBG_IMG_WIDTH       (1280)
+#define SIM_DBG_IMG_HEIGHT      (800)
+#define SIM_WAIT_SLICE          (100000)    // us, longest port wait
+#define SIM_BITS_PER_BYTE       (10)
+#define SIM_MAX_CAP_FRAMES      (4096)
+
+#define SIM_VER_MAJOR           (1)
+#define SIM_VER_MINOR           (0)
+
+enum {
+    SIM_PATTERN_FLAT = 0,
+    SIM_PATTERN_RAMP,
+    SIM_PATTERN_WAVE,
+    SIM_PATTERN_CAPTURE
+};
+
+enum {
+    SIM_MODE_IDLE = 0,
+    SIM_MODE_TRIG,
+    SIM_MODE_CONT
+};
+
+// One point of a capture: where it falls in the field, 0..1, and its depth
+typedef struct {
+    TFloat fPos;
+    TU16   nDepth;
+} TSimPoint;
+
+typedef struct {
+    TU32   nFirst;          // index in g_pCapPoints
+    TU32   nCount;
+} TSimFrame;
+
+static const char *  g_szPatterns[] = { "flat", "ramp", "wave" };
+
+// Options
+static const char *  g_szLink = NULL;
+static const char *  g_szSerialNum = "SIM0001";
+static TU16          g_nMaxRes = SIM_DEF_MAX_RES;
+static TU32          g_nFps = SIM_DEF_FPS;
+static TU8           g_nPattern = SIM_PATTERN_WAVE;
+static TU32          g_nErrorEvery = 0;
+static TU32          g_nBaud = 0;
+
+// Capture
+static TSimPoint   * g_pCapPoints = NULL;
+static TSimFrame     g_tCapFrames[SIM_MAX_CAP_FRAMES];
+static TU32          g_nCapFrames = 0;
+
+// Device state
+static int           g_fdMaster = -1;
+static UTIL_HANDLE   g_hSlave = INVALID_UTIL_HANDLE;
+static TXcomPortCtx  g_tPort;
+static TXcomCtx      g_tXcom;
+static TU16          g_nRes;
+static TU8           g_nMode = SIM_MODE_IDLE;
+static TU8           g_nPower = 0;
+static TBool         g_bStreaming = TFalse;
+static TU64          g_nNextFrameUs = 0;
+static TU32          g_nStartMs;
+static TU8           g_nReportId = 0;
+static volatile int  g_bRun = 1;
+
+// Counters
+static TU32          g_nRequests = 0;
+static TU32          g_nFrames = 0;
+static TU32          g_nDropped = 0;
+static TU32          g_nErrors = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+static void OnSignal(int nSig)
+{
+    g_bRun = 0;
+}
+
+static TBool LoadCapture(const char *szName)
+{
+    FILE  *fp = fopen(szName, "r");
+    TU32   nPoints = 0, nRoom = 0;
+    TFloat fX, fY;
+    int    nFrame, nLast = -1;
+    TSimPoint *pNew;
+
+    if (!fp) return TFalse;
+
+    while (fscanf(fp, "%f;%f;%d", &fX, &fY, &nFrame) == 3)
+    {
+        if (nFrame != nLast)
+        {
+            if (g_nCapFrames == SIM_MAX_CAP_FRAMES) break;
+
+            g_tCapFrames[g_nCapFrames].nFirst = nPoints;
+            g_tCapFrames[g_nCapFrames].nCount = 0;
+            g_nCapFrames++;
+            nLast = nFrame;
+        }
+
+        if (nPoints == nRoom)
+        {
+            nRoom = nRoom ? nRoom * 2 : 4096;
+            pNew = (TSimPoint *)realloc(g_pCapPoints, nRoom * sizeof(TSimPoint));
+            if (!pNew) break;
+            g_pCapPoints = pNew;
+        }
+
+        // Back to polar: LOG_Data wrote point i at i * (pi/2) / size
+        g_pCapPoints[nPoints].fPos   = (TFloat)(atan2(fY, fX) / (M_PI / 2));
+        g_pCapPoints[nPoints].nDepth = (TU16)(sqrt(fX * fX + fY * fY) + 0.5);
+        g_tCapFrames[g_nCapFrames - 1].nCount++;
+        nPoints++;
+    }
+
+    fclose(fp);
+
+    return (TBool)(g_nCapFrames > 0);
+}
+
+static void RenderDepth(TU8 *pOut, TU32 nFrame)
+{
+    const TSimFrame *pFrame;
+    TU16 nDepth;
+    TU32 i, nIdx;
+
+    if (g_nPattern == SIM_PATTERN_CAPTURE)
+    {
+        memset(pOut, 0, g_nRes * 2);
+
+        // Points fall on the nearest step of the current resolution
+        pFrame = &g_tCapFrames[nFrame % g_nCapFrames];
+        for (i=0; i<pFrame->nCount; i++)
+        {
+            nIdx = (TU32)(g_pCapPoints[pFrame->nFirst + i].fPos * g_nRes);
+            if (nIdx < g_nRes) UTIL_ENC_TU16_LSBF(pOut + nIdx * 2, g_pCapPoints[pFrame->nFirst + i].nDepth);
+        }
+        return;
+    }
+
+    for (i=0; i<g_nRes; i++)
+    {
+        switch (g_nPattern)
+        {
+        case SIM_PATTERN_RAMP:
+            nDepth = (TU16)(200 + i * 1300 / g_nRes);
+            break;
+        case SIM_PATTERN_WAVE:
+            nDepth = (TU16)(SIM_BASE_DEPTH + 300 * sin(6 * M_PI * i / g_nRes + nFrame * 0.1));
+            break;
+        default:
+            nDepth = SIM_BASE_DEPTH;
+            break;
+        }
+
+        UTIL_ENC_TU16_LSBF(pOut + i * 2, nDepth);
+    }
+}
+
+// Device time: ms since start, wrapping like the one of the device
+static TU32 DeviceTime(void)
+{
+    return TIMER_GetNow() - g_nStartMs;
+}
+
+static void SendDepth(void)
+{
+    TU8  cBuf[XCOM_MAX_PAYLOAD_LEN];
+    TU16 nLen = (TU16)(MSG_LEN_ReportDepthReq + g_nRes * 2);
+    TU64 nPeriod = 1000000 / g_nFps;
+    TU64 nWire;
+
+    MSG_ReportDepthReq_SetTimestamp(cBuf, DeviceTime());
+    RenderDepth(MSG_TAIL(ReportDepthReq, cBuf), g_nFrames);
+
+    if (xcom_send(&g_tXcom, g_nReportId++, (TU8)(RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ), cBuf, nLen))
+    {
+        g_nFrames++;
+    }
+    else
+    {
+        // The host does not read: the TX queue is full
+        g_nDropped++;
+    }
+
+    if (g_nErrorEvery > 0 && g_nFrames > 0 && (g_nFrames % g_nErrorEvery) == 0)
+    {
+        if (xcom_send(&g_tXcom, g_nReportId++, (TU8)(RADAR_CMD_REPORT_ERROR | CMD_BIT_REQ), NULL, 0)) g_nErrors++;
+    }
+
+    // No faster than the line carries the frame
+    if (g_nBaud > 0)
+    {
+        nWire = (TU64)(nLen + XCOM_MAX_MSG_LEN - XCOM_MAX_PAYLOAD_LEN) * SIM_BITS_PER_BYTE * 1000000 / g_nBaud;
+        nPeriod = UTIL_MAX(nPeriod, nWire);
+    }
+
+    g_nNextFrameUs += nPeriod;
+
+    // Fell behind, e.g. while blocked: do not burst to catch up
+    if (g_nNextFrameUs < TIMER_GetNowUs()) g_nNextFrameUs = TIMER_GetNowUs();
+}
+
+static void OnRequest(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    TU8  cRsp[XCOM_MAX_PAYLOAD_LEN];
+    TU16 nRspLen = 0;
+    TU16 nRes;
+    TU32 nOffset, nSize = SIM_DBG_IMG_WIDTH * SIM_DBG_IMG_HEIGHT, i;
+
+    if ((nCmd & CMD_MASK_REQ_RSP) != CMD_BIT_REQ) return;
+
+    nCmd &= ~CMD_MASK_REQ_RSP;
+    g_nRequests++;
+
+    switch (nCmd)
+    {
+    case RADAR_CMD_INIT:
+        g_bStreaming = TFalse;
+        break;
+    case RADAR_CMD_GET_INFO:
+        memset(cRsp, 0, MSG_LEN_GetInfoRsp);
+        MSG_GetInfoRsp_SetMajorVer(cRsp, SIM_VER_MAJOR);
+        MSG_GetInfoRsp_SetMinorVer(cRsp, SIM_VER_MINOR);
+        strncpy((char *)MSG_GetInfoRsp_SerialNum(cRsp), g_szSerialNum, MSG_FIELD_SIZE(GetInfoRsp, SerialNum) - 1);
+        strncpy((char *)MSG_GetInfoRsp_Name(cRsp), "LM820 Simulator", MSG_FIELD_SIZE(GetInfoRsp, Name) - 1);
+        nRspLen = MSG_LEN_GetInfoRsp;
+        break;
+    case RADAR_CMD_SET_LD:
+        if (!MSG_CHECK_LEN(SetLdReq, nLen)) return;
+        g_nPower = MSG_SetLdReq_Power(pBuf);
+        MSG_SetLdRsp_SetPower(cRsp, g_nPower);
+        nRspLen = MSG_LEN_SetLdRsp;
+        break;
+    case RADAR_CMD_SET_MODE:
+        if (!MSG_CHECK_LEN(SetModeReq, nLen)) return;
+        if (MSG_SetModeReq_Mode(pBuf) <= SIM_MODE_CONT) g_nMode = MSG_SetModeReq_Mode(pBuf);
+        MSG_SetModeRsp_SetMode(cRsp, g_nMode);
+        nRspLen = MSG_LEN_SetModeRsp;
+        break;
+    case RADAR_CMD_SET_RES:
+        if (!MSG_CHECK_LEN(SetResReq, nLen)) return;
+        // max, max/2, max/4 or max/8; the response tells the one in use
+        nRes = MSG_SetResReq_DepthSize(pBuf);
+        if (nRes == g_nMaxRes || nRes == g_nMaxRes / 2 || nRes == g_nMaxRes / 4 || nRes == g_nMaxRes / 8) g_nRes = nRes;
+        MSG_SetResRsp_SetDepthSize(cRsp, g_nRes);
+        nRspLen = MSG_LEN_SetResRsp;
+        break;
+    case RADAR_CMD_GET_FOV:
+        MSG_GetFovRsp_SetFov(cRsp, SIM_FOV);
+        nRspLen = MSG_LEN_GetFovRsp;
+        break;
+    case RADAR_CMD_GET_MAX_RES:
+        MSG_GetMaxResRsp_SetMaxRes(cRsp, g_nMaxRes);
+        nRspLen = MSG_LEN_GetMaxResRsp;
+        break;
+    case RADAR_CMD_TRIG_DEPTH:
+        // An empty response when not in TRIG mode: no depth ready
+        if (g_nMode == SIM_MODE_TRIG)
+        {
+            MSG_TrigDepthRsp_SetTimestamp(cRsp, DeviceTime());
+            RenderDepth(MSG_TAIL(TrigDepthRsp, cRsp), g_nFrames++);
+            nRspLen = (TU16)(MSG_LEN_TrigDepthRsp + g_nRes * 2);
+        }
+        break;
+    case RADAR_CMD_START_DEPTH:
+        g_bStreaming = TTrue;
+        g_nNextFrameUs = TIMER_GetNowUs();
+        break;
+    case RADAR_CMD_STOP_DEPTH:
+        g_bStreaming = TFalse;
+        break;
+    case RADAR_CMD_TAKE_DBG_IMG:
+        MSG_TakeDbgImgRsp_SetWidth(cRsp, SIM_DBG_IMG_WIDTH);
+        MSG_TakeDbgImgRsp_SetHeight(cRsp, SIM_DBG_IMG_HEIGHT);
+        nRspLen = MSG_LEN_TakeDbgImgRsp;
+        break;
+    case RADAR_CMD_READ_DBG_IMG:
+        if (!MSG_CHECK_LEN(ReadDbgImgReq, nLen)) return;
+        // Short, then empty, past the end of the image
+        nOffset = MSG_ReadDbgImgReq_Offset(pBuf);
+        nRspLen = (TU16)UTIL_MIN(MSG_ReadDbgImgReq_Len(pBuf), XCOM_MAX_PAYLOAD_LEN);
+        nRspLen = (TU16)((nOffset >= nSize) ? 0 : UTIL_MIN(nRspLen, nSize - nOffset));
+        for (i=0; i<nRspLen; i++)
+        {
+            cRsp[i] = (TU8)(((nOffset + i) % SIM_DBG_IMG_WIDTH) ^ ((nOffset + i) / SIM_DBG_IMG_WIDTH));
+        }
+        break;
+    default:
+        // Unknown to the device: no response
+        return;
+    }
+
+    if (!xcom_send(&g_tXcom, nId, nCmd, cRsp, nRspLen)) g_nDropped++;
+}
+
+static TBool OpenPty(char *szSlave, TU32 nSlaveLen)
+{
+    char *szName;
+
+    g_fdMaster = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (g_fdMaster < 0 || grantpt(g_fdMaster) < 0 || unlockpt(g_fdMaster) < 0) return TFalse;
+
+    szName = ptsname(g_fdMaster);
+    if (!szName) return TFalse;
+
+    strncpy(szSlave, szName, nSlaveLen - 1);
+    szSlave[nSlaveLen - 1] = '\0';
+
+    // Kept open, in raw mode, so that the pty does not hang up between hosts
+    g_hSlave = UART_Init(szSlave);
+    if (g_hSlave == INVALID_UTIL_HANDLE) return TFalse;
+
+    xcom_port_init(&g_tPort);
+    g_tPort.hPort = (UTIL_HANDLE)g_fdMaster;
+
+    return xcom_init(&g_tXcom, &g_tPort, OnRequest, NULL);
+}
+
+static int ParseArgs(int argc, char *argv[])
+{
+    int i;
+    TU8 j;
+
+    for (i=1; i<argc; i++)
+    {
+        if (i + 1 >= argc) return -1;
+
+        if (strcmp(argv[i], "-l") == 0)      g_szLink = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0) g_nMaxRes = (TU16)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0) g_nFps = (TU32)atol(argv[++i]);
+        else if (strcmp(argv[i], "-e") == 0) g_nErrorEvery = (TU32)atol(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0) g_nBaud = (TU32)atol(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0) g_szSerialNum = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            if (!LoadCapture(argv[++i]))
+            {
+                printf("no frames in capture [%s]\n", argv[i]);
+                return -1;
+            }
+            g_nPattern = SIM_PATTERN_CAPTURE;
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            i++;
+            for (j=0; j<UTIL_TAB_SIZE(g_szPatterns) && strcmp(argv[i], g_szPatterns[j]) != 0; j++);
+            if (j == UTIL_TAB_SIZE(g_szPatterns)) return -1;
+            g_nPattern = j;
+        }
+        else return -1;
+    }
+
+    if (g_nMaxRes == 0 || g_nMaxRes > SIM_MAX_RES || g_nFps == 0) return -1;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char szSlave[64];
+    TU64 nNow, nWait;
+    TU32 nEvents;
+
+    if (ParseArgs(argc, argv) < 0)
+    {
+        printf("usage: radar_sim [-l link] [-n max_res] [-f fps] [-p flat|ramp|wave] [-c capture] [-e n] [-b baud] [-s serial_num]\n");
+        return 1;
+    }
+
+    if (!OpenPty(szSlave, sizeof(szSlave)))
+    {
+        printf("pty failed!\n");
+        return 1;
+    }
+
+    if (g_szLink)
+    {
+        unlink(g_szLink);
+        if (symlink(szSlave, g_szLink) < 0) printf("link [%s] failed!\n", g_szLink);
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+
+    g_nRes = g_nMaxRes;
+    g_nStartMs = TIMER_GetNow();
+
+    // The name first and alone on its line, for scripts
+    printf("%s\n", szSlave);
+    fflush(stdout);
+
+    while (g_bRun)
+    {
+        nNow = TIMER_GetNowUs();
+
+        if (g_bStreaming && g_nMode == SIM_MODE_CONT && nNow >= g_nNextFrameUs) SendDepth();
+
+        nWait = SIM_WAIT_SLICE;
+        if (g_bStreaming && g_nMode == SIM_MODE_CONT)
+        {
+            nNow  = TIMER_GetNowUs();
+            nWait = (g_nNextFrameUs > nNow) ? UTIL_MIN(g_nNextFrameUs - nNow, nWait) : 0;
+        }
+
+        nEvents = UART_EV_READ;
+        if (xcom_tx_pending(&g_tXcom) > 0) nEvents |= UART_EV_WRITE;
+
+        if (UART_Wait(g_tPort.hPort, nEvents, (TU32)nWait) & UART_EV_ERROR) break;
+
+        xcom_fsm(&g_tXcom);
+    }
+
+    if (g_szLink) unlink(g_szLink);
+
+    printf("requests %lu, depth frames %lu, errors %lu, dropped %lu\n", g_nRequests, g_nFrames, g_nErrors, g_nDropped);
+
+    UART_Close(g_hSlave);
+    close(g_fdMaster);
+    free(g_pCapPoints);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "radar_ops.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Command round trip time of a device, with the port as opened by default,
+// then with the low latency tunings of radar_open_tuned(). USB-serial
+// adapters hold RX bytes up to their latency timer, 16 ms on FTDI, which
+// shows up here as the gap between the two runs.
+//
+// usage: rtt_bench port [baud] [count]
+#define RTT_DEF_COUNT           (200)
+#define RTT_MAX_COUNT           (10000)
+
+typedef struct {
+    const char * szName;
+    TU32         nTunings;
+} TRttMode;
+
+static const TRttMode g_tModes[] = {
+    { "default",     0             },
+    { "low latency", UART_TUNE_ALL },
+};
+
+static TU32 g_nRtt[RTT_MAX_COUNT];
+
+////////////////////////////////////////////////////////////////////////////////
+static int CompareU32(const void *a, const void *b)
+{
+    TU32 x = *(const TU32 *)a;
+    TU32 y = *(const TU32 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void PrintTunings(TU32 nWanted, TU32 nApplied)
+{
+    printf("  tunings:");
+    if (nWanted == 0) printf(" none");
+    if (nWanted & UART_TUNE_LOW_LATENCY)   printf(" low_latency %s", (nApplied & UART_TUNE_LOW_LATENCY) ? "on" : "n/a");
+    if (nWanted & UART_TUNE_LATENCY_TIMER) printf(", latency_timer %s", (nApplied & UART_TUNE_LATENCY_TIMER) ? "on" : "n/a");
+    if (nWanted & UART_TUNE_WAKE_LEN)      printf(", wake_len %s", (nApplied & UART_TUNE_WAKE_LEN) ? "on" : "n/a");
+    printf("\n");
+}
+
+// Returns TFalse if a command failed
+static TBool RunCmd(TRadarCtx *pCtx, const char *szCmd, TU32 nCount)
+{
+    TDevInfo tInfo;
+    TU64 nStart, nSum = 0;
+    TU32 i;
+    int  nRet;
+
+    for (i=0; i<nCount; i++)
+    {
+        nStart = TIMER_GetNowUs();
+        nRet = (szCmd[0] == 'I') ? radar_init_ex(pCtx) : radar_get_info_ex(pCtx, &tInfo);
+        g_nRtt[i] = (TU32)(TIMER_GetNowUs() - nStart);
+
+        if (nRet != RADAR_ERROR_SUCCESS)
+        {
+            printf("  %-8s failed at %lu: %d\n", szCmd, i, nRet);
+            return TFalse;
+        }
+
+        nSum += g_nRtt[i];
+    }
+
+    qsort(g_nRtt, nCount, sizeof(TU32), CompareU32);
+
+    printf("  %-8s us: min %6lu  avg %6lu  p50 %6lu  p99 %6lu  max %6lu\n", szCmd,
+           g_nRtt[0], (TU32)(nSum / nCount), g_nRtt[nCount / 2],
+           g_nRtt[(nCount * 99) / 100], g_nRtt[nCount - 1]);
+
+    return TTrue;
+}
+
+int main(int argc, char *argv[])
+{
+    TRadarCtx *pCtx = (TRadarCtx *)calloc(1, sizeof(TRadarCtx));
+    TU32 nBaud  = (argc > 2) ? (TU32)atol(argv[2]) : RADAR_DEF_BAUD;
+    TU32 nCount = (argc > 3) ? (TU32)atol(argv[3]) : RTT_DEF_COUNT;
+    TU32 i;
+    int  nFail = 0;
+
+    if (argc < 2 || !pCtx)
+    {
+        printf("usage: rtt_bench port [baud] [count]\n");
+        return 1;
+    }
+
+    nCount = UTIL_MAX(1, UTIL_MIN(nCount, RTT_MAX_COUNT));
+
+    for (i=0; i<UTIL_TAB_SIZE(g_tModes); i++)
+    {
+        if (radar_open_tuned_ex(pCtx, argv[1], nBaud, g_tModes[i].nTunings) != RADAR_ERROR_SUCCESS)
+        {
+            printf("open [%s] failed!\n", argv[1]);
+            nFail++;
+            continue;
+        }
+
+        printf("%s, %lu baud, %lu round trips\n", g_tModes[i].szName, radar_get_baud_ex(pCtx), nCount);
+        PrintTunings(g_tModes[i].nTunings, radar_get_tunings_ex(pCtx));
+
+        if (!RunCmd(pCtx, "INIT", nCount))     nFail++;
+        if (!RunCmd(pCtx, "GET_INFO", nCount)) nFail++;
+
+        // Leave the laser as it is: only the port is closed
+        xcom_port_close(&pCtx->tPort);
+        pCtx->bOpened = TFalse;
+    }
+
+    free(pCtx);
+
+    return nFail ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+#include "hal.h"
+#include "xcom_sock.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Serves a serial port on a TCP or UDP port, for radar_open("tcp://...")
+// or "udp://..." from another machine, or from this one against radar_sim:
+//
+//   radar_sim                          -> prints /dev/pts/N
+//   sock_bridge tcp 5000 /dev/pts/N
+//   rtt_bench tcp://127.0.0.1:5000
+//
+// It takes one client at a time, sets up the socket as the client end does
+// and forwards the bytes as they come until the client goes away, then
+// waits for the next one. UDP has no hang up: the bridge answers whoever
+// sent last. The serial
+// port is opened with the low latency tunings so that the bridge adds
+// little to the round trip.
+//
+// usage: sock_bridge tcp|udp port serial_port [baud]
+#define BRIDGE_BUF_SIZE         (4096)
+#define BRIDGE_WAIT_US          (100000)
+#define BRIDGE_WAIT_MS          (100)
+
+static UTIL_HANDLE    g_hSock = INVALID_UTIL_HANDLE;
+static UTIL_HANDLE    g_hUart = INVALID_UTIL_HANDLE;
+static volatile TBool g_bRun  = TFalse;
+static volatile TBool g_bUartDone = TFalse;
+static TU32           g_nBytes[2];      // to the serial port, to the socket
+
+////////////////////////////////////////////////////////////////////////////////
+// Serial port to socket
+static void * UartThread(void *pParam)
+{
+    TU8  cBuf[BRIDGE_BUF_SIZE];
+    TU32 nLen;
+
+    while (g_bRun)
+    {
+        if (UART_Wait(g_hUart, UART_EV_READ, BRIDGE_WAIT_US) & UART_EV_ERROR) break;
+
+        nLen = UART_Read(g_hUart, cBuf, sizeof(cBuf));
+        if (nLen == 0) continue;
+
+        if (SOCK_Write(g_hSock, cBuf, (TS32)nLen) < 0) break;
+        g_nBytes[1] += nLen;
+    }
+
+    g_bRun = TFalse;
+    g_bUartDone = TTrue;
+
+    return NULL;
+}
+
+// One client, until it goes away
+static void Serve(const SOCK_CONFIG *pCfg, char *argv[])
+{
+    TU8  cBuf[BRIDGE_BUF_SIZE];
+    TU32 nApplied;
+    TS32 nLen;
+
+    // Waits for the client
+    g_hSock = SOCK_OpenEx(0, (TU16)atol(argv[2]), pCfg, &nApplied);
+    if (g_hSock == INVALID_UTIL_HANDLE)
+    {
+        printf("%s port %s failed!\n", argv[1], argv[2]);
+        exit(1);
+    }
+
+    printf("%s client on port %s <-> %s, nodelay %s, buffers %s\n", argv[1], argv[2], argv[3],
+           (nApplied & SOCK_TUNE_NODELAY) ? "on" : "n/a", (nApplied & SOCK_TUNE_BUF_SIZE) ? "on" : "n/a");
+
+    g_nBytes[0] = g_nBytes[1] = 0;
+    g_bRun      = TTrue;
+    g_bUartDone = TFalse;
+
+    if (THREAD_Create(UartThread, NULL) == INVALID_UTIL_HANDLE)
+    {
+        printf("thread failed!\n");
+        exit(1);
+    }
+
+    // Socket to serial port
+    while (g_bRun)
+    {
+        nLen = SOCK_Read(g_hSock, cBuf, sizeof(cBuf), BRIDGE_WAIT_MS);
+        if (nLen < 0) break;
+        if (nLen == 0) continue;
+
+        UART_Write(g_hUart, cBuf, (TU32)nLen);
+        g_nBytes[0] += (TU32)nLen;
+    }
+
+    g_bRun = TFalse;
+    while (!g_bUartDone) UTIL_Sleep(1);
+
+    printf("client gone: %lu bytes to %s, %lu bytes back\n", g_nBytes[0], argv[3], g_nBytes[1]);
+
+    SOCK_Close(g_hSock);
+}
+
+int main(int argc, char *argv[])
+{
+    SOCK_CONFIG tSockCfg;
+    UART_CONFIG tUartCfg;
+
+    if (argc < 4 || (strcmp(argv[1], "tcp") != 0 && strcmp(argv[1], "udp") != 0))
+    {
+        printf("usage: sock_bridge tcp|udp port serial_port [baud]\n");
+        return 1;
+    }
+
+    memset(&tUartCfg, 0, sizeof(tUartCfg));
+    tUartCfg.nBaud    = (argc > 4) ? (TU32)atol(argv[4]) : 0;
+    tUartCfg.nTunings = UART_TUNE_ALL;
+
+    g_hUart = UART_InitEx(argv[3], &tUartCfg, NULL);
+    if (g_hUart == INVALID_UTIL_HANDLE)
+    {
+        printf("open [%s] failed!\n", argv[3]);
+        return 1;
+    }
+
+    memset(&tSockCfg, 0, sizeof(tSockCfg));
+    tSockCfg.nType      = (strcmp(argv[1], "udp") == 0) ? SOCK_TYPE_UDP : SOCK_TYPE_TCP;
+    tSockCfg.nTunings   = SOCK_TUNE_ALL;
+    tSockCfg.nRxBufSize = XCOM_SOCK_TX_BUF_SIZE;    // the requests of the client
+    tSockCfg.nTxBufSize = XCOM_SOCK_RX_BUF_SIZE;    // what the device sends back
+
+    // Until killed
+    while (TTrue) Serve(&tSockCfg, argv);
+
+    return 0;
+}
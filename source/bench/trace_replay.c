@@ -0,0 +1,86 @@
+#include "xcom.h"
+#include "xcom_port.h"
+#include "xcom_trace.h"
+#include "msg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Replays a "UART TX:"/"UART RX:" trace such as a.txt through the xcom parser,
+// playing the host side from the trace: each logged request is sent, then
+// the logged device bytes are parsed. As fast as the parser goes, or at the
+// pacing of the trace. To replay through the API instead, give the same
+// port name to radar_clt. The client must then send exactly the requests
+// of the trace, so it needs the options of the recorded session, e.g. for
+// a.txt: radar_clt -p trace:a.txt -s 120 -b 50. A response whose request
+// never comes is held back, and the client only sees timeouts from there.
+//
+// usage: trace_replay trace [paced]
+#define REPLAY_WAIT_US          (100000)
+
+static TU32 g_nFrames[2];   // responses, reports
+
+////////////////////////////////////////////////////////////////////////////////
+static void OnFrame(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    g_nFrames[(nCmd & CMD_MASK_REQ_RSP) ? 1 : 0]++;
+}
+
+int main(int argc, char *argv[])
+{
+    static TXcomCtx tXcom;
+    TXcomPortCtx    tPort;
+    TXcomTraceStats tTrace;
+    TXcomStats      tStats;
+    char  szPort[512];
+    const TU8 *pTx;
+    TU64  nStart, nUs;
+    TU16  nLen;
+
+    if (argc < 2)
+    {
+        printf("usage: trace_replay trace [paced]\n");
+        return 1;
+    }
+
+    snprintf(szPort, sizeof(szPort), "trace:%s%s", argv[1], (argc > 2) ? XCOM_TRACE_PACED : "");
+
+    xcom_port_init(&tPort);
+    if (!xcom_port_open(&tPort, (TU8 *)szPort))
+    {
+        printf("open [%s] failed!\n", szPort);
+        return 1;
+    }
+
+    xcom_init(&tXcom, &tPort, OnFrame, NULL);
+
+    nStart = TIMER_GetNowUs();
+
+    // Until the trace hangs up
+    while (TTrue)
+    {
+        nLen = xcom_trace_next_tx(&tPort, &pTx);
+        if (nLen > 0) xcom_port_send(&tPort, (TU8 *)pTx, nLen);
+
+        if (xcom_port_wait(&tPort, UART_EV_READ, REPLAY_WAIT_US) & UART_EV_ERROR) break;
+
+        xcom_fsm(&tXcom);
+    }
+
+    nUs = UTIL_MAX(TIMER_GetNowUs() - nStart, 1);
+
+    xcom_get_stats(&tXcom, &tStats);
+    xcom_trace_get_stats(&tPort, &tTrace);
+
+    printf("%s: %lu RX bytes, %lu responses, %lu reports in %.3f ms\n", argv[1],
+           tStats.nRxBytes, g_nFrames[0], g_nFrames[1], nUs / 1000.0);
+    printf("  %.1f MB/s, %.0f frames/s\n", tStats.nRxBytes / (TDouble)nUs,
+           (g_nFrames[0] + g_nFrames[1]) * 1e6 / nUs);
+    printf("  crc errors %lu, rejected headers %lu, skipped bytes %lu, TX diffs %lu\n",
+           tStats.nRxCrcErrors, tStats.nRxHeaderRejects, tStats.nRxSkipBytes, tTrace.nTxDiffs);
+
+    xcom_port_close(&tPort);
+
+    return 0;
+}
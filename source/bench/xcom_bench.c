@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include "xcom.h"
+#include "xcom_port.h"
+#include "msg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+// Parse throughput and robustness of xcom_rx_fsm. A synthetic stream of depth
+// reports, mixed with faults, is fed through a pipe in random chunks, as a
+// stand-in for the UART driver. Only the time spent in xcom_fsm is counted.
+//
+// usage: xcom_bench [frames] [fault %] [seed]
+#define BENCH_DEF_FRAMES        (20000)
+#define BENCH_DEF_FAULT_PCT     (5)
+
+#define BENCH_SYNC              (0xA5)
+#define BENCH_VER               (0x04)
+#define BENCH_MAX_NOISE         (64)
+
+enum {
+    FAULT_BIT_FLIP = 0,     // a frame with 1 to 3 bits flipped
+    FAULT_TRUNCATED,        // a frame cut short after its header
+    FAULT_BOGUS_SYNC,       // noise full of SYNC and VER bytes
+    FAULT_LEN_OVER_MAX,     // a header with LEN above the max payload
+    FAULT_NUM
+};
+
+static const char * g_szFaultName[FAULT_NUM] = { "bit flip", "truncated", "bogus sync", "len over max" };
+static const TU16   g_nDepthPoints[] = { 160, 320, 480, 640, 1000 };
+static const TU32   g_nChunkMax[] = { 16, 256, 4096 };
+
+// Stream under test
+static TU8  * g_pStream = NULL;
+static TU32   g_nStreamLen = 0;
+
+// Intact frames, by sequence number carried in the timestamp field
+typedef struct {
+    TU32 nOffset;       // where the frame starts in the stream
+    TU16 nLen;          // payload length
+    TU32 nRxAt;         // bytes received when it was delivered, 0 if never
+} TBenchFrame;
+
+static TBenchFrame * g_pFrames = NULL;
+static TU32          g_nFrames = 0;
+
+// Faults, by start offset in the stream
+static TU32 * g_pFaults = NULL;
+static TU32   g_nFaults = 0;
+static TU32   g_nFaultCnt[FAULT_NUM];
+
+static TU32 g_nRandState = 0x12345678;
+
+// Per run results
+static TXcomCtx     g_tXcom;
+static TXcomPortCtx g_tPort;
+static TU32         g_nFalse = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+static TU32 Rand32(void)
+{
+    g_nRandState ^= g_nRandState << 13;
+    g_nRandState ^= g_nRandState >> 17;
+    g_nRandState ^= g_nRandState << 5;
+
+    return g_nRandState;
+}
+
+static TU8 PayloadByte(TU32 nSeq, TU16 i)
+{
+    return (TU8)(nSeq * 31 + i * 7);
+}
+
+static TU32 PutFrame(TU8 *p, TU32 nSeq, TU16 nPoints)
+{
+    TU16 nLen = (TU16)(MSG_LEN_ReportDepthReq + 2 * nPoints);
+    TU16 i;
+
+    p[0] = BENCH_SYNC;
+    p[1] = BENCH_VER;
+    p[2] = 0;
+    p[3] = RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ;
+    p[4] = (TU8)(nLen & 0xFF);
+    p[5] = (TU8)(nLen >> 8);
+
+    MSG_ReportDepthReq_SetTimestamp(&p[6], nSeq);
+    for (i=MSG_LEN_ReportDepthReq; i<nLen; i++) p[6+i] = PayloadByte(nSeq, i);
+
+    p[6+nLen] = CRC_CalCrc8(p, (TU16)(6+nLen), 0);
+
+    return 7 + (TU32)nLen;
+}
+
+static void AddFault(TU8 nType)
+{
+    TU8 *p = g_pStream + g_nStreamLen;
+    TU32 nLen = 0;
+    TU32 i, nFlips;
+    TU16 nBadLen;
+
+    g_pFaults[g_nFaults++] = g_nStreamLen;
+    g_nFaultCnt[nType]++;
+
+    switch (nType)
+    {
+    case FAULT_BIT_FLIP:
+        // Sequence numbers of damaged frames are never handed out as intact
+        nLen = PutFrame(p, 0xFFFFFFFF, g_nDepthPoints[Rand32() % UTIL_TAB_SIZE(g_nDepthPoints)]);
+        nFlips = 1 + Rand32() % 3;
+        for (i=0; i<nFlips; i++) p[Rand32() % nLen] ^= (TU8)(1 << (Rand32() % 8));
+        break;
+
+    case FAULT_TRUNCATED:
+        nLen = PutFrame(p, 0xFFFFFFFF, g_nDepthPoints[Rand32() % UTIL_TAB_SIZE(g_nDepthPoints)]);
+        nLen = 6 + Rand32() % (nLen - 6);
+        break;
+
+    case FAULT_BOGUS_SYNC:
+        nLen = 1 + Rand32() % BENCH_MAX_NOISE;
+        for (i=0; i<nLen; i++)
+        {
+            switch (Rand32() % 3)
+            {
+            case 0:  p[i] = BENCH_SYNC; break;
+            case 1:  p[i] = BENCH_VER; break;
+            default: p[i] = (TU8)Rand32(); break;
+            }
+        }
+        break;
+
+    default:
+        nBadLen = (TU16)(XCOM_MAX_PAYLOAD_LEN + 1 + Rand32() % (0xFFFF - XCOM_MAX_PAYLOAD_LEN));
+        p[0] = BENCH_SYNC;
+        p[1] = BENCH_VER;
+        p[2] = (TU8)Rand32();
+        p[3] = RADAR_CMD_REPORT_DEPTH | CMD_BIT_REQ;
+        p[4] = (TU8)(nBadLen & 0xFF);
+        p[5] = (TU8)(nBadLen >> 8);
+        nLen = 6 + Rand32() % BENCH_MAX_NOISE;
+        for (i=6; i<nLen; i++) p[i] = (TU8)Rand32();
+        break;
+    }
+
+    g_nStreamLen += nLen;
+}
+
+static TBool BuildStream(TU32 nFrames, TU32 nFaultPct)
+{
+    TU32 i;
+    TU16 nPoints;
+
+    g_pStream = (TU8 *)malloc((size_t)nFrames * 2 * XCOM_MAX_MSG_LEN);
+    g_pFrames = (TBenchFrame *)malloc(nFrames * sizeof(TBenchFrame));
+    g_pFaults = (TU32 *)malloc(nFrames * sizeof(TU32));
+    if (!g_pStream || !g_pFrames || !g_pFaults) return TFalse;
+
+    for (i=0; i<nFrames; i++)
+    {
+        if (Rand32() % 100 < nFaultPct) AddFault((TU8)(Rand32() % FAULT_NUM));
+
+        nPoints = g_nDepthPoints[Rand32() % UTIL_TAB_SIZE(g_nDepthPoints)];
+
+        g_pFrames[g_nFrames].nOffset = g_nStreamLen;
+        g_pFrames[g_nFrames].nLen    = (TU16)(MSG_LEN_ReportDepthReq + 2 * nPoints);
+        g_nStreamLen += PutFrame(g_pStream + g_nStreamLen, g_nFrames, nPoints);
+        g_nFrames++;
+    }
+
+    return TTrue;
+}
+
+static void OnFrame(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+{
+    TU32 nSeq;
+    TU16 i;
+
+    if (nLen < MSG_LEN_ReportDepthReq)
+    {
+        g_nFalse++;
+        return;
+    }
+
+    // Anything that is not an intact frame, seen for the first time, is false
+    nSeq = MSG_ReportDepthReq_Timestamp(pBuf);
+
+    if (nSeq >= g_nFrames || g_pFrames[nSeq].nRxAt != 0 || g_pFrames[nSeq].nLen != nLen)
+    {
+        g_nFalse++;
+        return;
+    }
+
+    for (i=MSG_LEN_ReportDepthReq; i<nLen; i++)
+    {
+        if (pBuf[i] != PayloadByte(nSeq, i))
+        {
+            g_nFalse++;
+            return;
+        }
+    }
+
+    g_pFrames[nSeq].nRxAt = g_tXcom.tStats.nRxBytes;
+}
+
+static double NowSec(void)
+{
+    struct timespec tNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &tNow);
+
+    return tNow.tv_sec + tNow.tv_nsec / 1e9;
+}
+
+static void RunChunks(TU32 nChunkMax, TU32 nFaultPct)
+{
+    int    fd[2];
+    TU32   nSent = 0;
+    TU32   nChunk;
+    ssize_t nRet;
+    double fStart, fParse = 0;
+    TU32   i, k, nRecovered = 0;
+    TU32   nLatency, nLatencyMax = 0;
+    double fLatencySum = 0;
+    TU32   nLatencyCnt = 0;
+
+    if (pipe2(fd, O_NONBLOCK) < 0)
+    {
+        printf("pipe failed\n");
+        return;
+    }
+
+    fcntl(fd[1], F_SETPIPE_SZ, 1 << 20);
+
+    for (i=0; i<g_nFrames; i++) g_pFrames[i].nRxAt = 0;
+    g_nFalse = 0;
+
+    // The read end stands in for the UART driver
+    xcom_port_init(&g_tPort);
+    g_tPort.hPort = (UTIL_HANDLE)fd[0];
+    xcom_init(&g_tXcom, &g_tPort, OnFrame, NULL);
+
+    while (g_tXcom.tStats.nRxBytes < g_nStreamLen)
+    {
+        if (nSent < g_nStreamLen)
+        {
+            nChunk = UTIL_MIN(1 + Rand32() % nChunkMax, g_nStreamLen - nSent);
+            nRet = write(fd[1], g_pStream + nSent, nChunk);
+            if (nRet > 0) nSent += (TU32)nRet;
+        }
+
+        fStart = NowSec();
+        xcom_fsm(&g_tXcom);
+        fParse += NowSec() - fStart;
+    }
+
+    close(fd[0]);
+    close(fd[1]);
+
+    // Resync latency: bytes received from the start of a fault until the
+    // next intact frame was delivered
+    for (i=0, k=0; i<g_nFaults; i++)
+    {
+        while (k < g_nFrames && (g_pFrames[k].nOffset < g_pFaults[i] || g_pFrames[k].nRxAt == 0)) k++;
+        if (k == g_nFrames) break;
+
+        nLatency = g_pFrames[k].nRxAt - g_pFaults[i];
+        fLatencySum += nLatency;
+        nLatencyCnt++;
+        if (nLatency > nLatencyMax) nLatencyMax = nLatency;
+    }
+
+    for (i=0; i<g_nFrames; i++)
+    {
+        if (g_pFrames[i].nRxAt != 0) nRecovered++;
+    }
+
+    printf("faults=%2lu%% chunk<=%4lu: %8.1f MB/s, recovered %lu/%lu, lost %lu, false %lu, "
+           "resync avg %.0f max %lu bytes, skipped %lu, copied %lu\n",
+           (unsigned long)nFaultPct, (unsigned long)nChunkMax,
+           g_nStreamLen / fParse / 1e6,
+           (unsigned long)nRecovered, (unsigned long)g_nFrames,
+           (unsigned long)(g_nFrames - nRecovered), (unsigned long)g_nFalse,
+           nLatencyCnt ? fLatencySum / nLatencyCnt : 0.0, (unsigned long)nLatencyMax,
+           (unsigned long)g_tXcom.tStats.nRxSkipBytes, (unsigned long)g_tXcom.tStats.nRxCopyBytes);
+}
+
+int main(int argc, char *argv[])
+{
+    TU32 nFrames   = (argc > 1) ? (TU32)atoi(argv[1]) : BENCH_DEF_FRAMES;
+    TU32 nFaultPct = (argc > 2) ? (TU32)atoi(argv[2]) : BENCH_DEF_FAULT_PCT;
+    TU32 i;
+
+    if (argc > 3 && atoi(argv[3]) != 0) g_nRandState = (TU32)atoi(argv[3]);
+
+    if (nFrames == 0 || nFaultPct > 100 || !BuildStream(nFrames, nFaultPct))
+    {
+        printf("usage: xcom_bench [frames] [fault %%] [seed]\n");
+        return 1;
+    }
+
+    printf("stream: %lu bytes, %lu intact frames, %lu faults (",
+           (unsigned long)g_nStreamLen, (unsigned long)g_nFrames, (unsigned long)g_nFaults);
+    for (i=0; i<FAULT_NUM; i++)
+    {
+        printf("%s%s %lu", i ? ", " : "", g_szFaultName[i], (unsigned long)g_nFaultCnt[i]);
+    }
+    printf("), crc8 %s\n", CRC_GetImplName(CRC_GetImpl()));
+
+    for (i=0; i<UTIL_TAB_SIZE(g_nChunkMax); i++)
+    {
+        RunChunks(g_nChunkMax[i], nFaultPct);
+    }
+
+    free(g_pStream);
+    free(g_pFrames);
+    free(g_pFaults);
+
+    return 0;
+}
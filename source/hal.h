@@ -9,6 +9,8 @@ extern "C" {
 // Types
 typedef unsigned long   TU32;
 typedef   signed long   TS32;
+typedef unsigned long long TU64;
+typedef   signed long long TS64;
 typedef unsigned short  TU16;
 typedef   signed short  TS16;
 typedef unsigned char   TU8;
@@ -29,6 +31,7 @@ typedef        double   TDouble;
 #define TS16_MAX        ((TS16)32767)
 #define TS16_MIN        ((TS16)-32768)
 #define TU32_MAX        ((TU32)4294967295uL)
+#define TU64_MAX        ((TU64)-1)
 #define TS32_MAX        ((TS32)2147483647)
 #define TS32_MIN        ((TS32)-2147483648)
 
@@ -40,8 +43,10 @@ typedef TU32                    UTIL_HANDLE;
 #define INVALID_UTIL_HANDLE     ((UTIL_HANDLE)-1)
     
 ////////////////////////////////////////////////////////////////////////////////
-// Timer
-TU32 TIMER_GetNow(void);
+// Timer: all monotonic, not affected by clock changes, from an arbitrary origin
+TU32 TIMER_GetNow(void);        // ms, wraps with TU32
+TU64 TIMER_GetNowUs(void);
+TU64 TIMER_GetNowNs(void);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Sleep
@@ -53,13 +58,54 @@ enum {
     UART_IO_CTS = 0
 };
 
+// Events for UART_Wait
+enum {
+    UART_EV_READ  = 0x01,   // data to read
+    UART_EV_WRITE = 0x02,   // room to write
+    UART_EV_ERROR = 0x04,   // port failed or hung up
+    UART_EV_WAKE  = 0x08    // the wakeup given to UART_WaitEx was set
+};
+
+// Tunings for UART_InitEx, reported back when they took effect
+enum {
+    UART_TUNE_LOW_LATENCY   = 0x01,     // driver flag ASYNC_LOW_LATENCY
+    UART_TUNE_LATENCY_TIMER = 0x02,     // USB adapter latency timer, e.g. FTDI, lowered through sysfs
+    UART_TUNE_WAKE_LEN      = 0x04,     // wake the reader once a given number of bytes is in, see UART_SetWakeLen
+    UART_TUNE_ALL           = 0x07
+};
+
+typedef struct {
+    TU32 nBaud;             // 0 for 115200
+    TU32 nTunings;          // UART_TUNE_* wanted
+    TU8  nLatencyTimer;     // ms, for UART_TUNE_LATENCY_TIMER, 0 for 1 ms
+} UART_CONFIG;
+
+// Longest port name UART_List gives, with the NUL
+#define UART_MAX_NAME_LEN   (64)
+
+// One fragment of a gathered write
+typedef struct {
+    TU8 * pBuf;
+    TU32  nLen;
+} UART_IOVEC;
+
 UTIL_HANDLE UART_Init(const char *szName);
+UTIL_HANDLE UART_InitEx(const char *szName, const UART_CONFIG *pCfg, TU32 *pApplied);
 void  UART_Close(UTIL_HANDLE nHandle);
 TU32  UART_Read(UTIL_HANDLE nHandle, TU8 * pBuf, TU32 nBufLen);
 TU32  UART_Write(UTIL_HANDLE nHandle, TU8 * pBuf, TU32 nLen);
+TU32  UART_WriteV(UTIL_HANDLE nHandle, const UART_IOVEC * pVec, TU32 nVecCnt);
 TBool UART_GetIO(UTIL_HANDLE nHandle, TU32 nIO, TBool *pIsHigh);
 void  UART_FlushTX(UTIL_HANDLE nHandle);
 void  UART_FlushRX(UTIL_HANDLE nHandle);
+TBool UART_SetBaud(UTIL_HANDLE nHandle, TU32 nBaud);    // any rate the driver takes, not only the standard ones
+TU32  UART_GetBaud(UTIL_HANDLE nHandle);
+TBool UART_SetWakeLen(UTIL_HANDLE nHandle, TU16 nLen);  // UART_Wait reports UART_EV_READ once nLen bytes are in
+TU32  UART_Wait(UTIL_HANDLE nHandle, TU32 nEvents, TU32 nTimeoutUs);     // returns the ready events, 0 on timeout
+TU32  UART_WaitEx(UTIL_HANDLE nHandle, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);  // also ends when hWake is set
+TBool UART_WaitReadable(UTIL_HANDLE nHandle, TU32 nTimeoutUs);
+TBool UART_WaitWritable(UTIL_HANDLE nHandle, TU32 nTimeoutUs);
+TU32  UART_List(char szNames[][UART_MAX_NAME_LEN], TU32 nMax);  // serial ports of the system, returns how many
 
 ////////////////////////////////////////////////////////////////////////////////
 // Locker
@@ -68,21 +114,128 @@ void UTIL_Lock(UTIL_HANDLE hLock);
 void UTIL_Unlock(UTIL_HANDLE hLock);
 void UTIL_DeleteLock(UTIL_HANDLE hLock);
 
+////////////////////////////////////////////////////////////////////////////////
+// Mutex, condition and wakeup: allocated on the heap, as many as needed.
+// A mutex is not recursive. A condition is waited on with its mutex held.
+UTIL_HANDLE MUTEX_Create(void);
+void  MUTEX_Lock(UTIL_HANDLE hMutex);
+void  MUTEX_Unlock(UTIL_HANDLE hMutex);
+void  MUTEX_Delete(UTIL_HANDLE hMutex);
+
+UTIL_HANDLE COND_Create(void);
+TBool COND_Wait(UTIL_HANDLE hCond, UTIL_HANDLE hMutex, TU32 nTimeoutUs);    // TFalse on timeout
+void  COND_Signal(UTIL_HANDLE hCond);
+void  COND_Broadcast(UTIL_HANDLE hCond);
+void  COND_Delete(UTIL_HANDLE hCond);
+
+// A flag set from any thread, which UART_WaitEx waits on next to the port
+UTIL_HANDLE WAKE_Create(void);
+void  WAKE_Set(UTIL_HANDLE hWake);
+void  WAKE_Clear(UTIL_HANDLE hWake);
+TBool WAKE_Wait(UTIL_HANDLE hWake, TU32 nTimeoutUs);   // TFalse on timeout; sleeps if hWake is INVALID_UTIL_HANDLE
+void  WAKE_Delete(UTIL_HANDLE hWake);
+
+// A function run once, by whichever thread gets there first; the others
+// return once it is done. The flag is a static set to UTIL_ONCE_INIT, and
+// the function must not run ONCE_Run itself.
+typedef volatile long UTIL_ONCE;
+#define UTIL_ONCE_INIT      (0)
+
+void  ONCE_Run(UTIL_ONCE *pOnce, void (*pFunc)(void));
+
 ////////////////////////////////////////////////////////////////////////////////
 // Thread
 typedef void * (*UTIL_CB_FUNC)(void *);
 
+// Scheduling policies for THREAD_CreateEx
+enum {
+    THREAD_SCHED_NORMAL = 0,
+    THREAD_SCHED_FIFO,      // real-time, runs until it blocks
+    THREAD_SCHED_RR         // real-time, round robin among equal priorities
+};
+
+typedef struct {
+    const char * szName;    // shown by ps/top, 15 chars kept, NULL for none
+    TU32  nStackSize;       // bytes, 0 for the default of THREAD_Create
+    TU8   nPolicy;          // THREAD_SCHED_*
+    TU8   nPriority;        // 1 (low) .. 99 (high), for the real-time policies
+    TU64  nCpuMask;         // bit n for CPU n, 0 for any CPU
+} THREAD_CONFIG;
+
+// Settings of THREAD_CreateEx that took effect
+enum {
+    THREAD_SET_SCHED    = 0x01,
+    THREAD_SET_AFFINITY = 0x02,
+    THREAD_SET_NAME     = 0x04
+};
+
 UTIL_HANDLE THREAD_Create(UTIL_CB_FUNC pCbFunc, void * pParam);
-// UTIL_HANDLE THREAD_CreateEx(void (*pCbFunc)( void * ), void * pParam, TU32 nPriority, TU32 nStackSize);
+// The thread runs even if a setting is refused, e.g. a real-time policy
+// without the privilege: *pApplied tells which ones were taken
+UTIL_HANDLE THREAD_CreateEx(UTIL_CB_FUNC pCbFunc, void * pParam, const THREAD_CONFIG * pCfg, TU32 * pApplied);
 TBool THREAD_IsExist(UTIL_HANDLE nHandle);
 void  THREAD_Terminate(UTIL_HANDLE nHandle);
 
+////////////////////////////////////////////////////////////////////////////////
+// UART input line events: a thread blocks in the driver until a UART_IO_*
+// line changes, then stamps the edge. The callback runs on that thread.
+typedef struct {
+    TU32  nIO;              // UART_IO_*
+    TBool bHigh;            // level read right after the edge
+    TU64  nTimeUs;          // TIMER_GetNowUs when the driver woke the thread
+    TU32  nEdges;           // edges counted by the driver since the last event, more than 1 if they came too close
+} UART_IO_EVENT;
+
+typedef void (*UART_IO_CB)(void *pParam, const UART_IO_EVENT *pEvent);
+
+// INVALID_UTIL_HANDLE if the driver cannot report the line changes.
+// The thread ends if the port fails; UART_UnwatchIO is still needed then.
+UTIL_HANDLE UART_WatchIO(UTIL_HANDLE nHandle, TU32 nIO, UART_IO_CB pCbFunc, void *pParam, const THREAD_CONFIG *pCfg);
+void  UART_UnwatchIO(UTIL_HANDLE hWatch);
+
+////////////////////////////////////////////////////////////////////////////////
+// Device node watch: tells when the node of a port, or a link to it such as
+// /dev/serial/by-id/..., goes away and comes back, e.g. when a USB adapter
+// re-enumerates. The open handle of the old node stays dead: open it again.
+enum {
+    DEV_EV_REMOVED = 0x01,
+    DEV_EV_ADDED   = 0x02   // both when it went and came back between two waits
+};
+
+UTIL_HANDLE DEV_Watch(const char *szName);
+TU32  DEV_Wait(UTIL_HANDLE hWatch, TU32 nTimeoutUs);    // DEV_EV_* since the last call, 0 on timeout
+TBool DEV_IsPresent(UTIL_HANDLE hWatch);
+void  DEV_Unwatch(UTIL_HANDLE hWatch);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Socket
-UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort);
+enum {
+    SOCK_TYPE_TCP = 0,
+    SOCK_TYPE_UDP
+};
+
+// Tunings for SOCK_OpenEx, reported back when they took effect
+enum {
+    SOCK_TUNE_NODELAY   = 0x01,     // TCP_NODELAY: small frames leave at once, not after the Nagle wait
+    SOCK_TUNE_BUF_SIZE  = 0x02,     // SO_RCVBUF/SO_SNDBUF from the config
+    SOCK_TUNE_ALL       = 0x03
+};
+
+typedef struct {
+    TU8  nType;             // SOCK_TYPE_*
+    TU32 nTunings;          // SOCK_TUNE_* wanted
+    TU32 nRxBufSize;        // bytes, for SOCK_TUNE_BUF_SIZE, 0 to keep the default
+    TU32 nTxBufSize;
+} SOCK_CONFIG;
+
+UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort);      // TCP; nAddr 0 waits for a client
+UTIL_HANDLE SOCK_OpenEx(TU32 nAddr, TU16 nPort, const SOCK_CONFIG *pCfg, TU32 *pApplied);  // a UDP server waits for a datagram, then answers the sender of the last one
+TBool SOCK_Resolve(const char *szHost, TU32 *pAddr);    // host name or dotted address, to host order
 TS32  SOCK_GetRxBufLen(UTIL_HANDLE hSock);
 TS32  SOCK_Read(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen, TU32 nTmout);
 TS32  SOCK_Write(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen);
+TS32  SOCK_Send(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen);  // what fits now, without blocking; < 0 on error
+TU32  SOCK_Wait(UTIL_HANDLE hSock, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);   // UART_EV_*, as UART_WaitEx
 void  SOCK_Close(UTIL_HANDLE hSock);
     
 #ifdef __cplusplus
@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
 #include "hal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -10,12 +13,21 @@
 #include <limits.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <glob.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 #include <signal.h>
+#include <linux/serial.h>
 
 #define _LOG_   printf
 
@@ -23,9 +35,19 @@
 // Timer
 TU32 TIMER_GetNow(void)
 {
-    struct timeval tv;
-    if (gettimeofday(&tv, NULL) != 0) return 0;
-    return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+    return (TU32)(TIMER_GetNowNs() / 1000000);
+}
+
+TU64 TIMER_GetNowUs(void)
+{
+    return TIMER_GetNowNs() / 1000;
+}
+
+TU64 TIMER_GetNowNs(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) return 0;
+    return ((TU64)ts.tv_sec * 1000000000) + (TU64)ts.tv_nsec;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -42,10 +64,64 @@ void UTIL_Exit(void)
 
 ////////////////////////////////////////////////////////////////////////////////
 // UART
+#define UART_MAX_WAKE_LEN   (255)       // VMIN is a byte
+
+static TBool UART_SetLowLatency(int fd)
+{
+    struct serial_struct tSerial;
+
+    if (ioctl(fd, TIOCGSERIAL, &tSerial) < 0) return TFalse;
+
+    tSerial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &tSerial) < 0) return TFalse;
+
+    // Some drivers take the call and drop the flag
+    if (ioctl(fd, TIOCGSERIAL, &tSerial) < 0) return TFalse;
+
+    return (TBool)((tSerial.flags & ASYNC_LOW_LATENCY) != 0);
+}
+
+static TBool UART_SetLatencyTimer(const char *szName, TU8 nMs)
+{
+    char  szReal[PATH_MAX];
+    char  szPath[PATH_MAX + 64];
+    char *szTty;
+    FILE *fp;
+    int   nKept = -1;
+
+    // /dev/serial/by-id/... links to /dev/ttyUSBx
+    if (!realpath(szName, szReal)) return TFalse;
+
+    szTty = strrchr(szReal, '/');
+    szTty = szTty ? szTty + 1 : szReal;
+
+    snprintf(szPath, sizeof(szPath), "/sys/class/tty/%s/device/latency_timer", szTty);
+
+    fp = fopen(szPath, "w");
+    if (!fp) return TFalse;
+    fprintf(fp, "%u", nMs);
+    if (fclose(fp) != 0) return TFalse;
+
+    fp = fopen(szPath, "r");
+    if (!fp) return TFalse;
+    if (fscanf(fp, "%d", &nKept) != 1) nKept = -1;
+    fclose(fp);
+
+    return (TBool)(nKept == nMs);
+}
+
 UTIL_HANDLE UART_Init(const char *szName)
+{
+    return UART_InitEx(szName, NULL, NULL);
+}
+
+UTIL_HANDLE UART_InitEx(const char *szName, const UART_CONFIG *pCfg, TU32 *pApplied)
 {
     int fd = -1;
     struct termios   Opt;
+    TU32 nApplied = 0;
+
+    if (pApplied) *pApplied = 0;
     
     fd = open(szName, O_RDWR | O_NOCTTY | O_NDELAY);
     if(fd < 0)
@@ -69,7 +145,36 @@ UTIL_HANDLE UART_Init(const char *szName)
         perror("unable to adjust portsettings ");
         return INVALID_UTIL_HANDLE;
     }
-    
+
+    if (pCfg)
+    {
+        if ((pCfg->nBaud != 0) && !UART_SetBaud((UTIL_HANDLE)fd, pCfg->nBaud))
+        {
+            close(fd);
+            perror("unable to set the baud rate ");
+            return INVALID_UTIL_HANDLE;
+        }
+
+        // Tunings are best effort: each one needs driver support or rights
+        if ((pCfg->nTunings & UART_TUNE_LOW_LATENCY) && UART_SetLowLatency(fd))
+        {
+            nApplied |= UART_TUNE_LOW_LATENCY;
+        }
+
+        if ((pCfg->nTunings & UART_TUNE_LATENCY_TIMER)
+         && UART_SetLatencyTimer(szName, pCfg->nLatencyTimer ? pCfg->nLatencyTimer : 1))
+        {
+            nApplied |= UART_TUNE_LATENCY_TIMER;
+        }
+
+        if ((pCfg->nTunings & UART_TUNE_WAKE_LEN) && UART_SetWakeLen((UTIL_HANDLE)fd, 1))
+        {
+            nApplied |= UART_TUNE_WAKE_LEN;
+        }
+    }
+
+    if (pApplied) *pApplied = nApplied;
+
     return (UTIL_HANDLE)fd;
 }
 
@@ -100,6 +205,28 @@ TU32  UART_Write(UTIL_HANDLE nHandle, TU8 * pBuf, TU32 nLen)
     return (ret < 0 ? 0 : (TU32)ret);
 }
 
+#define UART_MAX_IOVEC      (8)
+
+TU32  UART_WriteV(UTIL_HANDLE nHandle, const UART_IOVEC * pVec, TU32 nVecCnt)
+{
+    struct iovec tIov[UART_MAX_IOVEC];
+    ssize_t ret;
+    TU32 i;
+
+    if (nVecCnt > UART_MAX_IOVEC) nVecCnt = UART_MAX_IOVEC;
+
+    for (i=0; i<nVecCnt; i++)
+    {
+        tIov[i].iov_base = pVec[i].pBuf;
+        tIov[i].iov_len  = pVec[i].nLen;
+    }
+
+    // All fragments with one syscall
+    ret = writev((int)nHandle, tIov, (int)nVecCnt);
+
+    return (ret < 0 ? 0 : (TU32)ret);
+}
+
 TBool UART_GetIO(UTIL_HANDLE nHandle, TU32 nIO, TBool *pIsHigh)
 {
     int status;
@@ -128,6 +255,78 @@ void  UART_FlushRX(UTIL_HANDLE nHandle)
     tcflush((int)nHandle,TCIFLUSH);
 }
 
+// With VTIME 0, poll() on a tty in raw mode only reports POLLIN once VMIN
+// bytes are in. Reads are non-blocking, so they still return what is there.
+TBool UART_SetWakeLen(UTIL_HANDLE nHandle, TU16 nLen)
+{
+    struct termios Opt;
+
+    if (tcgetattr((int)nHandle, &Opt) < 0) return TFalse;
+
+    if (nLen < 1) nLen = 1;
+    if (nLen > UART_MAX_WAKE_LEN) nLen = UART_MAX_WAKE_LEN;
+
+    Opt.c_cc[VMIN]  = (cc_t)nLen;
+    Opt.c_cc[VTIME] = 0;
+
+    return (TBool)(tcsetattr((int)nHandle, TCSANOW, &Opt) == 0);
+}
+
+TU32  UART_Wait(UTIL_HANDLE nHandle, TU32 nEvents, TU32 nTimeoutUs)
+{
+    return UART_WaitEx(nHandle, INVALID_UTIL_HANDLE, nEvents, nTimeoutUs);
+}
+
+TU32  UART_WaitEx(UTIL_HANDLE nHandle, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    struct pollfd   tPoll[2];
+    struct timespec tTmout;
+    nfds_t nFds = 1;
+    TU32 nReady = 0;
+    int  ret;
+
+    tPoll[0].fd      = (int)nHandle;
+    tPoll[0].events  = (short)(((nEvents & UART_EV_READ) ? POLLIN : 0) | ((nEvents & UART_EV_WRITE) ? POLLOUT : 0));
+    tPoll[0].revents = 0;
+
+    // The wakeup is an eventfd, readable once set
+    if (hWake != INVALID_UTIL_HANDLE)
+    {
+        tPoll[1].fd      = (int)hWake;
+        tPoll[1].events  = POLLIN;
+        tPoll[1].revents = 0;
+        nFds = 2;
+    }
+
+    tTmout.tv_sec  = nTimeoutUs / 1000000;
+    tTmout.tv_nsec = (nTimeoutUs % 1000000) * 1000;
+
+    // ppoll, for a timeout finer than the 1 ms of poll
+    do
+    {
+        ret = ppoll(tPoll, nFds, &tTmout, NULL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) return UART_EV_ERROR;
+
+    if (tPoll[0].revents & POLLIN)  nReady |= UART_EV_READ;
+    if (tPoll[0].revents & POLLOUT) nReady |= UART_EV_WRITE;
+    if (tPoll[0].revents & (POLLERR | POLLHUP | POLLNVAL)) nReady |= UART_EV_ERROR;
+    if ((nFds == 2) && (tPoll[1].revents & POLLIN)) nReady |= UART_EV_WAKE;
+
+    return nReady;
+}
+
+TBool UART_WaitReadable(UTIL_HANDLE nHandle, TU32 nTimeoutUs)
+{
+    return (TBool)((UART_Wait(nHandle, UART_EV_READ, nTimeoutUs) & UART_EV_READ) != 0);
+}
+
+TBool UART_WaitWritable(UTIL_HANDLE nHandle, TU32 nTimeoutUs)
+{
+    return (TBool)((UART_Wait(nHandle, UART_EV_WRITE, nTimeoutUs) & UART_EV_WRITE) != 0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // localize objects table, like thread, mutex, ...
 #define TAB_ALLOC(t)        ( TabAlloc((t), sizeof(t)/sizeof(t[0])) )
@@ -247,6 +446,53 @@ void DeleteCriticalSection(UTIL_HANDLE *mutex)
     }
 }
 
+// USB adapters first, then the on-board UARTs
+static const char * const g_szPortPatterns[] = { "/dev/ttyUSB*", "/dev/ttyACM*", "/dev/ttyS*" };
+
+// The kernel makes ttyS nodes for UARTs that may not be there: skip those
+// the driver found no chip for
+static TBool UART_IsPresent(const char *szName)
+{
+    struct serial_struct tSerial;
+    int   fd;
+    TBool bPresent = TTrue;
+
+    if (strncmp(szName, "/dev/ttyS", 9) != 0) return TTrue;
+
+    fd = open(szName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) return TFalse;
+
+    if (ioctl(fd, TIOCGSERIAL, &tSerial) == 0 && tSerial.type == PORT_UNKNOWN) bPresent = TFalse;
+
+    close(fd);
+
+    return bPresent;
+}
+
+TU32  UART_List(char szNames[][UART_MAX_NAME_LEN], TU32 nMax)
+{
+    glob_t tGlob;
+    TU32   nCount = 0;
+    size_t i, j;
+
+    for (i=0; i<sizeof(g_szPortPatterns)/sizeof(g_szPortPatterns[0]); i++)
+    {
+        if (glob(g_szPortPatterns[i], 0, NULL, &tGlob) != 0) continue;
+
+        for (j=0; j<tGlob.gl_pathc && nCount<nMax; j++)
+        {
+            if (strlen(tGlob.gl_pathv[j]) >= UART_MAX_NAME_LEN) continue;
+            if (!UART_IsPresent(tGlob.gl_pathv[j])) continue;
+
+            strcpy(szNames[nCount++], tGlob.gl_pathv[j]);
+        }
+
+        globfree(&tGlob);
+    }
+
+    return nCount;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Locker
 UTIL_HANDLE UTIL_CreateLock(void)
@@ -273,6 +519,144 @@ void UTIL_DeleteLock(UTIL_HANDLE hLock)
     DeleteCriticalSection(&hLock);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Mutex, condition and wakeup. The handle is the pointer, or the eventfd.
+UTIL_HANDLE MUTEX_Create(void)
+{
+    pthread_mutex_t *pMutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+
+    if (!pMutex) return INVALID_UTIL_HANDLE;
+
+    // Default type: not recursive, no owner checks, a futex when not contended
+    if (pthread_mutex_init(pMutex, NULL) != 0)
+    {
+        free(pMutex);
+        return INVALID_UTIL_HANDLE;
+    }
+
+    return (UTIL_HANDLE)pMutex;
+}
+
+void  MUTEX_Lock(UTIL_HANDLE hMutex)
+{
+    pthread_mutex_lock((pthread_mutex_t *)hMutex);
+}
+
+void  MUTEX_Unlock(UTIL_HANDLE hMutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)hMutex);
+}
+
+void  MUTEX_Delete(UTIL_HANDLE hMutex)
+{
+    if (hMutex == INVALID_UTIL_HANDLE) return;
+
+    pthread_mutex_destroy((pthread_mutex_t *)hMutex);
+    free((pthread_mutex_t *)hMutex);
+}
+
+UTIL_HANDLE COND_Create(void)
+{
+    pthread_cond_t    *pCond = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
+    pthread_condattr_t tAttr;
+    int nRet;
+
+    if (!pCond) return INVALID_UTIL_HANDLE;
+
+    // Timed waits on the monotonic clock, like TIMER_GetNowUs
+    pthread_condattr_init(&tAttr);
+    pthread_condattr_setclock(&tAttr, CLOCK_MONOTONIC);
+    nRet = pthread_cond_init(pCond, &tAttr);
+    pthread_condattr_destroy(&tAttr);
+
+    if (nRet != 0)
+    {
+        free(pCond);
+        return INVALID_UTIL_HANDLE;
+    }
+
+    return (UTIL_HANDLE)pCond;
+}
+
+TBool COND_Wait(UTIL_HANDLE hCond, UTIL_HANDLE hMutex, TU32 nTimeoutUs)
+{
+    struct timespec ts;
+    TU64 nDeadline = TIMER_GetNowNs() + (TU64)nTimeoutUs * 1000;
+
+    ts.tv_sec  = (time_t)(nDeadline / 1000000000);
+    ts.tv_nsec = (long)(nDeadline % 1000000000);
+
+    return (TBool)(pthread_cond_timedwait((pthread_cond_t *)hCond, (pthread_mutex_t *)hMutex, &ts) == 0);
+}
+
+void  COND_Signal(UTIL_HANDLE hCond)
+{
+    pthread_cond_signal((pthread_cond_t *)hCond);
+}
+
+void  COND_Broadcast(UTIL_HANDLE hCond)
+{
+    pthread_cond_broadcast((pthread_cond_t *)hCond);
+}
+
+void  COND_Delete(UTIL_HANDLE hCond)
+{
+    if (hCond == INVALID_UTIL_HANDLE) return;
+
+    pthread_cond_destroy((pthread_cond_t *)hCond);
+    free((pthread_cond_t *)hCond);
+}
+
+UTIL_HANDLE WAKE_Create(void)
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return (fd < 0) ? INVALID_UTIL_HANDLE : (UTIL_HANDLE)fd;
+}
+
+void  WAKE_Set(UTIL_HANDLE hWake)
+{
+    uint64_t nOne = 1;
+
+    if (write((int)hWake, &nOne, sizeof(nOne)) < 0) return;
+}
+
+void  WAKE_Clear(UTIL_HANDLE hWake)
+{
+    uint64_t nCount;
+
+    if (read((int)hWake, &nCount, sizeof(nCount)) < 0) return;
+}
+
+TBool WAKE_Wait(UTIL_HANDLE hWake, TU32 nTimeoutUs)
+{
+    // No port: poll skips the negative fd of INVALID_UTIL_HANDLE
+    return (TBool)((UART_WaitEx(INVALID_UTIL_HANDLE, hWake, 0, nTimeoutUs) & UART_EV_WAKE) != 0);
+}
+
+void  WAKE_Delete(UTIL_HANDLE hWake)
+{
+    if (hWake != INVALID_UTIL_HANDLE) close((int)hWake);
+}
+
+static pthread_mutex_t g_tOnceLock = PTHREAD_MUTEX_INITIALIZER;
+
+void  ONCE_Run(UTIL_ONCE *pOnce, void (*pFunc)(void))
+{
+    // Seen done, what pFunc wrote is seen too
+    if (__atomic_load_n(pOnce, __ATOMIC_ACQUIRE)) return;
+
+    pthread_mutex_lock(&g_tOnceLock);
+
+    if (!*pOnce)
+    {
+        pFunc();
+        __atomic_store_n(pOnce, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&g_tOnceLock);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Thread
 #define UTIL_MAX_THREAD     (64)
@@ -281,6 +665,9 @@ static TU8          g_tThreadAllocTab[UTIL_MAX_THREAD];
 static pthread_t    g_tThreadHandleTab[UTIL_MAX_THREAD];
 static TU8          g_bThreadTabInited = 0;
 
+// The threads free their own slots as they end, while others create
+static pthread_mutex_t g_tThreadTabLock = PTHREAD_MUTEX_INITIALIZER;
+
 #define IS_THREAD_VALID(h)  ((TU32)(h) < (TU32)UTIL_MAX_THREAD)
 
 static void ThreadTabInit(void)
@@ -296,57 +683,475 @@ static void ThreadTabInit(void)
 
 UTIL_HANDLE THREAD_Create(UTIL_CB_FUNC pCbFunc, void * pParam)
 {
-    pthread_t       thread_t;
-    pthread_attr_t  threadAttr;  // attribute variable    
-    
-    TU32            idx;
+    return THREAD_CreateEx(pCbFunc, pParam, NULL, NULL);
+}
 
-    if (!g_bThreadTabInited) ThreadTabInit();
-    
-    idx = TAB_ALLOC(g_tThreadAllocTab);
-    
-    if ( ! IS_THREAD_VALID(idx) )   return INVALID_UTIL_HANDLE;
+typedef struct {
+    UTIL_CB_FUNC pCbFunc;
+    void       * pParam;
+    TU32         idx;
+    char         szName[16];    // the kernel keeps 15 chars, empty for none
+} TThreadStart;
+
+static void THREAD_Release(void * pParam)
+{
+    TU32 idx = (TU32)(size_t)pParam;
+
+    pthread_mutex_lock(&g_tThreadTabLock);
+    memset(&g_tThreadHandleTab[idx], 0, sizeof(g_tThreadHandleTab[0]));
+    TAB_FREE(g_tThreadAllocTab, idx);
+    pthread_mutex_unlock(&g_tThreadTabLock);
+}
+
+// Every thread runs through here: it names itself, so that it cannot be
+// gone by then, and gives its slot back once the callback returns, or when
+// it is cancelled. The threads are detached, nobody joins them to do it.
+static void * THREAD_Start(void * pParam)
+{
+    TThreadStart tStart = *(TThreadStart *)pParam;
+    void       * pRet;
+
+    free(pParam);
+    if (tStart.szName[0] != '\0') pthread_setname_np(pthread_self(), tStart.szName);
+
+    pthread_cleanup_push(THREAD_Release, (void *)(size_t)tStart.idx);
+    pRet = tStart.pCbFunc(tStart.pParam);
+    pthread_cleanup_pop(1);
+
+    return pRet;
+}
+
+// nSet: THREAD_SET_SCHED and THREAD_SET_AFFINITY to put in the attributes
+static int THREAD_Spawn(pthread_t * pThread, const THREAD_CONFIG * pCfg, TU32 nSet,
+                        UTIL_CB_FUNC pCbFunc, void * pParam)
+{
+    pthread_attr_t      threadAttr;  // attribute variable
+    struct sched_param  tSched;
+    cpu_set_t           tCpus;
+    size_t              nStackSize = 12000*1024;
+    int                 nPolicy;
+    int                 nRet;
+    int                 i;
 
     // init
     pthread_attr_init(&threadAttr);
     
     // stack size
-    pthread_attr_setstacksize(&threadAttr, 12000*1024);
+    if (pCfg && pCfg->nStackSize != 0)
+    {
+        nStackSize = (pCfg->nStackSize < PTHREAD_STACK_MIN) ? PTHREAD_STACK_MIN : pCfg->nStackSize;
+    }
+    pthread_attr_setstacksize(&threadAttr, nStackSize);
     
     // detached state
     pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_DETACHED);
+
+    // real-time policy, instead of the one of the caller
+    if (nSet & THREAD_SET_SCHED)
+    {
+        nPolicy = (pCfg->nPolicy == THREAD_SCHED_RR) ? SCHED_RR : SCHED_FIFO;
+
+        memset(&tSched, 0, sizeof(tSched));
+        tSched.sched_priority = pCfg->nPriority;
+        if (tSched.sched_priority < sched_get_priority_min(nPolicy)) tSched.sched_priority = sched_get_priority_min(nPolicy);
+        if (tSched.sched_priority > sched_get_priority_max(nPolicy)) tSched.sched_priority = sched_get_priority_max(nPolicy);
+
+        pthread_attr_setinheritsched(&threadAttr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&threadAttr, nPolicy);
+        pthread_attr_setschedparam(&threadAttr, &tSched);
+    }
+
+    // CPU affinity
+    if (nSet & THREAD_SET_AFFINITY)
+    {
+        CPU_ZERO(&tCpus);
+        for (i=0; i<64 && i<CPU_SETSIZE; i++)
+        {
+            if (pCfg->nCpuMask & ((TU64)1 << i)) CPU_SET(i, &tCpus);
+        }
+        pthread_attr_setaffinity_np(&threadAttr, sizeof(tCpus), &tCpus);
+    }
     
     // create thread
-    pthread_create(&thread_t, &threadAttr, pCbFunc, pParam);
+    nRet = pthread_create(pThread, &threadAttr, pCbFunc, pParam);
     
     // Destroy mutex attr
     pthread_attr_destroy(&threadAttr);
+
+    return nRet;
+}
+
+UTIL_HANDLE THREAD_CreateEx(UTIL_CB_FUNC pCbFunc, void * pParam, const THREAD_CONFIG * pCfg, TU32 * pApplied)
+{
+    pthread_t       thread_t;
+    TThreadStart  * pStart = NULL;
+    TU32            nSet = 0;
+    int             nRet;
+    
+    TU32            idx;
+
+    if (pApplied) *pApplied = 0;
+
+    pStart = (TThreadStart *)malloc(sizeof(TThreadStart));
+    if (!pStart) return INVALID_UTIL_HANDLE;
+
+    // Held until the handle is stored: a thread which ends at once waits
+    // for it to free the slot
+    pthread_mutex_lock(&g_tThreadTabLock);
+
+    if (!g_bThreadTabInited) ThreadTabInit();
+    
+    idx = TAB_ALLOC(g_tThreadAllocTab);
+    
+    if ( ! IS_THREAD_VALID(idx) )
+    {
+        pthread_mutex_unlock(&g_tThreadTabLock);
+        free(pStart);
+        return INVALID_UTIL_HANDLE;
+    }
+
+    pStart->pCbFunc   = pCbFunc;
+    pStart->pParam    = pParam;
+    pStart->idx       = idx;
+    pStart->szName[0] = '\0';
+
+    if (pCfg)
+    {
+        if (pCfg->nPolicy != THREAD_SCHED_NORMAL) nSet |= THREAD_SET_SCHED;
+        if (pCfg->nCpuMask != 0) nSet |= THREAD_SET_AFFINITY;
+
+        if (pCfg->szName)
+        {
+            strncpy(pStart->szName, pCfg->szName, sizeof(pStart->szName) - 1);
+            pStart->szName[sizeof(pStart->szName) - 1] = '\0';
+            nSet |= THREAD_SET_NAME;
+        }
+    }
+
+    nRet = THREAD_Spawn(&thread_t, pCfg, nSet, THREAD_Start, pStart);
+
+    // No CAP_SYS_NICE nor RLIMIT_RTPRIO: run with the policy of the caller
+    if (nRet == EPERM && (nSet & THREAD_SET_SCHED))
+    {
+        _LOG_("THREAD_CreateEx: real-time policy refused, using the default one\n");
+        nSet &= ~THREAD_SET_SCHED;
+        nRet = THREAD_Spawn(&thread_t, pCfg, nSet, THREAD_Start, pStart);
+    }
+
+    // No CPU of the mask online
+    if (nRet == EINVAL && (nSet & THREAD_SET_AFFINITY))
+    {
+        _LOG_("THREAD_CreateEx: CPU mask refused, using any CPU\n");
+        nSet &= ~THREAD_SET_AFFINITY;
+        nRet = THREAD_Spawn(&thread_t, pCfg, nSet, THREAD_Start, pStart);
+    }
+
+    if (nRet != 0)
+    {
+        TAB_FREE(g_tThreadAllocTab, idx);
+        pthread_mutex_unlock(&g_tThreadTabLock);
+        free(pStart);
+        return INVALID_UTIL_HANDLE;
+    }
     
     g_tThreadHandleTab[idx] = thread_t;
+
+    pthread_mutex_unlock(&g_tThreadTabLock);
+
+    if (pApplied) *pApplied = nSet;
     
     return (UTIL_HANDLE)idx;
 }
 
+// A thread that ended gave its slot back: it no longer exists
 TBool THREAD_IsExist(UTIL_HANDLE nHandle)
 {
-    int nRet = TFalse;
+    TBool bExist = TFalse;
 
     if (IS_THREAD_VALID(nHandle))
     {
-        nRet = pthread_kill(g_tThreadHandleTab[nHandle], 0);
+        pthread_mutex_lock(&g_tThreadTabLock);
+        bExist = (TBool)(g_tThreadAllocTab[nHandle] != 0);
+        pthread_mutex_unlock(&g_tThreadTabLock);
     }
     
-    return (nRet != ESRCH) ? TTrue : TFalse;
+    return bExist;
 }
 
+// The slot is freed by the cleanup of the thread, once the cancel is taken
 void  THREAD_Terminate(UTIL_HANDLE nHandle)
 {
     if (IS_THREAD_VALID(nHandle))
     {
-        pthread_cancel(g_tThreadHandleTab[nHandle]);
-        memset(&g_tThreadHandleTab[nHandle], 0, sizeof(g_tThreadHandleTab[0]));
-        TAB_FREE(g_tThreadAllocTab, nHandle);
+        pthread_mutex_lock(&g_tThreadTabLock);
+        if (g_tThreadAllocTab[nHandle] != 0) pthread_cancel(g_tThreadHandleTab[nHandle]);
+        pthread_mutex_unlock(&g_tThreadTabLock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// UART input line events
+//
+// TIOCMIWAIT blocks until a modem line changes and has no timeout. To stop
+// the thread, a signal with an empty handler and no SA_RESTART ends the wait
+// with EINTR. TIOCGICOUNT counts the edges, so edges that came before the
+// thread was woken are not lost, and tells whether the driver has the feature.
+#define UART_WATCH_SIGNAL   (SIGRTMIN + 2)
+
+typedef struct {
+    int             fd;
+    TU32            nIO;
+    UART_IO_CB      pCbFunc;
+    void          * pParam;
+    pthread_t       tThread;
+    volatile TBool  bStarted;
+    volatile TBool  bRun;
+    volatile TBool  bDone;
+} TUartWatch;
+
+static TBool g_bWatchSignalSet = TFalse;
+
+static void UART_WatchSignal(int nSig)
+{
+}
+
+static TU32 UART_IOCount(const struct serial_icounter_struct *pCount, TU32 nIO)
+{
+    return (nIO == UART_IO_CTS) ? (TU32)pCount->cts : 0;
+}
+
+static void * UART_WatchThread(void *pParam)
+{
+    TUartWatch *pWatch = (TUartWatch *)pParam;
+    struct serial_icounter_struct tCount;
+    UART_IO_EVENT tEvent;
+    TU32 nLast;
+    int  nStatus;
+
+    pWatch->tThread  = pthread_self();
+    pWatch->bStarted = TTrue;
+
+    if (ioctl(pWatch->fd, TIOCGICOUNT, &tCount) < 0) goto exit;
+    nLast = UART_IOCount(&tCount, pWatch->nIO);
+
+    tEvent.nIO = pWatch->nIO;
+
+    while (pWatch->bRun)
+    {
+        if (ioctl(pWatch->fd, TIOCMIWAIT, TIOCM_CTS) < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        tEvent.nTimeUs = TIMER_GetNowUs();
+
+        if (ioctl(pWatch->fd, TIOCGICOUNT, &tCount) < 0 || ioctl(pWatch->fd, TIOCMGET, &nStatus) < 0) break;
+
+        tEvent.nEdges = UART_IOCount(&tCount, pWatch->nIO) - nLast;
+        tEvent.bHigh  = (nStatus & TIOCM_CTS) ? TTrue : TFalse;
+        nLast += tEvent.nEdges;
+
+        if (tEvent.nEdges > 0) pWatch->pCbFunc(pWatch->pParam, &tEvent);
+    }
+
+exit:
+    pWatch->bDone = TTrue;
+
+    return NULL;
+}
+
+UTIL_HANDLE UART_WatchIO(UTIL_HANDLE nHandle, TU32 nIO, UART_IO_CB pCbFunc, void *pParam, const THREAD_CONFIG *pCfg)
+{
+    struct serial_icounter_struct tCount;
+    struct sigaction tAct;
+    TUartWatch *pWatch;
+
+    if (nIO != UART_IO_CTS || !pCbFunc) return INVALID_UTIL_HANDLE;
+
+    // Drivers without the line counters, e.g. pty, have no TIOCMIWAIT either
+    if (ioctl((int)nHandle, TIOCGICOUNT, &tCount) < 0) return INVALID_UTIL_HANDLE;
+
+    if (!g_bWatchSignalSet)
+    {
+        memset(&tAct, 0, sizeof(tAct));
+        tAct.sa_handler = UART_WatchSignal;
+        sigemptyset(&tAct.sa_mask);
+        if (sigaction(UART_WATCH_SIGNAL, &tAct, NULL) < 0) return INVALID_UTIL_HANDLE;
+        g_bWatchSignalSet = TTrue;
+    }
+
+    pWatch = (TUartWatch *)calloc(1, sizeof(TUartWatch));
+    if (!pWatch) return INVALID_UTIL_HANDLE;
+
+    pWatch->fd      = (int)nHandle;
+    pWatch->nIO     = nIO;
+    pWatch->pCbFunc = pCbFunc;
+    pWatch->pParam  = pParam;
+    pWatch->bRun    = TTrue;
+
+    if (THREAD_CreateEx(UART_WatchThread, pWatch, pCfg, NULL) == INVALID_UTIL_HANDLE)
+    {
+        free(pWatch);
+        return INVALID_UTIL_HANDLE;
+    }
+
+    return (UTIL_HANDLE)pWatch;
+}
+
+void  UART_UnwatchIO(UTIL_HANDLE hWatch)
+{
+    TUartWatch *pWatch = (TUartWatch *)hWatch;
+
+    if (hWatch == INVALID_UTIL_HANDLE) return;
+
+    pWatch->bRun = TFalse;
+
+    // Again until it is out: the signal may come just before it blocks
+    while (!pWatch->bDone)
+    {
+        if (pWatch->bStarted) pthread_kill(pWatch->tThread, UART_WATCH_SIGNAL);
+        UTIL_Sleep(1);
     }
+
+    free(pWatch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Device node watch
+//
+// inotify on /dev, where the kernel and udev add and remove the nodes, and on
+// the directory of the name, e.g. /dev/serial/by-id. That one goes away with
+// the last adapter, so it is watched again after each batch of events.
+#define DEV_WATCH_MASK      (IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM)
+#define DEV_EVENT_BUF_LEN   (4096)
+
+typedef struct {
+    int   fd;
+    char  szName[PATH_MAX];
+    char  szDir[PATH_MAX];
+    char  szNode[PATH_MAX];         // the name the node had, the link resolved
+    TBool bPresent;
+} TDevWatch;
+
+static const char * DEV_BaseName(const char *szPath)
+{
+    const char *p = strrchr(szPath, '/');
+
+    return p ? (p + 1) : szPath;
+}
+
+// Present once the name leads to a node, remembering which one
+static TBool DEV_Check(TDevWatch *pWatch)
+{
+    char szReal[PATH_MAX];
+
+    if (!realpath(pWatch->szName, szReal)) return TFalse;
+
+    snprintf(pWatch->szNode, sizeof(pWatch->szNode), "%s", DEV_BaseName(szReal));
+
+    return TTrue;
+}
+
+UTIL_HANDLE DEV_Watch(const char *szName)
+{
+    TDevWatch *pWatch;
+    char *p;
+
+    if (!szName || strlen(szName) >= PATH_MAX) return INVALID_UTIL_HANDLE;
+
+    pWatch = (TDevWatch *)calloc(1, sizeof(TDevWatch));
+    if (!pWatch) return INVALID_UTIL_HANDLE;
+
+    strcpy(pWatch->szName, szName);
+    strcpy(pWatch->szDir, szName);
+    p = strrchr(pWatch->szDir, '/');
+    if (p) *p = '\0';
+
+    pWatch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (pWatch->fd < 0 || inotify_add_watch(pWatch->fd, "/dev", DEV_WATCH_MASK) < 0)
+    {
+        if (pWatch->fd >= 0) close(pWatch->fd);
+        free(pWatch);
+        return INVALID_UTIL_HANDLE;
+    }
+
+    if (pWatch->szDir[0] != '\0') inotify_add_watch(pWatch->fd, pWatch->szDir, DEV_WATCH_MASK);
+
+    // Checked once watched, so that no change falls in between
+    pWatch->bPresent = DEV_Check(pWatch);
+
+    return (UTIL_HANDLE)pWatch;
+}
+
+TU32  DEV_Wait(UTIL_HANDLE hWatch, TU32 nTimeoutUs)
+{
+    TDevWatch *pWatch = (TDevWatch *)hWatch;
+    char   cBuf[DEV_EVENT_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *pEvent;
+    struct pollfd   tPoll;
+    struct timespec tTmout;
+    TBool  bGone = TFalse;
+    TBool  bPresent;
+    TU32   nEvents = 0;
+    ssize_t nLen, nPos;
+    int    ret;
+
+    tPoll.fd      = pWatch->fd;
+    tPoll.events  = POLLIN;
+    tPoll.revents = 0;
+
+    tTmout.tv_sec  = nTimeoutUs / 1000000;
+    tTmout.tv_nsec = (nTimeoutUs % 1000000) * 1000;
+
+    do
+    {
+        ret = ppoll(&tPoll, 1, &tTmout, NULL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0) return 0;
+
+    // The node may be gone and back within one batch
+    while ((nLen = read(pWatch->fd, cBuf, sizeof(cBuf))) > 0)
+    {
+        for (nPos = 0; nPos < nLen; nPos += sizeof(struct inotify_event) + pEvent->len)
+        {
+            pEvent = (const struct inotify_event *)&cBuf[nPos];
+
+            if ((pEvent->mask & (IN_DELETE | IN_MOVED_FROM)) && pEvent->len > 0
+             && (strcmp(pEvent->name, pWatch->szNode) == 0 || strcmp(pEvent->name, DEV_BaseName(pWatch->szName)) == 0))
+            {
+                bGone = TTrue;
+            }
+        }
+    }
+
+    if (pWatch->szDir[0] != '\0') inotify_add_watch(pWatch->fd, pWatch->szDir, DEV_WATCH_MASK);
+
+    bPresent = DEV_Check(pWatch);
+
+    if (pWatch->bPresent && (bGone || !bPresent)) nEvents |= DEV_EV_REMOVED;
+    if (bPresent && (bGone || !pWatch->bPresent)) nEvents |= DEV_EV_ADDED;
+
+    pWatch->bPresent = bPresent;
+
+    return nEvents;
+}
+
+TBool DEV_IsPresent(UTIL_HANDLE hWatch)
+{
+    return ((TDevWatch *)hWatch)->bPresent;
+}
+
+void  DEV_Unwatch(UTIL_HANDLE hWatch)
+{
+    TDevWatch *pWatch = (TDevWatch *)hWatch;
+
+    if (hWatch == INVALID_UTIL_HANDLE) return;
+
+    close(pWatch->fd);
+    free(pWatch);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -354,12 +1159,14 @@ void  THREAD_Terminate(UTIL_HANDLE nHandle)
 typedef struct {
     int                 is_inited;
     int                 is_svr;
+    int                 type;       // SOCK_STREAM or SOCK_DGRAM
     struct sockaddr_in  addr;
+    struct sockaddr_in  peer;       // UDP server: sender of the last datagram
     int                 fd_listen;
     int                 fd_conn;
 }TSockVar;
 
-#define UTIL_MAX_SOCKET     (4)
+#define UTIL_MAX_SOCKET     (64)        // as many as the other tables, one per port or bridge
 #define SOCK_TIMEOUT        (0)
 #define SOCK_WELL_CLOSED    (-1)
 #define SOCK_ERROR_OCCUR    (-2)
@@ -395,15 +1202,102 @@ static TSockVar * SOCK_GetVar(UTIL_HANDLE hSock)
     return &g_tSocketHandleTab[hSock];
 }
 
-static int SOCK_SvrOpen(TSockVar * pVar)
+// A UDP server answers the sender of the last datagram
+static int SOCK_RecvFrom(TSockVar * pVar, char * pBuf, int nLen)
+{
+    socklen_t nPeerLen = sizeof(pVar->peer);
+
+    if (pVar->is_svr && pVar->type == SOCK_DGRAM)
+    {
+        return recvfrom(pVar->fd_conn, pBuf, nLen, MSG_DONTWAIT, (struct sockaddr*)&pVar->peer, &nPeerLen);
+    }
+
+    return recv(pVar->fd_conn, pBuf, nLen, MSG_DONTWAIT);
+}
+
+static int SOCK_SendTo(TSockVar * pVar, const char * pBuf, int nLen, int nFlags)
+{
+    if (pVar->is_svr && pVar->type == SOCK_DGRAM)
+    {
+        return sendto(pVar->fd_conn, pBuf, nLen, nFlags, (struct sockaddr*)&pVar->peer, sizeof(pVar->peer));
+    }
+
+    return send(pVar->fd_conn, pBuf, nLen, nFlags);
+}
+
+// Buffer sizes go on the socket before connect() or listen(): TCP picks its
+// window scale from them in the handshake, and accepted sockets inherit them
+static TU32 SOCK_TuneBuf(int fd, const SOCK_CONFIG *pCfg)
+{
+    int nRx, nTx;
+
+    if (!pCfg || !(pCfg->nTunings & SOCK_TUNE_BUF_SIZE)) return 0;
+
+    nRx = (int)pCfg->nRxBufSize;
+    nTx = (int)pCfg->nTxBufSize;
+
+    if ((nRx == 0 || setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &nRx, sizeof(nRx)) == 0)
+     && (nTx == 0 || setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &nTx, sizeof(nTx)) == 0))
+    {
+        return SOCK_TUNE_BUF_SIZE;
+    }
+
+    return 0;
+}
+
+// Per connection, once it is up
+static TU32 SOCK_TuneConn(TSockVar * pVar, const SOCK_CONFIG *pCfg)
+{
+    int  nOn = 1;
+
+    if (pCfg && (pCfg->nTunings & SOCK_TUNE_NODELAY) && pVar->type == SOCK_STREAM
+     && setsockopt(pVar->fd_conn, IPPROTO_TCP, TCP_NODELAY, &nOn, sizeof(nOn)) == 0)
+    {
+        return SOCK_TUNE_NODELAY;
+    }
+
+    return 0;
+}
+
+// UDP has no accept: the peer is the sender of the first datagram, then
+// of the last one, so that a client may come back from another port
+static int SOCK_SvrOpenUdp(TSockVar * pVar)
+{
+    socklen_t nPeerLen = sizeof(pVar->peer);
+    char c;
+
+    pVar->fd_conn = pVar->fd_listen;
+    pVar->fd_listen = -1;
+
+    _LOG_("SOCK_SVR: waiting for a datagram on port (%d) ...\n", ntohs(pVar->addr.sin_port));
+
+    if (recvfrom(pVar->fd_conn, &c, 1, MSG_PEEK, (struct sockaddr*)&pVar->peer, &nPeerLen) < 0)
+    {
+        _LOG_("udp peer error: %s (errno: %d) \n", strerror(errno), errno);
+        return -1;
+    }
+
+    fcntl(pVar->fd_conn, F_SETFL, O_NONBLOCK);
+
+    return 0;
+}
+
+static int SOCK_SvrOpen(TSockVar * pVar, const SOCK_CONFIG *pCfg, TU32 *pApplied)
 { 
+    int nOn = 1;
+
     // create socket
-    if ( (pVar->fd_listen = socket(AF_INET, SOCK_STREAM, 0)) == -1 )
+    if ( (pVar->fd_listen = socket(AF_INET, pVar->type, 0)) == -1 )
     {
         _LOG_("create socket error: %s (errno: %d) \n", strerror(errno), errno);
         return -1;
     }
 
+    *pApplied |= SOCK_TuneBuf(pVar->fd_listen, pCfg);
+
+    // a restarted server gets its port back at once
+    setsockopt(pVar->fd_listen, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn));
+
     // bind
     if ( bind(pVar->fd_listen, (struct sockaddr*)&pVar->addr, sizeof(pVar->addr))  == -1 )
     {
@@ -411,6 +1305,8 @@ static int SOCK_SvrOpen(TSockVar * pVar)
         return -1;
     }
 
+    if (pVar->type == SOCK_DGRAM) return SOCK_SvrOpenUdp(pVar);
+
     // listen
     if ( listen(pVar->fd_listen, 10)  == -1 )
     {
@@ -435,15 +1331,17 @@ static int SOCK_SvrOpen(TSockVar * pVar)
     return 0;
 }
 
-static int SOCK_CltOpen(TSockVar * pVar)
+static int SOCK_CltOpen(TSockVar * pVar, const SOCK_CONFIG *pCfg, TU32 *pApplied)
 {
     // create socket
-    if ( (pVar->fd_conn = socket(AF_INET, SOCK_STREAM, 0))  == -1 )
+    if ( (pVar->fd_conn = socket(AF_INET, pVar->type, 0))  == -1 )
     {
         _LOG_("create socket error: %s (errno: %d) \n", strerror(errno), errno);
         return -1;
     }
     
+    *pApplied |= SOCK_TuneBuf(pVar->fd_conn, pCfg);
+
     // connect
     if ( connect(pVar->fd_conn, (struct sockaddr*)&pVar->addr, sizeof(pVar->addr)) < 0 )
     {
@@ -460,10 +1358,18 @@ static int SOCK_CltOpen(TSockVar * pVar)
 }
 
 UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
+{
+    return SOCK_OpenEx(nAddr, nPort, NULL, NULL);
+}
+
+UTIL_HANDLE SOCK_OpenEx(TU32 nAddr, TU16 nPort, const SOCK_CONFIG *pCfg, TU32 *pApplied)
 {
     int     ret = -1;
     TU32    idx;
+    TU32    nApplied = 0;
     TSockVar    * pVar;
+
+    if (pApplied) *pApplied = 0;
     
     if (!g_bSocketTabInited) SocketTabInit();
     
@@ -476,6 +1382,7 @@ UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
     if (pVar->is_inited) SOCK_Close(idx);
 
     pVar->is_svr = (nAddr == 0) ? 1 : 0;
+    pVar->type = (pCfg && pCfg->nType == SOCK_TYPE_UDP) ? SOCK_DGRAM : SOCK_STREAM;
 
     memset(&pVar->addr, 0, sizeof(struct sockaddr_in));
     pVar->addr.sin_family = AF_INET;
@@ -492,7 +1399,7 @@ UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
     pVar->fd_listen = -1;
     pVar->fd_conn = -1;
 
-    ret = (pVar->is_svr ? SOCK_SvrOpen(pVar) : SOCK_CltOpen(pVar));
+    ret = (pVar->is_svr ? SOCK_SvrOpen(pVar, pCfg, &nApplied) : SOCK_CltOpen(pVar, pCfg, &nApplied));
 
     if (ret < 0)
     {
@@ -502,9 +1409,27 @@ UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
 
     pVar->is_inited = 1;
 
+    nApplied |= SOCK_TuneConn(pVar, pCfg);
+    if (pApplied) *pApplied = nApplied;
+
     return (UTIL_HANDLE)idx;
 }
 
+TBool SOCK_Resolve(const char *szHost, TU32 *pAddr)
+{
+    struct addrinfo tHints, *pRes;
+
+    memset(&tHints, 0, sizeof(tHints));
+    tHints.ai_family = AF_INET;
+
+    if (getaddrinfo(szHost, NULL, &tHints, &pRes) != 0) return TFalse;
+
+    *pAddr = ntohl(((struct sockaddr_in *)pRes->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(pRes);
+
+    return TTrue;
+}
+
 TS32  SOCK_GetRxBufLen(UTIL_HANDLE hSock)
 {
     TSockVar    * pVar = SOCK_GetVar(hSock);
@@ -545,7 +1470,7 @@ TS32  SOCK_Read(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen, TU32 nTmout)
     else if ( nRet > 0 && FD_ISSET(pVar->fd_conn, &read_fd))
     {
         // start receive
-        nRet = recv(pVar->fd_conn, (char *)pBuf, nBufLen, MSG_DONTWAIT);
+        nRet = SOCK_RecvFrom(pVar, (char *)pBuf, nBufLen);
         if (nRet > 0) return nRet;
         else if (nRet == 0) return SOCK_WELL_CLOSED;
     }
@@ -562,7 +1487,7 @@ TS32  SOCK_Write(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen)
     
     while (nSent < nBufLen)
     {
-        nRet = send(pVar->fd_conn, (char *)(pBuf + nSent), nBufLen - nSent, 0);
+        nRet = SOCK_SendTo(pVar, (char *)(pBuf + nSent), nBufLen - nSent, 0);
 
         if (nRet < 0)
         {
@@ -585,6 +1510,29 @@ TS32  SOCK_Write(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen)
     return nBufLen;
 }
 
+TS32  SOCK_Send(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen)
+{
+    TSockVar  * pVar = SOCK_GetVar(hSock);
+    int         nRet;
+
+    if (pVar == NULL) return SOCK_ERROR_OCCUR;
+
+    nRet = SOCK_SendTo(pVar, (char *)pBuf, nBufLen, MSG_DONTWAIT);
+    if (nRet >= 0) return nRet;
+
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : SOCK_ERROR_OCCUR;
+}
+
+TU32  SOCK_Wait(UTIL_HANDLE hSock, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    TSockVar  * pVar = SOCK_GetVar(hSock);
+
+    if (pVar == NULL) return UART_EV_ERROR;
+
+    // Any fd polls the same
+    return UART_WaitEx((UTIL_HANDLE)pVar->fd_conn, hWake, nEvents, nTimeoutUs);
+}
+
 void  SOCK_Close(UTIL_HANDLE hSock)
 {
     TSockVar    * pVar;
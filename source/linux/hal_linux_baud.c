@@ -0,0 +1,32 @@
+#include "hal.h"
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+// termios2 lets the kernel take any baud rate with BOTHER. Its struct clashes
+// with the one of <termios.h>, so it lives in this file alone.
+
+////////////////////////////////////////////////////////////////////////////////
+TBool UART_SetBaud(UTIL_HANDLE nHandle, TU32 nBaud)
+{
+    struct termios2 Opt;
+
+    if (nBaud == 0) return TFalse;
+
+    if (ioctl((int)nHandle, TCGETS2, &Opt) < 0) return TFalse;
+
+    Opt.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    Opt.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    Opt.c_ispeed = nBaud;
+    Opt.c_ospeed = nBaud;
+
+    return (TBool)(ioctl((int)nHandle, TCSETS2, &Opt) == 0);
+}
+
+TU32  UART_GetBaud(UTIL_HANDLE nHandle)
+{
+    struct termios2 Opt;
+
+    if (ioctl((int)nHandle, TCGETS2, &Opt) < 0) return 0;
+
+    return (TU32)Opt.c_ospeed;
+}
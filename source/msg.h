@@ -5,6 +5,9 @@
 extern "C" {
 #endif
 
+#include "util.h"
+#include <string.h>
+
 #define MAX_PAYLOAD_LEN         (2100)
 
 #define RADAR_CMD_INIT          (0x00)
@@ -30,6 +33,156 @@ extern "C" {
 #define CMD_BIT_REQ             ((TU8)(0x80))
 #define CMD_BIT_RSP             ((TU8)(0x00))
 
+////////////////////////////////////////////////////////////////////////////////
+// Message schema
+//
+// Each payload is described once, as a list of F(m, Field, Type, Count) in
+// wire order. MSG_DEFINE() turns the list into:
+//   MSG_LEN_<m>              length of the fixed part, summed at compile time
+//   MSG_OFF_<m>_<Field>      offset of the field in the payload
+//   MSG_<m>_<Field>(p)       reads the field straight from the payload
+//   MSG_<m>_Set<Field>(p, v) writes the field into a payload being built
+// Types are U8, U16 and U32 (LSB first) or BYTES, read as a pointer into the
+// payload. Variable data after the fixed part is reached with MSG_TAIL().
+#define MSG_T_U8                TU8
+#define MSG_T_U16               TU16
+#define MSG_T_U32               TU32
+#define MSG_T_BYTES             TU8 *
+
+#define MSG_SIZE_U8             (1)
+#define MSG_SIZE_U16            (2)
+#define MSG_SIZE_U32            (4)
+#define MSG_SIZE_BYTES          (1)
+
+#define MSG_GET_U8(p)           (*(p))
+#define MSG_GET_U16(p)          UTIL_DEC_TU16_LSBF(p)
+#define MSG_GET_U32(p)          UTIL_DEC_TU32_LSBF(p)
+#define MSG_GET_BYTES(p)        (p)
+
+#define MSG_PUT_U8(p, v, n)     (*(p) = (v))
+#define MSG_PUT_U16(p, v, n)    UTIL_ENC_TU16_LSBF(p, v)
+#define MSG_PUT_U32(p, v, n)    UTIL_ENC_TU32_LSBF(p, v)
+#define MSG_PUT_BYTES(p, v, n)  memcpy((p), (v), (n))
+
+// Each field takes an offset and an end; the next offset follows the end
+#define MSG_FIELD_OFF(m, f, t, n) \
+    MSG_OFF_##m##_##f, MSG_END_##m##_##f = MSG_OFF_##m##_##f + MSG_SIZE_##t * (n) - 1,
+
+#define MSG_FIELD_GET(m, f, t, n) \
+    static __inline MSG_T_##t MSG_##m##_##f(TU8 *p) { return MSG_GET_##t(p + MSG_OFF_##m##_##f); }
+
+#define MSG_FIELD_SET(m, f, t, n) \
+    static __inline void MSG_##m##_Set##f(TU8 *p, MSG_T_##t v) { MSG_PUT_##t(p + MSG_OFF_##m##_##f, v, MSG_SIZE_##t * (n)); }
+
+#define MSG_DEFINE(m, LIST) \
+    enum { LIST(MSG_FIELD_OFF, m) MSG_LEN_##m }; \
+    LIST(MSG_FIELD_GET, m) \
+    LIST(MSG_FIELD_SET, m) \
+    UTIL_STATIC_ASSERT(MSG_LEN_##m <= MAX_PAYLOAD_LEN, msg_len_##m)
+
+#define MSG_FIELD_SIZE(m, f)    (MSG_END_##m##_##f - MSG_OFF_##m##_##f + 1)
+#define MSG_CHECK_LEN(m, nLen)  ((nLen) >= MSG_LEN_##m)
+#define MSG_TAIL(m, p)          ((p) + MSG_LEN_##m)
+#define MSG_TAIL_LEN(m, nLen)   ((TU16)((nLen) - MSG_LEN_##m))
+
+////////////////////////////////////////////////////////////////////////////////
+// Payloads of every RADAR_CMD_*, REQ then RSP
+#define MSG_SCHEMA_INIT_REQ(F, m)
+#define MSG_SCHEMA_INIT_RSP(F, m)
+
+#define MSG_SCHEMA_GET_INFO_REQ(F, m)
+#define MSG_SCHEMA_GET_INFO_RSP(F, m) \
+    F(m, MajorVer,  U8,     1) \
+    F(m, MinorVer,  U8,     1) \
+    F(m, SerialNum, BYTES,  32) \
+    F(m, Name,      BYTES,  64)
+
+#define MSG_SCHEMA_SET_LD_REQ(F, m) \
+    F(m, Power,     U8,     1)
+#define MSG_SCHEMA_SET_LD_RSP(F, m) \
+    F(m, Power,     U8,     1)
+
+#define MSG_SCHEMA_SET_MODE_REQ(F, m) \
+    F(m, Mode,      U8,     1)
+#define MSG_SCHEMA_SET_MODE_RSP(F, m) \
+    F(m, Mode,      U8,     1)
+
+#define MSG_SCHEMA_SET_RES_REQ(F, m) \
+    F(m, DepthSize, U16,    1)
+#define MSG_SCHEMA_SET_RES_RSP(F, m) \
+    F(m, DepthSize, U16,    1)
+
+#define MSG_SCHEMA_GET_FOV_REQ(F, m)
+#define MSG_SCHEMA_GET_FOV_RSP(F, m) \
+    F(m, Fov,       U16,    1)
+
+#define MSG_SCHEMA_GET_MAX_RES_REQ(F, m)
+#define MSG_SCHEMA_GET_MAX_RES_RSP(F, m) \
+    F(m, MaxRes,    U16,    1)
+
+// Followed by the depth, TU16 LSB first
+#define MSG_SCHEMA_TRIG_DEPTH_REQ(F, m)
+#define MSG_SCHEMA_TRIG_DEPTH_RSP(F, m) \
+    F(m, Timestamp, U32,    1)
+
+#define MSG_SCHEMA_START_DEPTH_REQ(F, m)
+#define MSG_SCHEMA_START_DEPTH_RSP(F, m)
+
+#define MSG_SCHEMA_STOP_DEPTH_REQ(F, m)
+#define MSG_SCHEMA_STOP_DEPTH_RSP(F, m)
+
+#define MSG_SCHEMA_TAKE_DBG_IMG_REQ(F, m)
+#define MSG_SCHEMA_TAKE_DBG_IMG_RSP(F, m) \
+    F(m, Width,     U16,    1) \
+    F(m, Height,    U16,    1)
+
+// The response is the image data only
+#define MSG_SCHEMA_READ_DBG_IMG_REQ(F, m) \
+    F(m, Offset,    U32,    1) \
+    F(m, Len,       U16,    1)
+#define MSG_SCHEMA_READ_DBG_IMG_RSP(F, m)
+
+// Sent by the device: followed by the depth, TU16 LSB first
+#define MSG_SCHEMA_REPORT_DEPTH_REQ(F, m) \
+    F(m, Timestamp, U32,    1)
+
+// Sent by the device: the payload is not decoded
+#define MSG_SCHEMA_REPORT_ERROR_REQ(F, m)
+
+MSG_DEFINE(InitReq,         MSG_SCHEMA_INIT_REQ);
+MSG_DEFINE(InitRsp,         MSG_SCHEMA_INIT_RSP);
+MSG_DEFINE(GetInfoReq,      MSG_SCHEMA_GET_INFO_REQ);
+MSG_DEFINE(GetInfoRsp,      MSG_SCHEMA_GET_INFO_RSP);
+MSG_DEFINE(SetLdReq,        MSG_SCHEMA_SET_LD_REQ);
+MSG_DEFINE(SetLdRsp,        MSG_SCHEMA_SET_LD_RSP);
+MSG_DEFINE(SetModeReq,      MSG_SCHEMA_SET_MODE_REQ);
+MSG_DEFINE(SetModeRsp,      MSG_SCHEMA_SET_MODE_RSP);
+MSG_DEFINE(SetResReq,       MSG_SCHEMA_SET_RES_REQ);
+MSG_DEFINE(SetResRsp,       MSG_SCHEMA_SET_RES_RSP);
+MSG_DEFINE(GetFovReq,       MSG_SCHEMA_GET_FOV_REQ);
+MSG_DEFINE(GetFovRsp,       MSG_SCHEMA_GET_FOV_RSP);
+MSG_DEFINE(GetMaxResReq,    MSG_SCHEMA_GET_MAX_RES_REQ);
+MSG_DEFINE(GetMaxResRsp,    MSG_SCHEMA_GET_MAX_RES_RSP);
+MSG_DEFINE(TrigDepthReq,    MSG_SCHEMA_TRIG_DEPTH_REQ);
+MSG_DEFINE(TrigDepthRsp,    MSG_SCHEMA_TRIG_DEPTH_RSP);
+MSG_DEFINE(StartDepthReq,   MSG_SCHEMA_START_DEPTH_REQ);
+MSG_DEFINE(StartDepthRsp,   MSG_SCHEMA_START_DEPTH_RSP);
+MSG_DEFINE(StopDepthReq,    MSG_SCHEMA_STOP_DEPTH_REQ);
+MSG_DEFINE(StopDepthRsp,    MSG_SCHEMA_STOP_DEPTH_RSP);
+MSG_DEFINE(TakeDbgImgReq,   MSG_SCHEMA_TAKE_DBG_IMG_REQ);
+MSG_DEFINE(TakeDbgImgRsp,   MSG_SCHEMA_TAKE_DBG_IMG_RSP);
+MSG_DEFINE(ReadDbgImgReq,   MSG_SCHEMA_READ_DBG_IMG_REQ);
+MSG_DEFINE(ReadDbgImgRsp,   MSG_SCHEMA_READ_DBG_IMG_RSP);
+MSG_DEFINE(ReportDepthReq,  MSG_SCHEMA_REPORT_DEPTH_REQ);
+MSG_DEFINE(ReportErrorReq,  MSG_SCHEMA_REPORT_ERROR_REQ);
+
+// Wire sizes fixed by the protocol
+UTIL_STATIC_ASSERT(MSG_LEN_GetInfoRsp     == 98, msg_wire_GetInfoRsp);
+UTIL_STATIC_ASSERT(MSG_LEN_SetResReq      == 2,  msg_wire_SetResReq);
+UTIL_STATIC_ASSERT(MSG_LEN_TakeDbgImgRsp  == 4,  msg_wire_TakeDbgImgRsp);
+UTIL_STATIC_ASSERT(MSG_LEN_ReadDbgImgReq  == 6,  msg_wire_ReadDbgImgReq);
+UTIL_STATIC_ASSERT((int)MSG_LEN_TrigDepthRsp == (int)MSG_LEN_ReportDepthReq, msg_wire_Depth);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,13 +6,25 @@
 #include "display.h"
 #include "util.h"
 
+#ifdef __linux__
+#define _snprintf   snprintf
+#endif
+
 #define BRIGHTNESS_AUTO_CTRL        (0xFF)
 #define DEPTH_SIZE_UNKNOWN          (0xFFFF)
 
-static char           g_szPort[16] = "";                    // -p
+static char           g_szPort[RADAR_MAX_PORT_NAME] = "";   // -p
+static unsigned long  g_nBaud = RADAR_DEF_BAUD;             // -r
+static unsigned char  g_bDiscover = 0;                      // -D
+static char         * g_szSerialNum = NULL;                 // -S
+static unsigned char  g_bLowLatency = 0;                   // -l
+static int            g_nIoPriority = -1;                   // -P
+static int            g_nIoCpu = -1;                        // -A
+static unsigned char  g_bCtsEvents = 0;                     // -e
 static unsigned char  g_nDbgLevel = 2;                      // -L
 static unsigned char  g_bLogToScreen = 0;                   // -t
 static char         * g_szFileName = NULL;                  // -f
+static char         * g_szCapFileName = NULL;               // -c
 static unsigned char  g_nBrightness = BRIGHTNESS_AUTO_CTRL; // -b
 static unsigned short g_nDepthSize = DEPTH_SIZE_UNKNOWN;    // -s
 static float          g_fFovDeviation = 0;                  // -d
@@ -33,10 +45,19 @@ static void PrintUsage(void)
     printf("\n");
     printf("Usage: radar_clt [-x param] ...\n");
     printf("   [-x param] could be:\n");
-    printf("    -p port_num    : UART device name or COM port number\n");
+    printf("    -p port_num    : UART device name, COM port number, tcp://host:port or udp://host:port\n");
+    printf("                     of a network bridge, or trace:file[,paced] to replay a log\n");
+    printf("    -r baud_rate   : UART baud rate, 0 to probe the device, default 115200\n");
+    printf("    -D             : list the devices found on all serial ports, then exit\n");
+    printf("    -S serial_num  : open the device with this serial number, on any port, instead of -p\n");
+    printf("    -l             : low latency serial mode, for USB-serial adapters\n");
+    printf("    -P priority    : port I/O on its own thread, at this real-time priority, 0 for normal\n");
+    printf("    -A cpu         : port I/O on its own thread, bound to this CPU\n");
+    printf("    -e             : log the edges of the CTS line with the depth frames\n");
     printf("    -L log_level   : LOG level, default 2\n");
     printf("    -t             : print log to screen\n");
     printf("    -f file        : print log to file\n");
+    printf("    -c file        : capture raw UART bytes to a binary file\n");
     printf("    -b brightness  : set brightness of the laser, default auto controlled by the device\n");
     printf("    -s depth_size  : set depth size. default max size of device\n");
     printf("    -d deviation   : set the optical axis deviation, default 0\n");
@@ -57,9 +78,9 @@ static int ParseArgs(int argc, char *argv[])
         if (strcmp(argv[i], "-p") == 0)
         {
             if ((++i) >= argc) return -1;
-            if (argv[i][0] == '/')
+            if (argv[i][0] == '/' || strchr(argv[i], ':'))
             {
-                strncpy(g_szPort, argv[i], 16 - 1); // "/dev/ttyS0"
+                strncpy(g_szPort, argv[i], sizeof(g_szPort) - 1); // "/dev/ttyS0", "/dev/serial/by-id/..", "trace:a.txt" or "tcp://host:5000"
             }
             else
             {
@@ -67,6 +88,38 @@ static int ParseArgs(int argc, char *argv[])
                 sprintf(g_szPort, "\\\\.\\COM%d", nComNum); // "\\.\COM1" - "\\.\COM255"
             }
         }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            if ((++i) >= argc) return -1;
+            g_nBaud = (unsigned long)atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "-D") == 0)
+        {
+            g_bDiscover = 1;
+        }
+        else if (strcmp(argv[i], "-S") == 0)
+        {
+            if ((++i) >= argc) return -1;
+            g_szSerialNum = argv[i];
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            g_bLowLatency = 1;
+        }
+        else if (strcmp(argv[i], "-P") == 0)
+        {
+            if ((++i) >= argc) return -1;
+            g_nIoPriority = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-A") == 0)
+        {
+            if ((++i) >= argc) return -1;
+            g_nIoCpu = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            g_bCtsEvents = 1;
+        }
         else if (strcmp(argv[i], "-L") == 0)
         {
             if ((++i) >= argc) return -1;
@@ -81,6 +134,11 @@ static int ParseArgs(int argc, char *argv[])
             if ((++i) >= argc) return -1;
             g_szFileName = argv[i];
         }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            if ((++i) >= argc) return -1;
+            g_szCapFileName = argv[i];
+        }
         else if (strcmp(argv[i], "-b") == 0)
         {
             if ((++i) >= argc) return -1;
@@ -110,7 +168,7 @@ static int ParseArgs(int argc, char *argv[])
 
 static int CheckArgs(void)
 {
-    if (strcmp(g_szPort, "") == 0)
+    if (strcmp(g_szPort, "") == 0 && !g_bDiscover && !g_szSerialNum)
     {
         printf("UART port not defined!\n");
         return -1;
@@ -119,6 +177,45 @@ static int CheckArgs(void)
     return 0;
 }
 
+// All ports are probed at once: the search takes one probe timeout.
+// Lists what it found, or picks the port of g_szSerialNum.
+static int Discover(void)
+{
+    TRadarFound tFound[RADAR_MAX_DISCOVER_PORTS];
+    TU32 nFound = 0;
+    TU32 i;
+
+    if (radar_discover((TU32)g_nBaud, RADAR_DISCOVER_TIMEOUT, tFound, RADAR_MAX_DISCOVER_PORTS, &nFound) < 0)
+    {
+        printf("radar_discover failed!\n");
+        return -1;
+    }
+
+    for (i=0; i<nFound; i++)
+    {
+        if (g_bDiscover)
+        {
+            printf("%-24s %8lu baud  %-32.32s %.64s\n", tFound[i].szPort, tFound[i].nBaud,
+                   (char *)tFound[i].tInfo.SerialNum, (char *)tFound[i].tInfo.Name);
+        }
+        else if (strncmp((char *)tFound[i].tInfo.SerialNum, g_szSerialNum, sizeof(tFound[i].tInfo.SerialNum)) == 0)
+        {
+            strncpy(g_szPort, tFound[i].szPort, sizeof(g_szPort) - 1);
+            g_nBaud = tFound[i].nBaud;
+            return 0;
+        }
+    }
+
+    if (g_bDiscover)
+    {
+        printf("%lu device(s) found\n", nFound);
+        return 0;
+    }
+
+    printf("Device [%s] not found!\n", g_szSerialNum);
+    return -1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Test State Machine
 
@@ -131,9 +228,12 @@ enum {
 };
 
 #define DAT_LEN_FOR_DBGIMG_READ (512)
+#define DAT_LEN_FOR_DBGIMG_STEP (DAT_LEN_FOR_DBGIMG_READ*8)
 #define FRM_COUNT_FOR_FPS_STAT  (10)
 #define MAX_TIME_FOR_UPDATE_FPS (2000)
+#define MAX_TIME_FOR_REOPEN     (1000)
 #define MAX_DBG_IMG_SIZE        (1280*1024)
+#define DBG_IMG_NAME_LEN        (80)    // "dbg_img_" + 6 ints of up to 11 chars + ".raw"
 #define DEPTH_WINDOW_NAME       ("Percipio Depth")
 #define DBG_IMG_WINDOW_NAME     ("RAW Image for Debug")
 
@@ -145,12 +245,37 @@ static TBool g_bExit = TFalse;
 static TU16  g_nDbgImgWidth = 0;
 static TU16  g_nDbgImgHeight = 0;
 static TU32  g_nDbgImgOffset = 0;
-static char  g_szDbgImgName[30];
+static char  g_szDbgImgName[DBG_IMG_NAME_LEN];
 static char  g_cDbgImgBuf[MAX_DBG_IMG_SIZE];
 
 static TU32  g_nFrmNumTotal = 0;
 static TU32  g_nFrmNumForFps = 0;
-static TU32  g_nStartTimeForFps = 0;
+static TU64  g_nStartTimeForFps = 0;     // us
+
+// Device timestamp, host arrival, and the host time of the device timestamp
+static void LogDepth(TU32 nTimestamp, TU16 nDepthSize)
+{
+    TU64 nDevTime, nHostTime;
+    TU32 nErrBound;
+    TRadarCtsEvent tEdge;
+
+    if (radar_get_depth_time(&nDevTime, &nHostTime, &nErrBound) < 0)
+    {
+        nHostTime = 0;
+        nErrBound = 0;
+    }
+
+    LOG("Depth RCVD. timestamp: %u, depth_size: %d, arrival: %.3f ms, host time: %.3f +/- %.3f ms\n",
+        nTimestamp, nDepthSize, radar_get_depth_arrival() / 1000.0, nHostTime / 1000.0, nErrBound / 1000.0);
+
+    // The CTS edges since the last frame, against its host time
+    while (g_bCtsEvents && radar_get_cts_event(&tEdge) == RADAR_ERROR_SUCCESS)
+    {
+        LOG("CTS %s. host time: %.3f ms, %+.3f ms from depth, edges: %lu, lost: %lu\n",
+            tEdge.bHigh ? "high" : "low", tEdge.nTimeUs / 1000.0,
+            ((TDouble)tEdge.nTimeUs - (TDouble)nHostTime) / 1000.0, tEdge.nEdges, tEdge.nLost);
+    }
+}
 
 static TBool SaveBuf(char *pFileName, TU8 *pBuf, TU32 nBufSize)
 {
@@ -178,36 +303,62 @@ static TBool SaveBuf(char *pFileName, TU8 *pBuf, TU32 nBufSize)
 }
 
 
-static TU8 DepthTest_OnInit(void)
+// Everything set up on the opened device, again once it is reopened
+static TBool SetupDevice(void)
 {
     TDevInfo tDevInfo;
+    THREAD_CONFIG tIoCfg;
+    TU32     nApplied;
 
-    if (radar_open(g_szPort) < 0)
-    {
-        LOG("radar_open failed!\n");
-        g_bExit = TTrue;
-        return TEST_STATE_EXIT;
-    }
+    LOG("Baud Rate: %lu\n", radar_get_baud());
+    if (g_bLowLatency) LOG("Low Latency Tunings: 0x%02lX\n", radar_get_tunings());
 
-    if (radar_get_info(&tDevInfo) < 0)
+    if (g_nIoPriority >= 0 || g_nIoCpu >= 0)
     {
-        LOG("radar_get_info failed!\n");
-        goto error;
+        memset(&tIoCfg, 0, sizeof(tIoCfg));
+        tIoCfg.szName    = "radar_io";
+        tIoCfg.nPolicy   = (g_nIoPriority > 0) ? THREAD_SCHED_FIFO : THREAD_SCHED_NORMAL;
+        tIoCfg.nPriority = (TU8)((g_nIoPriority > 0) ? g_nIoPriority : 0);
+        tIoCfg.nCpuMask  = (g_nIoCpu >= 0 && g_nIoCpu < 64) ? ((TU64)1 << g_nIoCpu) : 0;
+
+        if (radar_start_io_thread(&tIoCfg, &nApplied) < 0)
+        {
+            LOG("radar_start_io_thread failed!\n");
+            goto error;
+        }
+
+        LOG("I/O Thread: priority %s, cpu %s\n",
+            (nApplied & THREAD_SET_SCHED) ? "real-time" : "normal",
+            (nApplied & THREAD_SET_AFFINITY) ? "bound" : "any");
     }
-    else
+
+    if (g_bCtsEvents)
     {
-        LOG("Product Name: %s\n", tDevInfo.Name);
-        LOG("Product Version: %d.%d\n", tDevInfo.nMajorVer, tDevInfo.nMinorVer);
-        LOG("Serial Number: %s\n", tDevInfo.SerialNum);
+        memset(&tIoCfg, 0, sizeof(tIoCfg));
+        tIoCfg.szName    = "radar_cts";
+        tIoCfg.nPolicy   = (g_nIoPriority > 0) ? THREAD_SCHED_FIFO : THREAD_SCHED_NORMAL;
+        tIoCfg.nPriority = (TU8)((g_nIoPriority > 0) ? g_nIoPriority : 0);
+
+        if (radar_start_cts_events(&tIoCfg) < 0)
+        {
+            LOG("radar_start_cts_events failed, the port has no CTS events!\n");
+            g_bCtsEvents = 0;
+        }
     }
 
-    if (radar_get_fov(&g_nFov) < 0)
+    // Independent queries go out together, in one round trip. The request
+    // sequence stays the one of the plain calls: INFO, FOV, then MAX_RES
+    // only when no resolution is given.
+    if (radar_query(&tDevInfo, &g_nFov, NULL) < 0)
     {
-        LOG("radar_get_fov failed!\n");
+        LOG("radar_query failed!\n");
         goto error;
     }
     else
     {
+        LOG("Product Name: %s\n", tDevInfo.Name);
+        LOG("Product Version: %d.%d\n", tDevInfo.nMajorVer, tDevInfo.nMinorVer);
+        LOG("Serial Number: %s\n", tDevInfo.SerialNum);
         LOG("FOV: %f Degree\n", (float)(g_nFov / 10.0));
     }
 
@@ -252,22 +403,56 @@ static TU8 DepthTest_OnInit(void)
         goto error;
     }
 
+    return TTrue;
+
+error:
+    return TFalse;
+}
+
+static TU8 DepthTest_OnInit(void)
+{
+    if (radar_open_tuned(g_szPort, g_nBaud, g_bLowLatency ? UART_TUNE_ALL : 0) < 0)
+    {
+        LOG("radar_open failed!\n");
+        g_bExit = TTrue;
+        return TEST_STATE_EXIT;
+    }
+
+    if (!SetupDevice()) return TEST_STATE_EXIT;
+
     g_nFrmNumForFps = 0;
-    g_nStartTimeForFps = TIMER_GetNow();
+    g_nStartTimeForFps = TIMER_GetNowUs();
 
     display_Init();
     display_SetFovDeviation(DEPTH_WINDOW_NAME, g_fFovDeviation);
 
     return TEST_STATE_CONT;
+}
 
-error:
-    return TEST_STATE_EXIT;
+// The port went away, e.g. the USB adapter re-enumerated: wait for it and
+// carry on. Called again on the next frame while it does not come back.
+static TU8 DepthTest_Reopen(void)
+{
+    TU64 nStart = TIMER_GetNowUs();
+
+    if (radar_reopen(MAX_TIME_FOR_REOPEN) < 0)
+    {
+        LOG("radar_reopen: port not back yet\n");
+        return TEST_STATE_CONT;
+    }
+
+    if (!SetupDevice()) return TEST_STATE_EXIT;
+
+    LOG("Port back, depth again after %.3f ms\n", (TIMER_GetNowUs() - nStart) / 1000.0);
+
+    return TEST_STATE_CONT;
 }
 
 static TU8 DepthTest_OnCont(void)
 {
     TU32  nCurEvent;
     TU8   nNextState;
+    int   nRet;
     TU32  nTimestamp;
     TU16 *pDepth = NULL;
     TU16  nDepthSize;
@@ -286,7 +471,7 @@ static TU8 DepthTest_OnCont(void)
         if ((radar_take_dbg_img(&g_nDbgImgWidth, &g_nDbgImgHeight) == RADAR_ERROR_SUCCESS)
          && (g_nDbgImgWidth*g_nDbgImgHeight <= MAX_DBG_IMG_SIZE))
         {
-            _snprintf(g_szDbgImgName, 30, "dbg_img_%04d%02d%02d%02d%02d%02d.raw", 
+            _snprintf(g_szDbgImgName, sizeof(g_szDbgImgName), "dbg_img_%04d%02d%02d%02d%02d%02d.raw", 
                      pTm->tm_year+1900, pTm->tm_mon+1, pTm->tm_mday, pTm->tm_hour, pTm->tm_min, pTm->tm_sec);
 			//sprintf(g_szDbgImgName , "db_img_save.raw");
 
@@ -315,9 +500,11 @@ static TU8 DepthTest_OnCont(void)
         }
         break;
     default:
-        if (radar_cont_get_depth(300, &nTimestamp, &pDepth, &nDepthSize) == RADAR_ERROR_SUCCESS)
+        nRet = radar_cont_get_depth(300, &nTimestamp, &pDepth, &nDepthSize);
+
+        if (nRet == RADAR_ERROR_SUCCESS)
         {
-            LOG("Depth RCVD. timestamp: %u, depth_size: %d\n", nTimestamp, nDepthSize);
+            LogDepth(nTimestamp, nDepthSize);
             display_SetDepthImage(DEPTH_WINDOW_NAME, pDepth, nDepthSize, (float)(g_nFov/10.0));
 //log here
 //
@@ -325,13 +512,18 @@ static TU8 DepthTest_OnCont(void)
 
             g_nFrmNumTotal++;
             g_nFrmNumForFps++;
+            nNextState = TEST_STATE_CONT;
+        }
+        else if (nRet == RADAR_ERROR_PORT_FAILED)
+        {
+            LOG("radar_cont_get_depth: port lost!\n");
+            nNextState = DepthTest_Reopen();
         }
         else
         {
             LOG("radar_cont_get_depth failed!\n");
+            nNextState = TEST_STATE_CONT;
         }
-
-        nNextState = TEST_STATE_CONT;
         break;
     }
 
@@ -360,7 +552,7 @@ static TU8 DepthTest_OnTrig(void)
         if ((radar_take_dbg_img(&g_nDbgImgWidth, &g_nDbgImgHeight) == RADAR_ERROR_SUCCESS)
          && (g_nDbgImgWidth*g_nDbgImgHeight <= MAX_DBG_IMG_SIZE))
         {
-            _snprintf(g_szDbgImgName, 30, "dbg_img_%04d%02d%02d%02d%02d%02d.raw", 
+            _snprintf(g_szDbgImgName, sizeof(g_szDbgImgName), "dbg_img_%04d%02d%02d%02d%02d%02d.raw", 
                      pTm->tm_year+1900, pTm->tm_mon+1, pTm->tm_mday, pTm->tm_hour, pTm->tm_min, pTm->tm_sec);
 
             g_nDbgImgOffset = 0;
@@ -398,7 +590,7 @@ static TU8 DepthTest_OnTrig(void)
     case DISPLAY_EVENT_TRIG:
         if (radar_trig_get_depth(&nTimestamp, &pDepth, &nDepthSize) == RADAR_ERROR_SUCCESS)
         {
-            LOG("Depth RCVD. timestamp: %u, depth_size: %d\n", nTimestamp, nDepthSize);
+            LogDepth(nTimestamp, nDepthSize);
             display_SetDepthImage(DEPTH_WINDOW_NAME, pDepth, nDepthSize, (float)(g_nFov/10.0));
 
             g_nFrmNumTotal++;
@@ -423,7 +615,8 @@ static TU8 DepthTest_OnSave(void)
 {
     TU32  nCurEvent;
     TU8   nNextState;
-    TU16  nLen;
+    TU32  nLen;
+    TU32  nLenToRead;
 
     nCurEvent = g_nTestEvent;
     g_nTestEvent = DISPLAY_EVENT_NOEVENT;
@@ -434,11 +627,14 @@ static TU8 DepthTest_OnSave(void)
         nNextState = TEST_STATE_EXIT;
         break;  
     default:
-        nLen = DAT_LEN_FOR_DBGIMG_READ;
+        // Several segments per step, read with requests in flight
+        nLenToRead = UTIL_MIN(DAT_LEN_FOR_DBGIMG_STEP, MAX_DBG_IMG_SIZE - g_nDbgImgOffset);
+        nLen = nLenToRead;
 
-        if (radar_read_dbg_img(g_nDbgImgOffset, (TU8 *)&g_cDbgImgBuf[g_nDbgImgOffset], &nLen) == RADAR_ERROR_SUCCESS)
+        if ((nLenToRead == 0)
+         || (radar_read_dbg_img_bulk(g_nDbgImgOffset, (TU8 *)&g_cDbgImgBuf[g_nDbgImgOffset], &nLen, DAT_LEN_FOR_DBGIMG_READ) == RADAR_ERROR_SUCCESS))
         {
-            if (nLen < DAT_LEN_FOR_DBGIMG_READ)
+            if (nLen < nLenToRead || nLenToRead == 0)
             {
                 if (SaveBuf(g_szDbgImgName, (TU8 *)g_cDbgImgBuf, g_nDbgImgWidth*g_nDbgImgHeight))
                 {
@@ -458,11 +654,11 @@ static TU8 DepthTest_OnSave(void)
             }
             else
             {
-                g_nDbgImgOffset += DAT_LEN_FOR_DBGIMG_READ;
+                g_nDbgImgOffset += nLen;
             
                 display_SetDebugImageInfo(DEPTH_WINDOW_NAME, (TU8)(100*g_nDbgImgOffset/(g_nDbgImgWidth*g_nDbgImgHeight)), g_szDbgImgName);
             
-                LOG("radar_read_dbg_img: offset=0x%X, len=%d\n", g_nDbgImgOffset, nLen);
+                LOG("radar_read_dbg_img: offset=0x%X, len=%d\n", g_nDbgImgOffset, (int)nLen);
                 nNextState = TEST_STATE_SAVE;
             }
         }
@@ -515,8 +711,9 @@ static void DepthTest_Init(void)
 
 static void DepthTest_Fsm(void)
 {
-    TU32 nElapse;
+    TU64 nElapse;
     static float fFps = 0;
+    TXcomStats tStats;
 
     switch (g_nTestState)
     {
@@ -531,16 +728,21 @@ static void DepthTest_Fsm(void)
 
     if (g_bExit) return;
 
-    nElapse = TIMER_GetNow() - g_nStartTimeForFps;
-    if (g_nFrmNumForFps == FRM_COUNT_FOR_FPS_STAT || nElapse > MAX_TIME_FOR_UPDATE_FPS)
+    nElapse = TIMER_GetNowUs() - g_nStartTimeForFps;
+    if (g_nFrmNumForFps == FRM_COUNT_FOR_FPS_STAT || nElapse > (TU64)MAX_TIME_FOR_UPDATE_FPS * 1000)
     {
         if (nElapse != 0)
         {
-            fFps = (float)(g_nFrmNumForFps * 1000.0 / nElapse);
+            fFps = (float)(g_nFrmNumForFps * 1000000.0 / nElapse);
         }
 
+        radar_get_link_stats(&tStats);
+        LOG("LINK: rx %u frames, %u crc err, %u hdr rej, %u skipped, util rx %.1f%% tx %.1f%% of %u baud\n",
+            (unsigned)tStats.nRxFrames, (unsigned)tStats.nRxCrcErrors, (unsigned)tStats.nRxHeaderRejects,
+            (unsigned)tStats.nRxSkipBytes, tStats.fRxUtil * 100, tStats.fTxUtil * 100, (unsigned)tStats.nBaud);
+
         g_nFrmNumForFps = 0;
-        g_nStartTimeForFps = TIMER_GetNow();
+        g_nStartTimeForFps = TIMER_GetNowUs();
     }
     
     display_SetStatInfo(DEPTH_WINDOW_NAME, g_nFrmNumTotal, fFps);
@@ -569,6 +771,14 @@ int radar_clt_main(int argc, char *argv[])
 
     LOG_Init(g_bLogToScreen, g_szFileName, 1, g_nDbgLevel);
 
+    if (g_bDiscover || g_szSerialNum)
+    {
+        if (Discover() < 0) return -1;
+        if (g_bDiscover) return 0;
+    }
+
+    if (g_szCapFileName) CAP_Init(g_szCapFileName);
+
     DepthTest_Init();
 
     while (!g_bExit)
@@ -576,5 +786,7 @@ int radar_clt_main(int argc, char *argv[])
         DepthTest_Fsm();
     }
 
+    CAP_DeInit();
+
     return 0;
 }
@@ -3,52 +3,114 @@
 #include "xcom.h"
 #include "xcom_port.h"
 #include "util.h"
+#include <stdlib.h>
 #include <string.h>
 
 #define IO_DEF_TIMEOUT         (1000)
 #define TAKE_DBG_IMG_TIMEOUT   (10000)
 #define MAX_IO_TRY_NUM         (3)
+#define PROBE_TIMEOUT          (100)
 
-// Variables for response from the radar
-static TBool g_bRspReady = TFalse;
-static TU8   g_nCurId = 0;
-static TU8   g_nCurCmd = 0;
-static TU8   g_cCurBuf[MAX_PAYLOAD_LEN] = {0};
-static TU16  g_nCurLen = 0;
+// Longest single wait on the port, in ms, so that it fits in TU32 us
+#define MAX_WAIT_SLICE         (1000000)
 
-// Variables for Depth reported by the radar
-static TU8   g_cCurDepthBuf[MAX_PAYLOAD_LEN] = {0};
-static TU16  g_nCurDepthLen = 0;
+// Longest sleep of the I/O thread between port checks, in ms
+#define IO_THREAD_SLICE        (10)
 
-// Variables for device failed reported by the radar
-static TBool g_bDevFailed = TFalse;
+// Longest wait for the I/O thread to end, in ms. It checks bIoRun at
+// least every IO_THREAD_SLICE, so this is only hit if it is stuck.
+#define IO_THREAD_STOP_TIMEOUT (1000)
+
+// Longest wait of radar_reopen_ex between tries at a port that is back, in ms
+#define REOPEN_SLICE           (10)
+
+// Stack of a radar_discover probe thread, in bytes
+#define DISCOVER_STACK_SIZE    (256*1024)
+
+// Time a radar_discover probe may take on top of its answer timeouts, in ms
+#define DISCOVER_JOIN_MARGIN   (2000)
+
+// Bits on the wire per byte: start + 8 data + stop
+#define UART_BITS_PER_BYTE     (10)
+#define MSG_OVERHEAD_LEN       (XCOM_MAX_MSG_LEN - XCOM_MAX_PAYLOAD_LEN)
+
+// In-flight requests, keyed by the low bits of the 8-bit message ID
+#define MAX_REQ_IN_FLIGHT      (RADAR_MAX_REQ_IN_FLIGHT)
+#define REQ_SLOT(c, id)        (&(c)->tReqTab[(id) & (MAX_REQ_IN_FLIGHT - 1)])
+
+enum {
+    REQ_STATE_FREE = 0,
+    REQ_STATE_SENT,
+    REQ_STATE_DONE
+};
+
+// Device context behind the radar_*() calls without _ex
+static TRadarCtx g_tRadarDef;
+
+// Rates tried by RADAR_BAUD_AUTO, the most likely first
+static const TU32 g_nProbeBaudTab[] = {
+    115200, 921600, 460800, 230400, 1000000, 1500000, 2000000, 3000000, 57600, 38400, 19200, 9600
+};
+
+UTIL_STATIC_ASSERT(MSG_FIELD_SIZE(GetInfoRsp, SerialNum) == sizeof(((TDevInfo *)0)->SerialNum), dev_info_sn);
+UTIL_STATIC_ASSERT(MSG_FIELD_SIZE(GetInfoRsp, Name) == sizeof(((TDevInfo *)0)->Name), dev_info_name);
 
 ////////////////////////////////////////////////////////////////////////////////
-static TU8 GetMsgIdToSend(void)
+static TU8 GetMsgIdToSend(TRadarCtx *pCtx)
+{
+    pCtx->nTxCount++;
+    return (TU8)pCtx->nTxCount;
+}
+
+// With an I/O thread, the link state is shared with it
+static void CtxLock(TRadarCtx *pCtx)
+{
+    if (pCtx->bIoThread) MUTEX_Lock(pCtx->hIoLock);
+}
+
+static void CtxUnlock(TRadarCtx *pCtx)
+{
+    if (pCtx->bIoThread) MUTEX_Unlock(pCtx->hIoLock);
+}
+
+// Move bytes between the port and the link, unless the I/O thread does it
+static void PumpPort(TRadarCtx *pCtx)
+{
+    if (!pCtx->bIoThread) xcom_fsm(&pCtx->tXcom);
+}
+
+// A frame is stamped when its last byte is read: take off the time it took
+// on the line to get the host time the device started sending it
+static TU64 FrameStartTime(TRadarCtx *pCtx, TU64 nArrivalUs, TU16 nPayloadLen)
 {
-    static TU32 g_nTxCount = 0;
+    TU64 nWireUs = (TU64)(nPayloadLen + MSG_OVERHEAD_LEN) * UART_BITS_PER_BYTE * 1000000 / UTIL_MAX(pCtx->tXcom.nBaud, 1);
 
-    g_nTxCount++;
-    return (TU8)g_nTxCount;
+    return (nArrivalUs > nWireUs) ? (nArrivalUs - nWireUs) : 0;
 }
 
-static void clt_xcom_rcvd_cb(TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+static void clt_xcom_rcvd_cb(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
 {
+    TRadarCtx *pCtx = (TRadarCtx *)pParam;
+    TRadarReq *pSlot = NULL;
+
     LOG("MSG RCVD: Id=0x%02X, Cmd=0x%02X, Len=%d\n", nId, nCmd, nLen);
 
     if ((nCmd & CMD_MASK_REQ_RSP) == CMD_BIT_RSP)
     {
         nCmd &= ~ CMD_MASK_REQ_RSP;
 
-        // Response message received
-        if ((nId == g_nCurId) && (nCmd == g_nCurCmd))
+        // Response message received, in any order
+        pSlot = REQ_SLOT(pCtx, nId);
+
+        if ((pSlot->nState == REQ_STATE_SENT) && (nId == pSlot->nId) && (nCmd == pSlot->nCmd))
         {
             // ID and CMD matched: save the message
-            g_nCurLen = nLen;
-            memcpy(g_cCurBuf, pBuf, nLen);
+            pSlot->nLen = nLen;
+            pSlot->nTimeUs = pCtx->tXcom.nRxTimeUs;
+            memcpy(pSlot->cBuf, pBuf, nLen);
 
             // Set the response message ready flag
-            g_bRspReady = TTrue;
+            pSlot->nState = REQ_STATE_DONE;
         }
 
         // Just discard the response message if ID or CMD not matched
@@ -59,123 +121,280 @@ static void clt_xcom_rcvd_cb(TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
         nCmd &= ~ CMD_MASK_REQ_RSP;
 
         // Depth received (in continuous mode)
-        if (nCmd == RADAR_CMD_REPORT_DEPTH)
+        if ((nCmd == RADAR_CMD_REPORT_DEPTH) && MSG_CHECK_LEN(ReportDepthReq, nLen))
         {
             // Update the depth buffer. Old depth data in the buffer may be discarded!
-            memcpy(g_cCurDepthBuf, pBuf, nLen);
+            memcpy(pCtx->cDepthBuf[pCtx->nCurDepth], pBuf, nLen);
+            pCtx->nCurDepthTimeUs = pCtx->tXcom.nRxTimeUs;
+            pCtx->nCurDepthDevMs  = CLKSYNC_Update(&pCtx->tClkSync, MSG_ReportDepthReq_Timestamp(pBuf),
+                                                   FrameStartTime(pCtx, pCtx->nCurDepthTimeUs, nLen));
 
             // The depth buffer becomes valid if the length is not 0
-            g_nCurDepthLen = nLen;
+            pCtx->nCurDepthLen = nLen;
         }
         else if (nCmd == RADAR_CMD_REPORT_ERROR)
         {
             // Set the device failed flag, to indicate the radar is in fault
-            g_bDevFailed = TTrue;
+            pCtx->bDevFailed = TTrue;
         }
     }
 }
 
-static int xcom_io_sync(TU32 nTimeout)
+// Send a request and wait for its response, which is left in the request slot
+static int xcom_io_sync(TRadarCtx *pCtx, TU8 nCmd, TU8 *pReq, TU16 nReqLen, TU32 nTimeout, TU8 **ppRsp, TU16 *pRspLen)
 {
-    Timer_t tmIO;
+    int nRet;
+    TU8 nId;
+
+    nRet = radar_req_submit_ex(pCtx, nCmd, pReq, nReqLen, &nId);
+
+    if (nRet == RADAR_ERROR_SUCCESS)
+    {
+        nRet = radar_req_wait_ex(pCtx, nId, nTimeout, ppRsp, pRspLen);
+    }
+
+    return nRet;
+}
+
+// Block until the port has work or the timer runs out, TFalse if the port failed.
+// Called under CtxLock. With an I/O thread, sleep on its condition until it
+// handed over frames: the lock is released meanwhile.
+static TBool WaitPort(TRadarCtx *pCtx, Timer_t *pTimer)
+{
+    TU64 nLeft = UTIL_MIN(TIMER_RemainingUs(pTimer), (TU64)MAX_WAIT_SLICE * 1000);
+
+    if (pCtx->bIoThread)
+    {
+        if (nLeft > 0 && !pCtx->bPortFailed) COND_Wait(pCtx->hIoCond, pCtx->hIoLock, (TU32)nLeft);
+        return (TBool)!pCtx->bPortFailed;
+    }
+
+    return xcom_wait(&pCtx->tXcom, (TU32)nLeft);
+}
+
+static int DecodeDevInfo(TDevInfo * pDevInfo, TU8 * p, TU16 nLen)
+{
+    if (!MSG_CHECK_LEN(GetInfoRsp, nLen)) return RADAR_ERROR_DEVICE_FAILED;
+
+    pDevInfo->nMajorVer = MSG_GetInfoRsp_MajorVer(p);
+    pDevInfo->nMinorVer = MSG_GetInfoRsp_MinorVer(p);
+    memcpy(pDevInfo->SerialNum, MSG_GetInfoRsp_SerialNum(p), sizeof(pDevInfo->SerialNum));
+    memcpy(pDevInfo->Name, MSG_GetInfoRsp_Name(p), sizeof(pDevInfo->Name));
+
+    return RADAR_ERROR_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int radar_req_submit_ex(TRadarCtx *pCtx, TU8 nCmd, TU8 * pReq, TU16 nReqLen, TU8 * pId)
+{
+    TU8 nId;
+    TRadarReq *pSlot = NULL;
+    int nRet = RADAR_ERROR_SUCCESS;
+
+    if (!pId || (nReqLen > 0 && !pReq) || nReqLen > MAX_PAYLOAD_LEN)
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    // Closed by a radar_reopen_ex that gave up: the caller tries it again
+    if (!xcom_port_is_open(&pCtx->tPort)) return RADAR_ERROR_PORT_FAILED;
+
+    // The slot must be set before the I/O thread can see the response
+    CtxLock(pCtx);
 
     // Notify the caller immediately if the radar is in fault
-    if (g_bDevFailed) return RADAR_ERROR_DEVICE_FAILED;
+    if (pCtx->bDevFailed)
+    {
+        nRet = RADAR_ERROR_DEVICE_FAILED;
+        goto exit;
+    }
 
     // Try to send the REQ message with a new ID
-    g_nCurId = GetMsgIdToSend();
+    nId = GetMsgIdToSend(pCtx);
+    pSlot = REQ_SLOT(pCtx, nId);
+
+    if (pSlot->nState != REQ_STATE_FREE)
+    {
+        LOG("radar_req_submit: too many requests in flight!\n");
+        nRet = RADAR_ERROR_IMPLEMENTATION;
+        goto exit;
+    }
 
-    if (!xcom_send(g_nCurId, (TU8)(g_nCurCmd | CMD_BIT_REQ), g_cCurBuf, g_nCurLen))
+    if (!xcom_send(&pCtx->tXcom, nId, (TU8)(nCmd | CMD_BIT_REQ), pReq, nReqLen))
     {
         LOG("xcom_send failed!\n");
-        return RADAR_ERROR_IMPLEMENTATION;
+        nRet = RADAR_ERROR_IMPLEMENTATION;
+        goto exit;
+    }
+
+    LOG("MSG SENT: Id=0x%02X, Cmd=0x%02X, Len=%d\n", nId, (TU8)(nCmd | CMD_BIT_REQ), nReqLen);
+
+    pSlot->nId    = nId;
+    pSlot->nCmd   = nCmd;
+    pSlot->nLen   = 0;
+    pSlot->nState = REQ_STATE_SENT;
+
+    // Push the message to the port right away. The I/O thread may be
+    // waiting on the RX state, so only the TX half runs here then.
+    if (pCtx->bIoThread)
+    {
+        // What the port did not take is left to the thread
+        xcom_flush(&pCtx->tXcom);
+        if (xcom_tx_pending(&pCtx->tXcom) > 0) WAKE_Set(pCtx->hIoWake);
+    }
+    else
+    {
+        xcom_fsm(&pCtx->tXcom);
     }
 
-    LOG("MSG SENT: Id=0x%02X, Cmd=0x%02X, Len=%d\n", g_nCurId, (TU8)(g_nCurCmd | CMD_BIT_REQ), g_nCurLen);
+    *pId = nId;
+
+exit:
+    CtxUnlock(pCtx);
+
+    return nRet;
+}
+
+int radar_req_wait_ex(TRadarCtx *pCtx, TU8 nId, TU32 nTimeout, TU8 ** ppRsp, TU16 * pRspLen)
+{
+    Timer_t tmIO;
+    TRadarReq *pSlot = REQ_SLOT(pCtx, nId);
+    TBool bPortOk;
+    int nRet = RADAR_ERROR_SUCCESS;
+
+    if (!xcom_port_is_open(&pCtx->tPort)) return RADAR_ERROR_PORT_FAILED;
 
-    // Waiting for the RSP message
-    g_bRspReady = TFalse;
+    if (!ppRsp || !pRspLen)
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
 
     TIMER_SetDelay_ms(&tmIO, nTimeout);
     TIMER_Start(&tmIO);
 
-    while (!TIMER_Elapsed(&tmIO))
+    // The I/O thread fills the slot: look at it under the lock only
+    CtxLock(pCtx);
+
+    if ((pSlot->nState == REQ_STATE_FREE) || (pSlot->nId != nId))
+    {
+        CtxUnlock(pCtx);
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    // Waiting for the RSP message, it may have come with an earlier one
+    while (pSlot->nState != REQ_STATE_DONE)
     {
-        xcom_fsm();
+        if (TIMER_Elapsed(&tmIO))
+        {
+            // Wait RSP message timeout! A late response is discarded
+            nRet = RADAR_ERROR_ACCESS_TIMEOUT;
+            break;
+        }
+
+        PumpPort(pCtx);
 
         // Notify the caller immediately if the radar is in fault
-        if (g_bDevFailed)
+        if (pCtx->bDevFailed)
         {
-            return RADAR_ERROR_DEVICE_FAILED;
+            nRet = RADAR_ERROR_DEVICE_FAILED;
+            break;
         }
 
-        if (g_bRspReady)
+        if (pSlot->nState != REQ_STATE_DONE)
         {
-            // RSP message received, return to parse the message
-            return RADAR_ERROR_SUCCESS;
+            bPortOk = WaitPort(pCtx, &tmIO);
+
+            if (!bPortOk)
+            {
+                nRet = RADAR_ERROR_PORT_FAILED;
+                break;
+            }
         }
+    }
 
-        UTIL_Sleep(1);
+    // RSP message received. It is copied out before the slot is freed, as
+    // a new request may take the slot and its response overwrite it.
+    if (nRet == RADAR_ERROR_SUCCESS)
+    {
+        memcpy(pCtx->cRspBuf, pSlot->cBuf, pSlot->nLen);
+        *ppRsp   = pCtx->cRspBuf;
+        *pRspLen = pSlot->nLen;
+        pCtx->nRspTimeUs = pSlot->nTimeUs;
     }
 
-    // Wait RSP message timeout!
-    return RADAR_ERROR_ACCESS_TIMEOUT;
+    pSlot->nState = REQ_STATE_FREE;
+
+    CtxUnlock(pCtx);
+
+    return nRet;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-int radar_init(void)
+int radar_req_cancel_ex(TRadarCtx *pCtx, TU8 nId)
 {
-    int nRet;
+    TRadarReq *pSlot = REQ_SLOT(pCtx, nId);
+    int nRet = RADAR_ERROR_SUCCESS;
 
-    g_nCurCmd = RADAR_CMD_INIT;
-    g_nCurLen = 0;
+    CtxLock(pCtx);
+
+    if ((pSlot->nState == REQ_STATE_FREE) || (pSlot->nId != nId))
+    {
+        nRet = RADAR_ERROR_WRONG_PARAM;
+    }
+    else
+    {
+        // A late response is discarded, the slot can be reused right away
+        pSlot->nState = REQ_STATE_FREE;
+    }
 
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    CtxUnlock(pCtx);
 
     return nRet;
 }
 
-int radar_get_info(TDevInfo * pDevInfo)
+////////////////////////////////////////////////////////////////////////////////
+int radar_init_ex(TRadarCtx *pCtx)
+{
+    TU8 *pRsp;
+    TU16 nRspLen;
+
+    return xcom_io_sync(pCtx, RADAR_CMD_INIT, NULL, MSG_LEN_InitReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
+}
+
+int radar_get_info_ex(TRadarCtx *pCtx, TDevInfo * pDevInfo)
 {
     int nRet;
-    TU8 * p = &g_cCurBuf[0];
+    TU8 *pRsp;
+    TU16 nRspLen;
 
     if (!pDevInfo)
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
-    g_nCurCmd = RADAR_CMD_GET_INFO;
-    g_nCurLen = 0;
-
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_GET_INFO, NULL, MSG_LEN_GetInfoReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        pDevInfo->nMajorVer = *p++;
-        pDevInfo->nMinorVer = *p++;
-        memcpy(pDevInfo->SerialNum, p, 32);
-        p += 32;
-        memcpy(pDevInfo->Name, p, 64);
-        p += 64;
+        nRet = DecodeDevInfo(pDevInfo, pRsp, nRspLen);
     }
 
     return nRet;
 }
 
-int radar_set_ld(TU8 nPower)
+int radar_set_ld_ex(TRadarCtx *pCtx, TU8 nPower)
 {
     int nRet;
+    TU8 cReq[MSG_LEN_SetLdReq];
+    TU8 *pRsp;
+    TU16 nRspLen;
 
-    g_nCurCmd = RADAR_CMD_SET_LD;
-    g_cCurBuf[0] = nPower;
-    g_nCurLen = 1;
+    MSG_SetLdReq_SetPower(cReq, nPower);
 
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_SET_LD, cReq, MSG_LEN_SetLdReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        if (nPower != g_cCurBuf[0])
+        if (!MSG_CHECK_LEN(SetLdRsp, nRspLen) || (nPower != MSG_SetLdRsp_Power(pRsp)))
         {
             return RADAR_ERROR_WRONG_PARAM;
         }
@@ -184,19 +403,20 @@ int radar_set_ld(TU8 nPower)
     return nRet;
 }
 
-int radar_set_mode(TU8 nMode)
+int radar_set_mode_ex(TRadarCtx *pCtx, TU8 nMode)
 {
     int nRet;
+    TU8 cReq[MSG_LEN_SetModeReq];
+    TU8 *pRsp;
+    TU16 nRspLen;
 
-    g_nCurCmd = RADAR_CMD_SET_MODE;
-    g_cCurBuf[0] = nMode;
-    g_nCurLen = 1;
+    MSG_SetModeReq_SetMode(cReq, nMode);
 
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_SET_MODE, cReq, MSG_LEN_SetModeReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        if (nMode != g_cCurBuf[0])
+        if (!MSG_CHECK_LEN(SetModeRsp, nRspLen) || (nMode != MSG_SetModeRsp_Mode(pRsp)))
         {
             return RADAR_ERROR_WRONG_PARAM;
         }
@@ -205,20 +425,20 @@ int radar_set_mode(TU8 nMode)
     return nRet;
 }
 
-int radar_set_res(TU16 nDepthSize)
+int radar_set_res_ex(TRadarCtx *pCtx, TU16 nDepthSize)
 {
     int nRet;
+    TU8 cReq[MSG_LEN_SetResReq];
+    TU8 *pRsp;
+    TU16 nRspLen;
 
-    g_nCurCmd = RADAR_CMD_SET_RES;
-    g_cCurBuf[0] = (TU8)((nDepthSize     ) & 0xFF);
-    g_cCurBuf[1] = (TU8)((nDepthSize >> 8) & 0xFF);
-    g_nCurLen = 2;
+    MSG_SetResReq_SetDepthSize(cReq, nDepthSize);
 
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_SET_RES, cReq, MSG_LEN_SetResReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        if (nDepthSize != UTIL_DEC_TU16_LSBF(&g_cCurBuf[0]))
+        if (!MSG_CHECK_LEN(SetResRsp, nRspLen) || (nDepthSize != MSG_SetResRsp_DepthSize(pRsp)))
         {
             return RADAR_ERROR_WRONG_PARAM;
         }
@@ -227,235 +447,1162 @@ int radar_set_res(TU16 nDepthSize)
     return nRet;
 }
 
-int radar_get_fov(TU16 * pFov)
+int radar_get_fov_ex(TRadarCtx *pCtx, TU16 * pFov)
 {
     int nRet;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
     if (!pFov)
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
-    g_nCurCmd = RADAR_CMD_GET_FOV;
-    g_nCurLen = 0;
-
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_GET_FOV, NULL, MSG_LEN_GetFovReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        *pFov = UTIL_DEC_TU16_LSBF(&g_cCurBuf[0]);
+        if (!MSG_CHECK_LEN(GetFovRsp, nRspLen)) return RADAR_ERROR_DEVICE_FAILED;
+
+        *pFov = MSG_GetFovRsp_Fov(pRsp);
     }
 
     return nRet;
 }
 
-int radar_get_max_res(TU16 * pMaxRes)
+int radar_get_max_res_ex(TRadarCtx *pCtx, TU16 * pMaxRes)
 {
     int nRet;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
     if (!pMaxRes)
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
-    g_nCurCmd = RADAR_CMD_GET_MAX_RES;
-    g_nCurLen = 0;
-
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_GET_MAX_RES, NULL, MSG_LEN_GetMaxResReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        *pMaxRes = UTIL_DEC_TU16_LSBF(&g_cCurBuf[0]);
+        if (!MSG_CHECK_LEN(GetMaxResRsp, nRspLen)) return RADAR_ERROR_DEVICE_FAILED;
+
+        *pMaxRes = MSG_GetMaxResRsp_MaxRes(pRsp);
     }
 
     return nRet;
 }
 
-int radar_trig_get_depth(TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize)
+int radar_trig_get_depth_ex(TRadarCtx *pCtx, TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize)
 {
     int nRet;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
     if (!pTimestamp || !ppDepth || !pDepthSize)
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
-    g_nCurCmd = RADAR_CMD_TRIG_DEPTH;
-    g_nCurLen = 0;
-
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_TRIG_DEPTH, NULL, MSG_LEN_TrigDepthReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        if (g_nCurLen == 0)
+        // An empty response means no depth ready
+        if (!MSG_CHECK_LEN(TrigDepthRsp, nRspLen))
         {
             return RADAR_ERROR_DEPTH_UNAVAILABLE;
         }
 
-        *pTimestamp = UTIL_DEC_TU32_LSBF(&g_cCurBuf[0]);
-        *ppDepth = (TU16 *)&g_cCurBuf[4];
-        *pDepthSize = (g_nCurLen-4)/2;
+        *pTimestamp = MSG_TrigDepthRsp_Timestamp(pRsp);
+        CtxLock(pCtx);
+        pCtx->nDepthTimeUs = pCtx->nRspTimeUs;
+        pCtx->nDepthDevMs  = CLKSYNC_Update(&pCtx->tClkSync, *pTimestamp,
+                                            FrameStartTime(pCtx, pCtx->nRspTimeUs, nRspLen));
+        CtxUnlock(pCtx);
+        *ppDepth = (TU16 *)MSG_TAIL(TrigDepthRsp, pRsp);
+        *pDepthSize = MSG_TAIL_LEN(TrigDepthRsp, nRspLen)/2;
     }
 
     return nRet;
 }
 
-int radar_cont_start(void)
+int radar_cont_start_ex(TRadarCtx *pCtx)
 {
-    int nRet;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
-    g_nCurCmd = RADAR_CMD_START_DEPTH;
-    g_nCurLen = 0;
-
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
-
-    return nRet;
+    return xcom_io_sync(pCtx, RADAR_CMD_START_DEPTH, NULL, MSG_LEN_StartDepthReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 }
 
-int radar_cont_stop(void)
+int radar_cont_stop_ex(TRadarCtx *pCtx)
 {
-    int nRet;
-
-    g_nCurCmd = RADAR_CMD_STOP_DEPTH;
-    g_nCurLen = 0;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
-
-    return nRet;
+    return xcom_io_sync(pCtx, RADAR_CMD_STOP_DEPTH, NULL, MSG_LEN_StopDepthReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 }
 
-int radar_cont_get_depth(TU32 nTimeout, TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize)
+int radar_cont_get_depth_ex(TRadarCtx *pCtx, TU32 nTimeout, TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize)
 {
     Timer_t tmIO;
+    TU8  *pDepth;
+    TBool bPortOk = TTrue;
+    int   nRet = RADAR_ERROR_DEPTH_UNAVAILABLE;
 
     if (!pTimestamp || !ppDepth || !pDepthSize)
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
+    if (!xcom_port_is_open(&pCtx->tPort)) return RADAR_ERROR_PORT_FAILED;
+
     TIMER_SetDelay_ms(&tmIO, nTimeout);
     TIMER_Start(&tmIO);
 
+    CtxLock(pCtx);
+
     do
     {
-        xcom_fsm();
+        PumpPort(pCtx);
 
-        if (g_nCurDepthLen > 0)
+        if (pCtx->nCurDepthLen > 0)
         {
-            *pTimestamp = UTIL_DEC_TU32_LSBF(&g_cCurDepthBuf[0]);
-            *ppDepth = (TU16 *)&g_cCurDepthBuf[4];
-            *pDepthSize = (g_nCurDepthLen-4)/2;
+            pDepth = pCtx->cDepthBuf[pCtx->nCurDepth];
+
+            *pTimestamp = MSG_ReportDepthReq_Timestamp(pDepth);
+            *ppDepth = (TU16 *)MSG_TAIL(ReportDepthReq, pDepth);
+            *pDepthSize = MSG_TAIL_LEN(ReportDepthReq, pCtx->nCurDepthLen)/2;
+            pCtx->nDepthTimeUs = pCtx->nCurDepthTimeUs;
+            pCtx->nDepthDevMs  = pCtx->nCurDepthDevMs;
 
-            g_nCurDepthLen = 0;
+            // The next depth goes to the other buffer
+            pCtx->nCurDepth ^= 1;
+            pCtx->nCurDepthLen = 0;
+
+            CtxUnlock(pCtx);
 
             return RADAR_ERROR_SUCCESS;
         }
-    } while (!TIMER_Elapsed(&tmIO));
 
-    return RADAR_ERROR_DEPTH_UNAVAILABLE;
+        bPortOk = WaitPort(pCtx, &tmIO);
+
+        if (!bPortOk) nRet = RADAR_ERROR_PORT_FAILED;
+    } while (bPortOk && !TIMER_Elapsed(&tmIO));
+
+    CtxUnlock(pCtx);
+
+    return nRet;
 }
 
-int radar_take_dbg_img(TU16 *pWidth, TU16 *pHeight)
+int radar_take_dbg_img_ex(TRadarCtx *pCtx, TU16 *pWidth, TU16 *pHeight)
 {
     int nRet;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
     if (!pWidth || !pHeight)
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
-    g_nCurCmd = RADAR_CMD_TAKE_DBG_IMG;
-    g_nCurLen = 0;
-
-    nRet = xcom_io_sync(TAKE_DBG_IMG_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_TAKE_DBG_IMG, NULL, MSG_LEN_TakeDbgImgReq, TAKE_DBG_IMG_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        *pWidth  = UTIL_DEC_TU16_LSBF(&g_cCurBuf[0]);
-        *pHeight = UTIL_DEC_TU16_LSBF(&g_cCurBuf[2]);
+        if (!MSG_CHECK_LEN(TakeDbgImgRsp, nRspLen)) return RADAR_ERROR_DEVICE_FAILED;
+
+        *pWidth  = MSG_TakeDbgImgRsp_Width(pRsp);
+        *pHeight = MSG_TakeDbgImgRsp_Height(pRsp);
     }
 
     return nRet;
 }
 
-int radar_read_dbg_img(TU32 nOffset, TU8 * pDat, TU16 * pDatLen)
+int radar_read_dbg_img_ex(TRadarCtx *pCtx, TU32 nOffset, TU8 * pDat, TU16 * pDatLen)
 {
     int nRet;
-    TU8 *p = &g_cCurBuf[0];
+    TU8 cReq[MSG_LEN_ReadDbgImgReq];
+    TU8 *pRsp;
+    TU16 nRspLen;
 
     if (!pDat || !pDatLen || (*pDatLen == 0))
     {
         return RADAR_ERROR_WRONG_PARAM;
     }
 
-    *p++ = (TU8)((nOffset      ) & 0xFF);
-    *p++ = (TU8)((nOffset >>  8) & 0xFF);
-    *p++ = (TU8)((nOffset >> 16) & 0xFF);
-    *p++ = (TU8)((nOffset >> 24) & 0xFF);
-    *p++ = (TU8)(((*pDatLen)   ) & 0xFF);
-    *p++ = (TU8)(((*pDatLen)>>8) & 0xFF);
-
-    g_nCurCmd = RADAR_CMD_READ_DBG_IMG;
-    g_nCurLen = (TU16)(p - &g_cCurBuf[0]);
+    MSG_ReadDbgImgReq_SetOffset(cReq, nOffset);
+    MSG_ReadDbgImgReq_SetLen(cReq, *pDatLen);
 
-    nRet = xcom_io_sync(IO_DEF_TIMEOUT);
+    nRet = xcom_io_sync(pCtx, RADAR_CMD_READ_DBG_IMG, cReq, MSG_LEN_ReadDbgImgReq, IO_DEF_TIMEOUT, &pRsp, &nRspLen);
 
     if (nRet == RADAR_ERROR_SUCCESS)
     {
-        if (g_nCurLen > (*pDatLen)) g_nCurLen = *pDatLen;
+        if (nRspLen > (*pDatLen)) nRspLen = *pDatLen;
 
-        memcpy(pDat, g_cCurBuf, g_nCurLen);
-        *pDatLen = g_nCurLen;
+        memcpy(pDat, MSG_TAIL(ReadDbgImgRsp, pRsp), nRspLen);
+        *pDatLen = nRspLen;
     }
 
     return nRet;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-int radar_open(char * szPort)
+int radar_query_ex(TRadarCtx *pCtx, TDevInfo * pDevInfo, TU16 * pFov, TU16 * pMaxRes)
 {
-    TU8 i = 0;
+    int  nRet;
+    TU8  nIdInfo, nIdFov, nIdMaxRes;
+    TU8  nSent = 0, nTaken = 0;
+    TU8 *pRsp;
+    TU16 nRspLen;
 
-    // Try to connect the device
-    for (i=0; i<MAX_IO_TRY_NUM; i++)
+    if (!pDevInfo || !pFov)
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    // Independent requests: send them all, then collect the responses.
+    // GET_MAX_RES is only asked for when the caller wants it.
+    if ((nRet = radar_req_submit_ex(pCtx, RADAR_CMD_GET_INFO, NULL, 0, &nIdInfo)) < 0) goto error;
+    nSent++;
+    if ((nRet = radar_req_submit_ex(pCtx, RADAR_CMD_GET_FOV, NULL, 0, &nIdFov)) < 0) goto error;
+    nSent++;
+    if (pMaxRes)
+    {
+        if ((nRet = radar_req_submit_ex(pCtx, RADAR_CMD_GET_MAX_RES, NULL, 0, &nIdMaxRes)) < 0) goto error;
+        nSent++;
+    }
+
+    // A waited slot is freed by radar_req_wait_ex() whatever the result
+    nTaken++;
+    if ((nRet = radar_req_wait_ex(pCtx, nIdInfo, IO_DEF_TIMEOUT, &pRsp, &nRspLen)) < 0) goto error;
+    if ((nRet = DecodeDevInfo(pDevInfo, pRsp, nRspLen)) < 0) goto error;
+
+    nTaken++;
+    if ((nRet = radar_req_wait_ex(pCtx, nIdFov, IO_DEF_TIMEOUT, &pRsp, &nRspLen)) < 0) goto error;
+    if (!MSG_CHECK_LEN(GetFovRsp, nRspLen)) { nRet = RADAR_ERROR_DEVICE_FAILED; goto error; }
+    *pFov = MSG_GetFovRsp_Fov(pRsp);
+
+    if (pMaxRes)
+    {
+        nTaken++;
+        if ((nRet = radar_req_wait_ex(pCtx, nIdMaxRes, IO_DEF_TIMEOUT, &pRsp, &nRspLen)) < 0) goto error;
+        if (!MSG_CHECK_LEN(GetMaxResRsp, nRspLen)) { nRet = RADAR_ERROR_DEVICE_FAILED; goto error; }
+        *pMaxRes = MSG_GetMaxResRsp_MaxRes(pRsp);
+    }
+
+    return RADAR_ERROR_SUCCESS;
+
+error:
+    // Release the slots of the requests that were sent but not waited on
+    if ((nSent > 0) && (nTaken < 1)) radar_req_cancel_ex(pCtx, nIdInfo);
+    if ((nSent > 1) && (nTaken < 2)) radar_req_cancel_ex(pCtx, nIdFov);
+    if ((nSent > 2) && (nTaken < 3)) radar_req_cancel_ex(pCtx, nIdMaxRes);
+
+    return nRet;
+}
+
+int radar_read_dbg_img_bulk_ex(TRadarCtx *pCtx, TU32 nOffset, TU8 * pDat, TU32 * pDatLen, TU16 nSegLen)
+{
+    int  nRet = RADAR_ERROR_SUCCESS;
+    int  nWait;
+    TU8  cReq[MSG_LEN_ReadDbgImgReq];
+    TU8  nIdTab[MAX_REQ_IN_FLIGHT];
+    TU8  nHead = 0;
+    TU8  nCount = 0;
+    TU32 nReqOffset = 0;
+    TU32 nDone = 0;
+    TU32 nSegOffset;
+    TU16 nLen;
+    TBool bEnd = TFalse;
+    TU8 *pRsp;
+    TU16 nRspLen;
+
+    if (!pDat || !pDatLen || (*pDatLen == 0) || (nSegLen == 0))
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    while (TTrue)
     {
-        if ((xcom_port_open((TU8 *)szPort) == TTrue)
-         && (xcom_init(clt_xcom_rcvd_cb) == TTrue)
-         && (radar_init() == RADAR_ERROR_SUCCESS))
+        // Keep the pipeline full with segment requests
+        while (!bEnd && nCount < MAX_REQ_IN_FLIGHT && nReqOffset < *pDatLen)
+        {
+            nLen = (TU16)UTIL_MIN((TU32)nSegLen, *pDatLen - nReqOffset);
+            nSegOffset = nOffset + nReqOffset;
+
+            MSG_ReadDbgImgReq_SetOffset(cReq, nSegOffset);
+            MSG_ReadDbgImgReq_SetLen(cReq, nLen);
+
+            nRet = radar_req_submit_ex(pCtx, RADAR_CMD_READ_DBG_IMG, cReq, MSG_LEN_ReadDbgImgReq,
+                                    &nIdTab[(nHead + nCount) % MAX_REQ_IN_FLIGHT]);
+            if (nRet != RADAR_ERROR_SUCCESS)
+            {
+                bEnd = TTrue;
+                break;
+            }
+
+            nCount++;
+            nReqOffset += nLen;
+        }
+
+        if (nCount == 0) break;
+
+        // After the end or a failure, give up the requests in flight rather
+        // than wait out each one on a link that may be dead
+        if (bEnd)
         {
+            while (nCount > 0)
+            {
+                radar_req_cancel_ex(pCtx, nIdTab[nHead]);
+                nHead = (TU8)((nHead + 1) % MAX_REQ_IN_FLIGHT);
+                nCount--;
+            }
             break;
         }
+
+        // Responses are collected in request order, so the data stays contiguous
+        nWait = radar_req_wait_ex(pCtx, nIdTab[nHead], IO_DEF_TIMEOUT, &pRsp, &nRspLen);
+
+        nHead = (TU8)((nHead + 1) % MAX_REQ_IN_FLIGHT);
+        nCount--;
+
+        if (nWait != RADAR_ERROR_SUCCESS)
+        {
+            nRet = nWait;
+            bEnd = TTrue;
+            continue;
+        }
+
+        nLen = (TU16)UTIL_MIN((TU32)nSegLen, *pDatLen - nDone);
+        if (nRspLen > nLen) nRspLen = nLen;
+
+        memcpy(pDat + nDone, MSG_TAIL(ReadDbgImgRsp, pRsp), nRspLen);
+        nDone += nRspLen;
+
+        // A short segment is the end of the image
+        if (nRspLen < nLen) bEnd = TTrue;
     }
 
-    if (i == MAX_IO_TRY_NUM)
+    *pDatLen = nDone;
+
+    return nRet;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Switch the port to a rate and check that the device answers at it
+static int TryBaud(TRadarCtx *pCtx, TU32 nBaud, TU32 nTimeout)
+{
+    TU8 *pRsp;
+    TU16 nRspLen;
+
+    if (!xcom_port_set_baud(&pCtx->tPort, nBaud)) return RADAR_ERROR_PORT_FAILED;
+
+    // Drop whatever was received at the previous rate
+    xcom_init(&pCtx->tXcom, &pCtx->tPort, clt_xcom_rcvd_cb, pCtx);
+    xcom_set_baud(&pCtx->tXcom, nBaud);
+
+    return xcom_io_sync(pCtx, RADAR_CMD_INIT, NULL, MSG_LEN_InitReq, nTimeout, &pRsp, &nRspLen);
+}
+
+static int ProbeBaud(TRadarCtx *pCtx)
+{
+    TU8 i;
+
+    for (i=0; i<UTIL_TAB_SIZE(g_nProbeBaudTab); i++)
     {
-        return RADAR_ERROR_PORT_FAILED;
+        if (TryBaud(pCtx, g_nProbeBaudTab[i], PROBE_TIMEOUT) == RADAR_ERROR_SUCCESS)
+        {
+            LOG("radar_open: device found at %lu baud\n", g_nProbeBaudTab[i]);
+            pCtx->nBaud = g_nProbeBaudTab[i];
+            return RADAR_ERROR_SUCCESS;
+        }
     }
 
-    return RADAR_ERROR_SUCCESS;
+    return RADAR_ERROR_ACCESS_TIMEOUT;
 }
 
-int radar_close(void)
+int radar_open_ex(TRadarCtx *pCtx, char * szPort)
+{
+    return radar_open_baud_ex(pCtx, szPort, RADAR_DEF_BAUD);
+}
+
+int radar_open_baud_ex(TRadarCtx *pCtx, char * szPort, TU32 nBaud)
+{
+    return radar_open_tuned_ex(pCtx, szPort, nBaud, 0);
+}
+
+int radar_open_tuned_ex(TRadarCtx *pCtx, char * szPort, TU32 nBaud, TU32 nTunings)
 {
     TU8 i = 0;
+    int nRet;
+    UART_CONFIG tCfg;
+    char cPort[RADAR_MAX_PORT_NAME];
 
-    // Try to stop the continous depth and turn off the laser
+    if (!pCtx || !szPort || strlen(szPort) >= RADAR_MAX_PORT_NAME)
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    // Start from a clean context, closing the port if it is reopened
+    if (pCtx->bOpened)
+    {
+        radar_stop_cts_events_ex(pCtx);
+        radar_stop_io_thread_ex(pCtx);
+        xcom_port_close(&pCtx->tPort);
+    }
+
+    // The name may be the one kept in the context, see radar_reopen_ex
+    memmove(cPort, szPort, strlen(szPort) + 1);
+    memset(pCtx, 0, sizeof(TRadarCtx));
+    strcpy(pCtx->szPort, cPort);
+    pCtx->nWantBaud    = nBaud;
+    pCtx->nWantTunings = nTunings;
+    xcom_port_init(&pCtx->tPort);
+    CLKSYNC_Init(&pCtx->tClkSync);
+
+    // The rate is set below, once the port is open
+    memset(&tCfg, 0, sizeof(tCfg));
+    tCfg.nTunings = nTunings;
+    tCfg.nLatencyTimer = RADAR_LATENCY_TIMER;
+
+    // Try to connect the device
     for (i=0; i<MAX_IO_TRY_NUM; i++)
     {
-        if ((radar_cont_stop() == RADAR_ERROR_SUCCESS)
-         && (radar_set_ld(0) == RADAR_ERROR_SUCCESS))
+        if (xcom_port_open_ex(&pCtx->tPort, (TU8 *)szPort, &tCfg) == TTrue)
         {
-            break;
+            if (nBaud == RADAR_BAUD_AUTO)
+            {
+                nRet = ProbeBaud(pCtx);
+            }
+            else
+            {
+                nRet = TryBaud(pCtx, nBaud, IO_DEF_TIMEOUT);
+                pCtx->nBaud = nBaud;
+            }
+
+            if (nRet == RADAR_ERROR_SUCCESS) break;
         }
     }
 
     if (i == MAX_IO_TRY_NUM)
     {
+        xcom_port_close(&pCtx->tPort);
+        pCtx->nBaud = 0;
         return RADAR_ERROR_PORT_FAILED;
     }
 
-    // close the port
-    xcom_port_close();
+    pCtx->bOpened = TTrue;
 
     return RADAR_ERROR_SUCCESS;
+}
+
+int radar_reopen_ex(TRadarCtx *pCtx, TU32 nTimeout)
+{
+    Timer_t tmIO;
+    UTIL_HANDLE hWatch;
+    char cPort[RADAR_MAX_PORT_NAME];
+    TU32 nEvents;
+    int  nRet = RADAR_ERROR_ACCESS_TIMEOUT;
+
+    if (pCtx->szPort[0] == '\0') return RADAR_ERROR_WRONG_PARAM;
+
+    strcpy(cPort, pCtx->szPort);
+
+    // The old handle is dead, the threads on it go with it
+    if (pCtx->bOpened)
+    {
+        radar_stop_cts_events_ex(pCtx);
+        radar_stop_io_thread_ex(pCtx);
+        xcom_port_close(&pCtx->tPort);
+        pCtx->bOpened = TFalse;
+    }
+
+    hWatch = DEV_Watch(cPort);
+    if (hWatch == INVALID_UTIL_HANDLE) return RADAR_ERROR_IMPLEMENTATION;
+
+    TIMER_SetDelay_ms(&tmIO, nTimeout);
+    TIMER_Start(&tmIO);
+
+    // The node may show up before udev let it be opened: try again on each
+    // change, and every slice in case the device was slow to answer
+    while (TTrue)
+    {
+        if (DEV_IsPresent(hWatch))
+        {
+            nRet = radar_open_tuned_ex(pCtx, cPort, pCtx->nWantBaud, pCtx->nWantTunings);
+            if (nRet == RADAR_ERROR_SUCCESS) break;
+        }
+
+        if (TIMER_Elapsed(&tmIO))
+        {
+            nRet = RADAR_ERROR_ACCESS_TIMEOUT;
+            break;
+        }
+
+        nEvents = DEV_Wait(hWatch, (TU32)UTIL_MIN(TIMER_RemainingUs(&tmIO), (TU64)REOPEN_SLICE * 1000));
+        if (nEvents & DEV_EV_REMOVED) LOG("radar_reopen: %s removed\n", cPort);
+        if (nEvents & DEV_EV_ADDED)   LOG("radar_reopen: %s added\n", cPort);
+    }
+
+    DEV_Unwatch(hWatch);
+
+    return nRet;
+}
+
+int radar_close_ex(TRadarCtx *pCtx)
+{
+    TU8 i = 0;
+
+    // Try to stop the continous depth and turn off the laser
+    for (i=0; i<MAX_IO_TRY_NUM; i++)
+    {
+        if ((radar_cont_stop_ex(pCtx) == RADAR_ERROR_SUCCESS)
+         && (radar_set_ld_ex(pCtx, 0) == RADAR_ERROR_SUCCESS))
+        {
+            break;
+        }
+    }
+
+    if (i == MAX_IO_TRY_NUM)
+    {
+        return RADAR_ERROR_PORT_FAILED;
+    }
+
+    // close the port
+    radar_stop_cts_events_ex(pCtx);
+    radar_stop_io_thread_ex(pCtx);
+    xcom_port_close(&pCtx->tPort);
+    pCtx->bOpened = TFalse;
+
+    return RADAR_ERROR_SUCCESS;
+}
+
+TU32 radar_get_baud_ex(TRadarCtx *pCtx)
+{
+    return pCtx->bOpened ? pCtx->nBaud : 0;
+}
+
+TU32 radar_get_tunings_ex(TRadarCtx *pCtx)
+{
+    return pCtx->bOpened ? pCtx->tPort.nTunings : 0;
+}
+
+void radar_get_link_stats_ex(TRadarCtx *pCtx, TXcomStats *pStats)
+{
+    xcom_get_stats(&pCtx->tXcom, pStats);
+}
+
+TU64 radar_get_depth_arrival_ex(TRadarCtx *pCtx)
+{
+    return pCtx->nDepthTimeUs;
+}
+
+int radar_get_depth_time_ex(TRadarCtx *pCtx, TU64 *pDevTime, TU64 *pHostTime, TU32 *pErrBound)
+{
+    TBool bOk;
+
+    if (!pDevTime || !pHostTime || !pErrBound)
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    CtxLock(pCtx);
+    bOk = (pCtx->nDepthTimeUs != 0) && CLKSYNC_ToHost(&pCtx->tClkSync, pCtx->nDepthDevMs, pHostTime, pErrBound);
+    CtxUnlock(pCtx);
+
+    if (!bOk) return RADAR_ERROR_DEPTH_UNAVAILABLE;
+
+    *pDevTime = pCtx->nDepthDevMs;
+
+    return RADAR_ERROR_SUCCESS;
+}
+
+static void DeleteIoSync(TRadarCtx *pCtx)
+{
+    xcom_set_wake(&pCtx->tXcom, INVALID_UTIL_HANDLE);
+
+    MUTEX_Delete(pCtx->hIoLock);
+    COND_Delete(pCtx->hIoCond);
+    WAKE_Delete(pCtx->hIoWake);
+
+    pCtx->hIoLock = INVALID_UTIL_HANDLE;
+    pCtx->hIoCond = INVALID_UTIL_HANDLE;
+    pCtx->hIoWake = INVALID_UTIL_HANDLE;
+}
+
+static void * IoThread(void *pParam)
+{
+    TRadarCtx *pCtx = (TRadarCtx *)pParam;
+    TU32 nFrames;
+
+    while (pCtx->bIoRun)
+    {
+        // Ends on port events, or on hIoWake when a frame was queued
+        if (!xcom_wait(&pCtx->tXcom, IO_THREAD_SLICE * 1000))
+        {
+            // The callers see it in WaitPort
+            MUTEX_Lock(pCtx->hIoLock);
+            pCtx->bPortFailed = TTrue;
+            COND_Broadcast(pCtx->hIoCond);
+            MUTEX_Unlock(pCtx->hIoLock);
+            break;
+        }
+
+        WAKE_Clear(pCtx->hIoWake);
+
+        MUTEX_Lock(pCtx->hIoLock);
+        nFrames = pCtx->tXcom.tStats.nRxFrames;
+        xcom_fsm(&pCtx->tXcom);
+        if (pCtx->tXcom.tStats.nRxFrames != nFrames) COND_Broadcast(pCtx->hIoCond);
+        MUTEX_Unlock(pCtx->hIoLock);
+    }
+
+    // radar_stop_io_thread_ex waits on it
+    MUTEX_Lock(pCtx->hIoLock);
+    pCtx->bIoDone = TTrue;
+    COND_Broadcast(pCtx->hIoCond);
+    MUTEX_Unlock(pCtx->hIoLock);
+
+    return NULL;
+}
+
+int radar_start_io_thread_ex(TRadarCtx *pCtx, const THREAD_CONFIG *pCfg, TU32 *pApplied)
+{
+    if (pApplied) *pApplied = 0;
+
+    if (!pCtx->bOpened) return RADAR_ERROR_PORT_FAILED;
+    if (pCtx->bIoThread) return RADAR_ERROR_WRONG_PARAM;
+
+    pCtx->hIoLock = MUTEX_Create();
+    pCtx->hIoCond = COND_Create();
+    pCtx->hIoWake = WAKE_Create();
+
+    if (pCtx->hIoLock == INVALID_UTIL_HANDLE || pCtx->hIoCond == INVALID_UTIL_HANDLE
+     || pCtx->hIoWake == INVALID_UTIL_HANDLE)
+    {
+        DeleteIoSync(pCtx);
+        return RADAR_ERROR_IMPLEMENTATION;
+    }
+
+    xcom_set_wake(&pCtx->tXcom, pCtx->hIoWake);
+
+    pCtx->bIoRun  = TTrue;
+    pCtx->bIoDone = TFalse;
+    pCtx->bPortFailed = TFalse;
+    pCtx->bIoThread = TTrue;
+
+    if (THREAD_CreateEx(IoThread, pCtx, pCfg, pApplied) == INVALID_UTIL_HANDLE)
+    {
+        pCtx->bIoThread = TFalse;
+        DeleteIoSync(pCtx);
+        return RADAR_ERROR_IMPLEMENTATION;
+    }
+
+    return RADAR_ERROR_SUCCESS;
+}
+
+void radar_stop_io_thread_ex(TRadarCtx *pCtx)
+{
+    Timer_t tmStop;
+    TBool   bDone;
+
+    if (!pCtx->bIoThread) return;
+
+    TIMER_SetDelay_ms(&tmStop, IO_THREAD_STOP_TIMEOUT);
+    TIMER_Start(&tmStop);
+
+    MUTEX_Lock(pCtx->hIoLock);
+
+    pCtx->bIoRun = TFalse;
+    WAKE_Set(pCtx->hIoWake);
+
+    while (!pCtx->bIoDone && !TIMER_Elapsed(&tmStop))
+    {
+        COND_Wait(pCtx->hIoCond, pCtx->hIoLock, (TU32)TIMER_RemainingUs(&tmStop));
+    }
+    bDone = pCtx->bIoDone;
+
+    MUTEX_Unlock(pCtx->hIoLock);
+
+    pCtx->bIoThread = TFalse;
+
+    // A thread still running may yet use them: better leak them
+    if (!bDone)
+    {
+        LOG("radar_stop_io_thread: the I/O thread did not end!\n");
+        return;
+    }
+
+    DeleteIoSync(pCtx);
+}
+
+// Runs on the watch thread of the HAL
+static void OnCtsEdge(void *pParam, const UART_IO_EVENT *pEvent)
+{
+    TRadarCtx *pCtx = (TRadarCtx *)pParam;
+    TRadarCtsEvent *pSlot;
+
+    MUTEX_Lock(pCtx->hCtsLock);
+
+    // Drop the oldest when full: the newest edges are the ones to match to depth
+    if (pCtx->nCtsCount == RADAR_MAX_CTS_EVENTS)
+    {
+        pCtx->nCtsHead = (TU8)((pCtx->nCtsHead + 1) % RADAR_MAX_CTS_EVENTS);
+        pCtx->nCtsCount--;
+        pCtx->nCtsLost++;
+    }
+
+    pSlot = &pCtx->tCtsEvent[(pCtx->nCtsHead + pCtx->nCtsCount) % RADAR_MAX_CTS_EVENTS];
+    pSlot->bHigh   = pEvent->bHigh;
+    pSlot->nTimeUs = pEvent->nTimeUs;
+    pSlot->nEdges  = pEvent->nEdges;
+    pSlot->nLost   = pCtx->nCtsLost;
+    pCtx->nCtsLost = 0;
+    pCtx->nCtsCount++;
+
+    MUTEX_Unlock(pCtx->hCtsLock);
+}
+
+int radar_start_cts_events_ex(TRadarCtx *pCtx, const THREAD_CONFIG *pCfg)
+{
+    if (!pCtx->bOpened) return RADAR_ERROR_PORT_FAILED;
+    if (pCtx->bCtsEvents) return RADAR_ERROR_WRONG_PARAM;
+
+    pCtx->hCtsLock = MUTEX_Create();
+    if (pCtx->hCtsLock == INVALID_UTIL_HANDLE) return RADAR_ERROR_IMPLEMENTATION;
+
+    pCtx->nCtsHead  = 0;
+    pCtx->nCtsCount = 0;
+    pCtx->nCtsLost  = 0;
+
+    pCtx->hCtsWatch = UART_WatchIO(pCtx->tPort.hPort, UART_IO_CTS, OnCtsEdge, pCtx, pCfg);
+
+    if (pCtx->hCtsWatch == INVALID_UTIL_HANDLE)
+    {
+        MUTEX_Delete(pCtx->hCtsLock);
+        pCtx->hCtsLock = INVALID_UTIL_HANDLE;
+        return RADAR_ERROR_IMPLEMENTATION;
+    }
+
+    pCtx->bCtsEvents = TTrue;
+
+    return RADAR_ERROR_SUCCESS;
+}
+
+void radar_stop_cts_events_ex(TRadarCtx *pCtx)
+{
+    if (!pCtx->bCtsEvents) return;
+
+    pCtx->bCtsEvents = TFalse;
+    UART_UnwatchIO(pCtx->hCtsWatch);
+    MUTEX_Delete(pCtx->hCtsLock);
+
+    pCtx->hCtsWatch = INVALID_UTIL_HANDLE;
+    pCtx->hCtsLock  = INVALID_UTIL_HANDLE;
+    pCtx->nCtsCount = 0;
+}
+
+int radar_get_cts_event_ex(TRadarCtx *pCtx, TRadarCtsEvent *pEvent)
+{
+    int nRet = RADAR_ERROR_EVENT_UNAVAILABLE;
+
+    if (!pEvent) return RADAR_ERROR_WRONG_PARAM;
+    if (!pCtx->bCtsEvents) return RADAR_ERROR_EVENT_UNAVAILABLE;
+
+    MUTEX_Lock(pCtx->hCtsLock);
+
+    if (pCtx->nCtsCount > 0)
+    {
+        *pEvent = pCtx->tCtsEvent[pCtx->nCtsHead];
+        pCtx->nCtsHead = (TU8)((pCtx->nCtsHead + 1) % RADAR_MAX_CTS_EVENTS);
+        pCtx->nCtsCount--;
+        nRet = RADAR_ERROR_SUCCESS;
+    }
+
+    MUTEX_Unlock(pCtx->hCtsLock);
+
+    return nRet;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Discovery: one probe per port, all at once. The jobs are shared by the
+// caller and the probes, the last one to let go frees them: a probe that
+// outlives the wait of the caller still has them.
+typedef struct TDiscoverRun TDiscoverRun;
+
+typedef struct {
+    TDiscoverRun * pRun;
+    TRadarCtx      tCtx;
+    char           szPort[UART_MAX_NAME_LEN];
+    TU32           nBaud;       // rate to probe at, then the one that answered
+    TU32           nTimeout;
+    TDevInfo       tInfo;
+    int            nRet;
+    TBool          bDone;       // under hLock
+} TDiscoverJob;
+
+struct TDiscoverRun {
+    UTIL_HANDLE    hLock;
+    UTIL_HANDLE    hCond;       // broadcast when a probe is done
+    TU32           nRefs;       // the caller and each probe, under hLock
+    TDiscoverJob * pJobs;
+};
+
+static void DiscoverRelease(TDiscoverRun *pRun)
+{
+    TBool bLast;
+
+    MUTEX_Lock(pRun->hLock);
+    bLast = (TBool)(--pRun->nRefs == 0);
+    MUTEX_Unlock(pRun->hLock);
+
+    if (!bLast) return;
+
+    MUTEX_Delete(pRun->hLock);
+    COND_Delete(pRun->hCond);
+    free(pRun->pJobs);
+    free(pRun);
+}
+
+// INIT and GET_INFO go out together: one round trip per rate
+static int ProbeRate(TRadarCtx *pCtx, TU32 nBaud, TU32 nTimeout, TDevInfo *pInfo)
+{
+    Timer_t tmIO;
+    TU8  nIdInit, nIdInfo;
+    TU8 *pRsp;
+    TU16 nRspLen;
+    int  nRet, nRetInfo;
+
+    if (!xcom_port_set_baud(&pCtx->tPort, nBaud)) return RADAR_ERROR_PORT_FAILED;
+
+    xcom_init(&pCtx->tXcom, &pCtx->tPort, clt_xcom_rcvd_cb, pCtx);
+    xcom_set_baud(&pCtx->tXcom, nBaud);
+
+    if ((nRet = radar_req_submit_ex(pCtx, RADAR_CMD_INIT, NULL, MSG_LEN_InitReq, &nIdInit)) < 0) return nRet;
+    if ((nRet = radar_req_submit_ex(pCtx, RADAR_CMD_GET_INFO, NULL, 0, &nIdInfo)) < 0)
+    {
+        radar_req_cancel_ex(pCtx, nIdInit);
+        return nRet;
+    }
+
+    TIMER_SetDelay_ms(&tmIO, nTimeout);
+    TIMER_Start(&tmIO);
+
+    // Both are waited on, so that both slots are free for the next rate
+    nRet     = radar_req_wait_ex(pCtx, nIdInit, nTimeout, &pRsp, &nRspLen);
+    nRetInfo = radar_req_wait_ex(pCtx, nIdInfo, TIMER_Remaining(&tmIO), &pRsp, &nRspLen);
+
+    if (nRet < 0) return nRet;
+    if (nRetInfo < 0) return nRetInfo;
+
+    return DecodeDevInfo(pInfo, pRsp, nRspLen);
+}
+
+static void * DiscoverThread(void *pParam)
+{
+    TDiscoverJob *pJob = (TDiscoverJob *)pParam;
+    TRadarCtx *pCtx = &pJob->tCtx;
+    TU8 i;
+
+    xcom_port_init(&pCtx->tPort);
+    CLKSYNC_Init(&pCtx->tClkSync);
+
+    pJob->nRet = RADAR_ERROR_PORT_FAILED;
+
+    if (xcom_port_open(&pCtx->tPort, (TU8 *)pJob->szPort))
+    {
+        if (pJob->nBaud != RADAR_BAUD_AUTO)
+        {
+            pJob->nRet = ProbeRate(pCtx, pJob->nBaud, pJob->nTimeout, &pJob->tInfo);
+        }
+        else
+        {
+            for (i=0; i<UTIL_TAB_SIZE(g_nProbeBaudTab) && pJob->nRet != RADAR_ERROR_SUCCESS; i++)
+            {
+                pJob->nRet = ProbeRate(pCtx, g_nProbeBaudTab[i], pJob->nTimeout, &pJob->tInfo);
+                if (pJob->nRet == RADAR_ERROR_SUCCESS) pJob->nBaud = g_nProbeBaudTab[i];
+            }
+        }
+
+        xcom_port_close(&pCtx->tPort);
+    }
+
+    MUTEX_Lock(pJob->pRun->hLock);
+    pJob->bDone = TTrue;
+    COND_Broadcast(pJob->pRun->hCond);
+    MUTEX_Unlock(pJob->pRun->hLock);
+
+    DiscoverRelease(pJob->pRun);
+
+    return NULL;
+}
+
+int radar_discover(TU32 nBaud, TU32 nTimeout, TRadarFound *pFound, TU32 nMaxFound, TU32 *pFoundNum)
+{
+    char          szPorts[RADAR_MAX_DISCOVER_PORTS][UART_MAX_NAME_LEN];
+    TDiscoverRun *pRun;
+    TDiscoverJob *pJobs;
+    THREAD_CONFIG tCfg;
+    Timer_t tmJoin;
+    TU32 nPorts, nRates, i;
+
+    if ((nMaxFound > 0 && !pFound) || !pFoundNum)
+    {
+        return RADAR_ERROR_WRONG_PARAM;
+    }
+
+    *pFoundNum = 0;
+
+    nPorts = UART_List(szPorts, RADAR_MAX_DISCOVER_PORTS);
+    if (nPorts == 0) return RADAR_ERROR_SUCCESS;
+
+    pRun  = (TDiscoverRun *)calloc(1, sizeof(TDiscoverRun));
+    pJobs = (TDiscoverJob *)calloc(nPorts, sizeof(TDiscoverJob));
+    if (!pRun || !pJobs)
+    {
+        free(pRun);
+        free(pJobs);
+        return RADAR_ERROR_IMPLEMENTATION;
+    }
+
+    pRun->hLock = MUTEX_Create();
+    pRun->hCond = COND_Create();
+    pRun->nRefs = 1;
+    pRun->pJobs = pJobs;
+
+    if (pRun->hLock == INVALID_UTIL_HANDLE || pRun->hCond == INVALID_UTIL_HANDLE)
+    {
+        MUTEX_Delete(pRun->hLock);
+        COND_Delete(pRun->hCond);
+        free(pJobs);
+        free(pRun);
+        return RADAR_ERROR_IMPLEMENTATION;
+    }
+
+    // A probe needs little stack, there may be many of them
+    memset(&tCfg, 0, sizeof(tCfg));
+    tCfg.szName = "radar_probe";
+    tCfg.nStackSize = DISCOVER_STACK_SIZE;
+
+    for (i=0; i<nPorts; i++)
+    {
+        pJobs[i].pRun     = pRun;
+        strcpy(pJobs[i].szPort, szPorts[i]);
+        pJobs[i].nBaud    = nBaud;
+        pJobs[i].nTimeout = nTimeout;
+
+        MUTEX_Lock(pRun->hLock);
+        pRun->nRefs++;
+        MUTEX_Unlock(pRun->hLock);
+
+        if (THREAD_CreateEx(DiscoverThread, &pJobs[i], &tCfg, NULL) == INVALID_UTIL_HANDLE)
+        {
+            // Out of threads: probe it here, it only adds this one wait
+            DiscoverThread(&pJobs[i]);
+        }
+    }
+
+    // Each probe waits out one timeout per rate, at most
+    nRates = (nBaud == RADAR_BAUD_AUTO) ? UTIL_TAB_SIZE(g_nProbeBaudTab) : 1;
+    TIMER_SetDelay_ms(&tmJoin, nRates * nTimeout + DISCOVER_JOIN_MARGIN);
+    TIMER_Start(&tmJoin);
+
+    MUTEX_Lock(pRun->hLock);
+
+    for (i=0; i<nPorts; i++)
+    {
+        while (!pJobs[i].bDone && !TIMER_Elapsed(&tmJoin))
+        {
+            COND_Wait(pRun->hCond, pRun->hLock, (TU32)TIMER_RemainingUs(&tmJoin));
+        }
+
+        if (!pJobs[i].bDone)
+        {
+            LOG("radar_discover: no end to the probe of %s!\n", pJobs[i].szPort);
+            continue;
+        }
+
+        if (pJobs[i].nRet == RADAR_ERROR_SUCCESS && *pFoundNum < nMaxFound)
+        {
+            LOG("radar_discover: %s at %s, %lu baud\n", pJobs[i].tInfo.SerialNum, pJobs[i].szPort, pJobs[i].nBaud);
+
+            strcpy(pFound[*pFoundNum].szPort, pJobs[i].szPort);
+            pFound[*pFoundNum].nBaud = pJobs[i].nBaud;
+            pFound[*pFoundNum].tInfo = pJobs[i].tInfo;
+            (*pFoundNum)++;
+        }
+    }
+
+    MUTEX_Unlock(pRun->hLock);
+
+    DiscoverRelease(pRun);
+
+    return RADAR_ERROR_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Single device API, on the default context
+int radar_init(void)
+{
+    return radar_init_ex(&g_tRadarDef);
+}
+
+int radar_get_info(TDevInfo * pDevInfo)
+{
+    return radar_get_info_ex(&g_tRadarDef, pDevInfo);
+}
+
+int radar_set_ld(TU8 nPower)
+{
+    return radar_set_ld_ex(&g_tRadarDef, nPower);
+}
+
+int radar_set_mode(TU8 nMode)
+{
+    return radar_set_mode_ex(&g_tRadarDef, nMode);
+}
+
+int radar_set_res(TU16 nDepthSize)
+{
+    return radar_set_res_ex(&g_tRadarDef, nDepthSize);
+}
+
+int radar_get_fov(TU16 * pFov)
+{
+    return radar_get_fov_ex(&g_tRadarDef, pFov);
+}
+
+int radar_get_max_res(TU16 * pMaxRes)
+{
+    return radar_get_max_res_ex(&g_tRadarDef, pMaxRes);
+}
+
+int radar_trig_get_depth(TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize)
+{
+    return radar_trig_get_depth_ex(&g_tRadarDef, pTimestamp, ppDepth, pDepthSize);
+}
+
+int radar_cont_start(void)
+{
+    return radar_cont_start_ex(&g_tRadarDef);
+}
+
+int radar_cont_stop(void)
+{
+    return radar_cont_stop_ex(&g_tRadarDef);
+}
+
+int radar_cont_get_depth(TU32 nTimeout, TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize)
+{
+    return radar_cont_get_depth_ex(&g_tRadarDef, nTimeout, pTimestamp, ppDepth, pDepthSize);
+}
+
+int radar_take_dbg_img(TU16 *pWidth, TU16 *pHeight)
+{
+    return radar_take_dbg_img_ex(&g_tRadarDef, pWidth, pHeight);
+}
+
+int radar_read_dbg_img(TU32 nOffset, TU8 * pDat, TU16 * pDatLen)
+{
+    return radar_read_dbg_img_ex(&g_tRadarDef, nOffset, pDat, pDatLen);
+}
+
+int radar_read_dbg_img_bulk(TU32 nOffset, TU8 * pDat, TU32 * pDatLen, TU16 nSegLen)
+{
+    return radar_read_dbg_img_bulk_ex(&g_tRadarDef, nOffset, pDat, pDatLen, nSegLen);
+}
+
+int radar_query(TDevInfo * pDevInfo, TU16 * pFov, TU16 * pMaxRes)
+{
+    return radar_query_ex(&g_tRadarDef, pDevInfo, pFov, pMaxRes);
+}
+
+int radar_req_submit(TU8 nCmd, TU8 * pReq, TU16 nReqLen, TU8 * pId)
+{
+    return radar_req_submit_ex(&g_tRadarDef, nCmd, pReq, nReqLen, pId);
+}
+
+int radar_req_wait(TU8 nId, TU32 nTimeout, TU8 ** ppRsp, TU16 * pRspLen)
+{
+    return radar_req_wait_ex(&g_tRadarDef, nId, nTimeout, ppRsp, pRspLen);
+}
+
+int radar_req_cancel(TU8 nId)
+{
+    return radar_req_cancel_ex(&g_tRadarDef, nId);
+}
+
+void radar_get_link_stats(TXcomStats *pStats)
+{
+    radar_get_link_stats_ex(&g_tRadarDef, pStats);
+}
+
+TU64 radar_get_depth_arrival(void)
+{
+    return radar_get_depth_arrival_ex(&g_tRadarDef);
+}
+
+int radar_get_depth_time(TU64 *pDevTime, TU64 *pHostTime, TU32 *pErrBound)
+{
+    return radar_get_depth_time_ex(&g_tRadarDef, pDevTime, pHostTime, pErrBound);
+}
+
+int radar_start_io_thread(const THREAD_CONFIG *pCfg, TU32 *pApplied)
+{
+    return radar_start_io_thread_ex(&g_tRadarDef, pCfg, pApplied);
+}
+
+void radar_stop_io_thread(void)
+{
+    radar_stop_io_thread_ex(&g_tRadarDef);
+}
+
+int radar_start_cts_events(const THREAD_CONFIG *pCfg)
+{
+    return radar_start_cts_events_ex(&g_tRadarDef, pCfg);
+}
+
+void radar_stop_cts_events(void)
+{
+    radar_stop_cts_events_ex(&g_tRadarDef);
+}
+
+int radar_get_cts_event(TRadarCtsEvent *pEvent)
+{
+    return radar_get_cts_event_ex(&g_tRadarDef, pEvent);
+}
+
+int radar_open(char * szPort)
+{
+    return radar_open_ex(&g_tRadarDef, szPort);
+}
+
+int radar_open_baud(char * szPort, TU32 nBaud)
+{
+    return radar_open_baud_ex(&g_tRadarDef, szPort, nBaud);
+}
+
+TU32 radar_get_baud(void)
+{
+    return radar_get_baud_ex(&g_tRadarDef);
+}
+
+int radar_open_tuned(char * szPort, TU32 nBaud, TU32 nTunings)
+{
+    return radar_open_tuned_ex(&g_tRadarDef, szPort, nBaud, nTunings);
+}
+
+TU32 radar_get_tunings(void)
+{
+    return radar_get_tunings_ex(&g_tRadarDef);
+}
+
+int radar_reopen(TU32 nTimeout)
+{
+    return radar_reopen_ex(&g_tRadarDef, nTimeout);
+}
+
+int radar_close(void)
+{
+    return radar_close_ex(&g_tRadarDef);
 }
\ No newline at end of file
@@ -253,6 +253,8 @@ error:
  */
 
 #include "hal.h"
+#include "util.h"
+#include "xcom.h"
 
 #define RADAR_ERROR_SUCCESS             (0)         /**< @brief error code for return: success */
 #define RADAR_ERROR_PORT_FAILED         (-1)        /**< @brief error code for return: port unavailable for communication */
@@ -261,6 +263,7 @@ error:
 #define RADAR_ERROR_WRONG_PARAM         (-4)        /**< @brief error code for return: wrong parameters */
 #define RADAR_ERROR_DEPTH_UNAVAILABLE   (-5)        /**< @brief error code for return: depth frame not ready */
 #define RADAR_ERROR_IMPLEMENTATION      (-6)        /**< @brief error code for return: local implementation failure */
+#define RADAR_ERROR_EVENT_UNAVAILABLE   (-7)        /**< @brief error code for return: no event queued */
 
 /**
   * @brief mode definition of the device
@@ -283,6 +286,108 @@ typedef struct {
     TU8 Name[64];           /**< @brief the name of the device */
 } TDevInfo;
 
+#define RADAR_DEF_BAUD                  (XCOM_DEF_BAUD)         /**< @brief baud rate used by radar_open */
+#define RADAR_BAUD_AUTO                 (0)                     /**< @brief baud rate for radar_open_baud: probe the rate the device answers at */
+#define RADAR_LATENCY_TIMER             (1)                     /**< @brief ms, USB adapter latency timer set by UART_TUNE_LATENCY_TIMER */
+#define RADAR_MAX_PORT_NAME             (128)                   /**< @brief max length of a port name kept for radar_reopen, with the NUL */
+
+#define RADAR_MAX_REQ_IN_FLIGHT         (XCOM_TX_QUEUE_LEN)     /**< @brief max requests sent and waiting for response, power of 2 */
+#define RADAR_MAX_CTS_EVENTS            (64)                    /**< @brief CTS edges queued until read by radar_get_cts_event */
+#define RADAR_MAX_DISCOVER_PORTS        (64)                    /**< @brief max ports probed by radar_discover */
+#define RADAR_DISCOVER_TIMEOUT          (200)                   /**< @brief ms, a fair wait for radar_discover */
+
+/**
+  * @brief a device found by radar_discover
+  */
+typedef struct {
+    char     szPort[UART_MAX_NAME_LEN]; /**< @brief the port to open it at */
+    TU32     nBaud;                     /**< @brief the baud rate it answered at */
+    TDevInfo tInfo;                     /**< @brief its information, the serial number tells the devices apart */
+} TRadarFound;
+
+/**
+  * @brief an edge of the CTS line of the port
+  * @see radar_get_cts_event
+  */
+typedef struct {
+    TBool bHigh;            /**< @brief level of CTS after the edge */
+    TU64  nTimeUs;          /**< @brief host time of the edge in us, on the clock of TIMER_GetNowUs */
+    TU32  nEdges;           /**< @brief edges since the previous event, more than 1 if they came too close to tell apart */
+    TU32  nLost;            /**< @brief events dropped before this one as the queue was full */
+} TRadarCtsEvent;
+
+/**
+  * @brief a request sent to the device and waiting for its response
+  */
+typedef struct {
+    TU8   nState;
+    TU8   nId;
+    TU8   nCmd;
+    TU16  nLen;
+    TU64  nTimeUs;          /**< @brief host time the response arrived, see TIMER_GetNowUs */
+    TU8   cBuf[XCOM_MAX_PAYLOAD_LEN];
+} TRadarReq;
+
+/**
+  * @brief all state of one device link, owned by the caller
+  * @see radar_open_ex
+  */
+typedef struct {
+    TBool        bOpened;
+    TU32         nBaud;
+    char         szPort[RADAR_MAX_PORT_NAME];   // as opened, for radar_reopen_ex
+    TU32         nWantBaud;     // as asked for, RADAR_BAUD_AUTO included
+    TU32         nWantTunings;
+    TXcomPortCtx tPort;
+    TXcomCtx     tXcom;
+
+    // Requests in flight, keyed by message ID
+    TRadarReq    tReqTab[RADAR_MAX_REQ_IN_FLIGHT];
+    TU32         nTxCount;
+    TU64         nRspTimeUs;    // arrival of the response last returned by radar_req_wait_ex
+    TU8          cRspBuf[XCOM_MAX_PAYLOAD_LEN];  // its payload, the slot may be reused meanwhile
+
+    // Depth reported by the device, filled in turn so that the one handed
+    // to the caller stays valid while the next one comes in
+    TU8          cDepthBuf[2][XCOM_MAX_PAYLOAD_LEN];
+    TU8          nCurDepth;
+    TU16         nCurDepthLen;
+    TU64         nCurDepthTimeUs;
+    TU64         nCurDepthDevMs;
+
+    // Arrival and widened timestamp of the depth last handed to the caller
+    TU64         nDepthTimeUs;
+    TU64         nDepthDevMs;
+
+    // Device clock against the host one, fed by every depth frame
+    TClkSync     tClkSync;
+
+    // Device failed reported by the device
+    TBool        bDevFailed;
+
+    // I/O thread, see radar_start_io_thread_ex. It owns the port and shares
+    // the state above under hIoLock. It broadcasts hIoCond when frames came
+    // in and once it ends; hIoWake gets it out of its port wait when a frame
+    // is queued.
+    TBool          bIoThread;
+    volatile TBool bIoRun;
+    volatile TBool bIoDone;
+    volatile TBool bPortFailed;
+    UTIL_HANDLE    hIoLock;
+    UTIL_HANDLE    hIoCond;
+    UTIL_HANDLE    hIoWake;
+
+    // CTS edges, see radar_start_cts_events_ex. The watch thread of the HAL
+    // queues them under hCtsLock.
+    TBool          bCtsEvents;
+    UTIL_HANDLE    hCtsWatch;
+    UTIL_HANDLE    hCtsLock;
+    TRadarCtsEvent tCtsEvent[RADAR_MAX_CTS_EVENTS];
+    TU8            nCtsHead;
+    TU8            nCtsCount;
+    TU32           nCtsLost;
+} TRadarCtx;
+
 /**
  * @brief   initialize the device
  * @return  0 in case of success or <0 in case of failure
@@ -379,6 +484,52 @@ int radar_take_dbg_img(TU16 *pWidth, TU16 *pHeight);
  */
 int radar_read_dbg_img(TU32 nOffset, TU8 * pDat, TU16 * pDatLen);
 
+/**
+ * @brief   read a range of the debug image with several segment requests in flight
+ * @param   [in] nOffset the offset of the range to read
+ * @param   [out] pDat the pointer to the buffer to hold the range
+ * @param   [in,out] pDatLen the length to read, then the length actually read, shorter at the end of the image
+ * @param   [in] nSegLen the length of each segment request
+ * @return  0 in case of success or <0 in case of failure
+ */
+int radar_read_dbg_img_bulk(TU32 nOffset, TU8 * pDat, TU32 * pDatLen, TU16 nSegLen);
+
+/**
+ * @brief   get device information, field angle and max resolution with one round trip
+ * @param   [out] pDevInfo device-specific information of the device
+ * @param   [out] pFov the field angle of the device(unit: 0.1 degree)
+ * @param   [out] pMaxRes the max resolution of the device, NULL to leave it out
+ * @return  0 in case of success or <0 in case of failure
+ */
+int radar_query(TDevInfo * pDevInfo, TU16 * pFov, TU16 * pMaxRes);
+
+/**
+ * @brief   send a request without waiting for its response
+ * @param   [in] nCmd the RADAR_CMD_* command, without the REQ bit
+ * @param   [in] pReq the request payload
+ * @param   [in] nReqLen the length of the request payload
+ * @param   [out] pId the message ID to wait on with radar_req_wait()
+ * @return  0 in case of success or <0 in case of failure
+ */
+int radar_req_submit(TU8 nCmd, TU8 * pReq, TU16 nReqLen, TU8 * pId);
+
+/**
+ * @brief   wait for the response of a request sent by radar_req_submit(), responses may come in any order
+ * @param   [in] nId the message ID of the request
+ * @param   [in] nTimeout the wait time in ms for the response
+ * @param   [out] ppRsp the pointer to the response payload, valid until the next radar_req_wait()
+ * @param   [out] pRspLen the length of the response payload
+ * @return  0 in case of success or <0 in case of failure
+ */
+int radar_req_wait(TU8 nId, TU32 nTimeout, TU8 ** ppRsp, TU16 * pRspLen);
+
+/**
+ * @brief   give up a request sent by radar_req_submit() without waiting for its response
+ * @param   [in] nId the message ID of the request
+ * @return  0 in case of success or <0 in case of failure
+ */
+int radar_req_cancel(TU8 nId);
+
 /**
  * @brief   open the device 
  * @param   [in] szPort port string to communicate, e.g. COM0 or /dev/ttyS0
@@ -386,12 +537,179 @@ int radar_read_dbg_img(TU32 nOffset, TU8 * pDat, TU16 * pDatLen);
  */
 int radar_open(char * szPort);
 
+/**
+ * @brief   open the device at a given baud rate
+ * @param   [in] szPort port string to communicate, e.g. COM0 or /dev/ttyS0
+ * @param   [in] nBaud line rate, any one the port driver takes, or RADAR_BAUD_AUTO
+ *          to try the common rates until the device answers RADAR_CMD_INIT
+ * @return  0 in case of success or <0 in case of failure
+ * @see     radar_get_baud
+ */
+int radar_open_baud(char * szPort, TU32 nBaud);
+
+/**
+ * @brief   get the baud rate the device was opened at
+ * @return  the baud rate, or 0 if the device is not opened
+ */
+TU32 radar_get_baud(void);
+
+/**
+ * @brief   open the device with low latency tunings of the serial port
+ * @param   [in] szPort port string to communicate, e.g. COM0 or /dev/ttyUSB0
+ * @param   [in] nBaud line rate, as for radar_open_baud
+ * @param   [in] nTunings UART_TUNE_* to try: the driver low latency flag, the
+ *          USB adapter latency timer, waking the reader once a frame is in
+ * @return  0 in case of success or <0 in case of failure. A tuning the port
+ *          does not take is not a failure.
+ * @see     radar_get_tunings
+ */
+int radar_open_tuned(char * szPort, TU32 nBaud, TU32 nTunings);
+
+/**
+ * @brief   get the tunings that took effect when the device was opened
+ * @return  UART_TUNE_* applied, or 0 if the device is not opened
+ */
+TU32 radar_get_tunings(void);
+
+/**
+ * @brief   open the device again after its port was lost, e.g. a USB adapter unplugged or
+ *          re-enumerated: calls return RADAR_ERROR_PORT_FAILED then. Waits for the device
+ *          node to come back, then opens it with the port name, baud rate and tunings of
+ *          the last open. A name under /dev/serial/by-id finds the adapter under a new node.
+ * @param   [in] nTimeout the wait time in ms for the port to come back
+ * @return  0 in case of success or <0 in case of failure. The device is to be set up
+ *          again: mode, resolution, depth output, the I/O thread and the CTS events.
+ */
+int radar_reopen(TU32 nTimeout);
+
 /**
  * @brief   close the radar
  * @return  0 in case of success or <0 in case of failure
  */
 int radar_close(void);
 
+/**
+ * @brief   get the link counters: frames, CRC failures, resync bytes, RX/TX bytes and line utilization
+ * @param   [out] pStats the link counters
+ */
+void radar_get_link_stats(TXcomStats *pStats);
+
+/**
+ * @brief   get the host time the last depth frame arrived at
+ * @return  the monotonic time in us, on the clock of TIMER_GetNowUs, when the
+ *          frame last returned by radar_trig_get_depth or radar_cont_get_depth
+ *          was read from the port, or 0 if none
+ */
+TU64 radar_get_depth_arrival(void);
+
+/**
+ * @brief   get the time of the last depth frame on the host clock
+ * @param   [out] pDevTime the timestamp of the frame in ms, widened to 64 bits across wraps
+ * @param   [out] pHostTime the estimated host time in us, on the clock of TIMER_GetNowUs,
+ *          of that timestamp. Device and host clocks are matched by an offset and a
+ *          drift fitted over the frames of the last minute.
+ * @param   [out] pErrBound the error bound of pHostTime in us
+ * @return  0 in case of success or <0 in case of failure
+ */
+int radar_get_depth_time(TU64 *pDevTime, TU64 *pHostTime, TU32 *pErrBound);
+
+/**
+ * @brief   move the port I/O of the opened device to a thread of its own
+ * @param   [in] pCfg scheduling of the thread: a real-time policy and a CPU keep
+ *          the receive path from being preempted by other work. NULL for defaults.
+ * @param   [out] pApplied THREAD_SET_* that took effect, may be NULL. A setting
+ *          refused for lack of privilege is left out, the thread runs anyway.
+ * @return  0 in case of success or <0 in case of failure
+ * @see     radar_stop_io_thread
+ */
+int radar_start_io_thread(const THREAD_CONFIG *pCfg, TU32 *pApplied);
+
+/**
+ * @brief   stop the I/O thread, the calls do their port I/O again. radar_close stops it too.
+ */
+void radar_stop_io_thread(void);
+
+/**
+ * @brief   start stamping the edges of the CTS line of the opened port, e.g. wired to a
+ *          photo-eye or an encoder index. A thread blocks in the driver until the line
+ *          changes, so the stamps are on the host clock, as the ones of radar_get_depth_time.
+ * @param   [in] pCfg scheduling of the thread, NULL for defaults. A real-time
+ *          priority keeps the stamps close to the edges.
+ * @return  0 in case of success or <0 in case of failure, RADAR_ERROR_IMPLEMENTATION
+ *          if the port driver cannot report the line changes
+ * @see     radar_get_cts_event
+ */
+int radar_start_cts_events(const THREAD_CONFIG *pCfg);
+
+/**
+ * @brief   stop stamping the CTS edges, the queued ones are dropped. radar_close stops it too.
+ */
+void radar_stop_cts_events(void);
+
+/**
+ * @brief   take the oldest CTS edge from the queue
+ * @param   [out] pEvent the edge
+ * @return  0 in case of success, RADAR_ERROR_EVENT_UNAVAILABLE if the queue is empty
+ */
+int radar_get_cts_event(TRadarCtsEvent *pEvent);
+
+/**
+ * @brief   find the devices on all serial ports: /dev/ttyUSB*, /dev/ttyACM* and /dev/ttyS*, or COM*.
+ *          Each port is probed on a thread of its own with RADAR_CMD_INIT and RADAR_CMD_GET_INFO,
+ *          so the search takes one timeout however many ports there are. Call it before the
+ *          devices are opened: the probe writes to every port.
+ * @param   [in] nBaud baud rate to probe at, or RADAR_BAUD_AUTO to try the common rates in turn
+ * @param   [in] nTimeout the wait time in ms for a device to answer, at each rate
+ * @param   [out] pFound the devices found, in the order of their ports
+ * @param   [in] nMaxFound room in pFound
+ * @param   [out] pFoundNum the number of devices found
+ * @return  0 in case of success or <0 in case of failure. Finding none is a success.
+ */
+int radar_discover(TU32 nBaud, TU32 nTimeout, TRadarFound *pFound, TU32 nMaxFound, TU32 *pFoundNum);
+
+/**
+ * @name    Multi-device API
+ * Each call works like the one without _ex, on the device context given
+ * as first parameter instead of the default one. Contexts share nothing,
+ * so a single thread may drive many devices by polling each in turn,
+ * e.g. radar_cont_get_depth_ex() with a timeout of 0.
+ * @{
+ */
+int radar_open_ex(TRadarCtx *pCtx, char * szPort);
+int radar_open_baud_ex(TRadarCtx *pCtx, char * szPort, TU32 nBaud);
+TU32 radar_get_baud_ex(TRadarCtx *pCtx);
+int radar_open_tuned_ex(TRadarCtx *pCtx, char * szPort, TU32 nBaud, TU32 nTunings);
+TU32 radar_get_tunings_ex(TRadarCtx *pCtx);
+int radar_reopen_ex(TRadarCtx *pCtx, TU32 nTimeout);
+int radar_close_ex(TRadarCtx *pCtx);
+int radar_init_ex(TRadarCtx *pCtx);
+int radar_get_info_ex(TRadarCtx *pCtx, TDevInfo * pDevInfo);
+int radar_set_ld_ex(TRadarCtx *pCtx, TU8 nPower);
+int radar_set_mode_ex(TRadarCtx *pCtx, TU8 nMode);
+int radar_set_res_ex(TRadarCtx *pCtx, TU16 nDepthSize);
+int radar_get_fov_ex(TRadarCtx *pCtx, TU16 * pFov);
+int radar_get_max_res_ex(TRadarCtx *pCtx, TU16 * pMaxRes);
+int radar_trig_get_depth_ex(TRadarCtx *pCtx, TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize);
+int radar_cont_start_ex(TRadarCtx *pCtx);
+int radar_cont_stop_ex(TRadarCtx *pCtx);
+int radar_cont_get_depth_ex(TRadarCtx *pCtx, TU32 nTimeout, TU32 *pTimestamp, TU16 ** ppDepth, TU16 * pDepthSize);
+int radar_take_dbg_img_ex(TRadarCtx *pCtx, TU16 *pWidth, TU16 *pHeight);
+int radar_read_dbg_img_ex(TRadarCtx *pCtx, TU32 nOffset, TU8 * pDat, TU16 * pDatLen);
+int radar_read_dbg_img_bulk_ex(TRadarCtx *pCtx, TU32 nOffset, TU8 * pDat, TU32 * pDatLen, TU16 nSegLen);
+int radar_query_ex(TRadarCtx *pCtx, TDevInfo * pDevInfo, TU16 * pFov, TU16 * pMaxRes);
+int radar_req_submit_ex(TRadarCtx *pCtx, TU8 nCmd, TU8 * pReq, TU16 nReqLen, TU8 * pId);
+int radar_req_wait_ex(TRadarCtx *pCtx, TU8 nId, TU32 nTimeout, TU8 ** ppRsp, TU16 * pRspLen);
+int radar_req_cancel_ex(TRadarCtx *pCtx, TU8 nId);
+void radar_get_link_stats_ex(TRadarCtx *pCtx, TXcomStats *pStats);
+TU64 radar_get_depth_arrival_ex(TRadarCtx *pCtx);
+int radar_get_depth_time_ex(TRadarCtx *pCtx, TU64 *pDevTime, TU64 *pHostTime, TU32 *pErrBound);
+int radar_start_io_thread_ex(TRadarCtx *pCtx, const THREAD_CONFIG *pCfg, TU32 *pApplied);
+void radar_stop_io_thread_ex(TRadarCtx *pCtx);
+int radar_start_cts_events_ex(TRadarCtx *pCtx, const THREAD_CONFIG *pCfg);
+void radar_stop_cts_events_ex(TRadarCtx *pCtx);
+int radar_get_cts_event_ex(TRadarCtx *pCtx, TRadarCtsEvent *pEvent);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
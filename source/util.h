@@ -29,25 +29,84 @@ void  LOG_PrintData(TU16 *pData, TU16 nLen, TU16 nFrames);///mydatalog
 #define LOG_Frame       LOG_TRACE_PrintFrame
 #define LOG_Data		LOG_PrintData
 
+////////////////////////////////////////////////////////////////////////////////
+// Capture of the raw UART bytes, see util_cap.c for the file format
+enum {
+    CAP_DIR_RX = 0,
+    CAP_DIR_TX,
+    CAP_DIR_LOST
+};
+
+TBool CAP_Init(const char * szFileName);
+void  CAP_DeInit(void);
+TBool CAP_IsOn(void);
+void  CAP_Write(TU8 nDir, TU8 nLink, TU8 *pBuf, TU32 nLen);
+
+////////////////////////////////////////////////////////////////////////////////
+// Clock sync: maps a device ms counter onto TIMER_GetNowUs, see util_clksync.c
+#define CLKSYNC_BUCKETS     (64)
+
+typedef struct {
+    TU64 nDev;              // device ms, widened
+    TU64 nHost;             // host us
+} TClkSyncPoint;
+
+typedef struct {
+    // Sample with the least delay in each of the last buckets of device time
+    TClkSyncPoint tPoint[CLKSYNC_BUCKETS];
+    TU32    nCount;
+    TU32    nHead;
+
+    // Widening of the 32-bit device counter
+    TBool   bStarted;
+    TU32    nDevLast;
+    TU64    nDevHigh;
+
+    // Fit: host = tPoint[nHead].nHost + fOffset + fSlope * (dev - tPoint[nHead].nDev)
+    TDouble fOffset;        // us
+    TDouble fSlope;         // host us per device ms
+    TU32    nErrUs;
+} TClkSync;
+
+void  CLKSYNC_Init(TClkSync *pSync);
+TU64  CLKSYNC_Update(TClkSync *pSync, TU32 nDevMs, TU64 nHostUs);      // returns nDevMs widened
+TBool CLKSYNC_ToHost(TClkSync *pSync, TU64 nDevMs, TU64 *pHostUs, TU32 *pErrUs);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Timer
 typedef TU32 Counter_t;
 
+// Runs on TIMER_GetNowUs, 64 bits wide, so it never wraps
 typedef struct {
-    Counter_t delay;
-    Counter_t start;
+    TU64 delay;     // us
+    TU64 start;     // us
     TU8 flag;
 } Timer_t;
     
 TBool TIMER_SetDelay_ms(Timer_t *timer, Counter_t delay);
+void  TIMER_SetDelay_us(Timer_t *timer, TU64 delay);
 void  TIMER_Start(Timer_t *timer);
 void  TIMER_Stop(Timer_t *timer);
 TBool TIMER_Elapsed(Timer_t *timer);
 TBool TIMER_isStarted(Timer_t *timer);
+Counter_t TIMER_Remaining(Timer_t *timer);     // ms, rounded up
+TU64  TIMER_RemainingUs(Timer_t *timer);
 
 ////////////////////////////////////////////////////////////////////////////////
 // CRC
-TU8 CRC_CalCrc8(TU8 *pBuf, TU16 nLen, TU8 nPrev);
+enum {
+    CRC8_IMPL_AUTO = 0,     // fastest one supported by the running CPU
+    CRC8_IMPL_BITWISE,      // reference, 8 shifts per byte
+    CRC8_IMPL_SLICE8,       // table driven, 8 bytes per step
+    CRC8_IMPL_CLMUL,        // PCLMULQDQ folding, x86 only
+    CRC8_IMPL_NUM
+};
+
+TU8   CRC_CalCrc8(TU8 *pBuf, TU16 nLen, TU8 nPrev);
+TBool CRC_IsImplSupported(TU8 nImpl);
+TBool CRC_SelectImpl(TU8 nImpl);     // not while other threads compute CRCs
+TU8   CRC_GetImpl(void);
+const char * CRC_GetImplName(TU8 nImpl);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Misc
@@ -59,6 +118,12 @@ TU8 CRC_CalCrc8(TU8 *pBuf, TU16 nLen, TU8 nPrev);
 #define UTIL_DEC_TU32_MSBF(p)   ( ( ((TU32)UTIL_DEC_TU16_MSBF(p)) << 16) + UTIL_DEC_TU16_MSBF((p)+2) )
 #define UTIL_DEC_TU32_LSBF(p)   ( ( ((TU32)UTIL_DEC_TU16_LSBF((p)+2)) << 16) + UTIL_DEC_TU16_LSBF(p) )
 
+#define UTIL_ENC_TU16_LSBF(p, v)    do { ((TU8*)(p))[0] = (TU8)((v) & 0xFF); ((TU8*)(p))[1] = (TU8)(((v) >> 8) & 0xFF); } while (0)
+#define UTIL_ENC_TU32_LSBF(p, v)    do { UTIL_ENC_TU16_LSBF((p), (v) & 0xFFFF); UTIL_ENC_TU16_LSBF(((TU8*)(p))+2, ((v) >> 16) & 0xFFFF); } while (0)
+
+// Fails to compile when c is false, usable at file scope
+#define UTIL_STATIC_ASSERT(c, name) typedef char util_static_assert_##name[(c) ? 1 : -1]
+
 #define UTIL_MAX(a, b)  ((a) > (b) ? (a) : (b))
 #define UTIL_MIN(a, b)  ((a) < (b) ? (a) : (b))
 
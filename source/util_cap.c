@@ -0,0 +1,193 @@
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/// Capture file, all fields LSB first
+///
+/// FILE HEADER: MAGIC "XCAP" | VERSION (2) | HEADER LEN (2) | OPEN TIME us since 1970 (8)
+/// RECORD:      TIMESTAMP us, monotonic (8) | LEN (2) | DIR (1) | LINK (1) | DATA[LEN]
+///
+/// DIR is one of CAP_DIR_*. A CAP_DIR_LOST record carries the number of bytes
+/// dropped before it (4), when the writer could not keep up.
+#define CAP_VERSION             (1)
+#define CAP_FILE_HDR_LEN        (16)
+#define CAP_REC_HDR_LEN         (12)
+
+// Two buffers: one filled by the I/O path, one written out by the thread
+#define CAP_BUF_SIZE            (256 * 1024)
+#define CAP_FLUSH_PERIOD        (20)        // ms
+
+static FILE   * g_fpCap = NULL;
+static UTIL_HANDLE g_hCapLock = INVALID_UTIL_HANDLE;
+static UTIL_HANDLE g_hCapThread = INVALID_UTIL_HANDLE;
+static volatile TBool g_bCapOn = TFalse;
+static volatile TBool g_bCapRun = TFalse;
+static volatile TBool g_bCapDone = TFalse;
+
+static TU8      g_cCapBuf[2][CAP_BUF_SIZE];
+static TU32     g_nCapLen[2] = {0, 0};
+static TU8      g_nCapFill = 0;
+static TU32     g_nCapLost = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+static void CAP_PutRecHdr(TU8 *p, TU64 nTime, TU16 nLen, TU8 nDir, TU8 nLink)
+{
+    UTIL_ENC_TU32_LSBF(&p[0], (TU32)(nTime & 0xFFFFFFFF));
+    UTIL_ENC_TU32_LSBF(&p[4], (TU32)(nTime >> 32));
+    UTIL_ENC_TU16_LSBF(&p[8], nLen);
+    p[10] = nDir;
+    p[11] = nLink;
+}
+
+// Called with the lock held
+static TBool CAP_Append(TU64 nTime, TU8 nDir, TU8 nLink, TU8 *pBuf, TU16 nLen)
+{
+    TU8 *p;
+
+    if (g_nCapLen[g_nCapFill] + CAP_REC_HDR_LEN + nLen > CAP_BUF_SIZE) return TFalse;
+
+    p = &g_cCapBuf[g_nCapFill][g_nCapLen[g_nCapFill]];
+
+    CAP_PutRecHdr(p, nTime, nLen, nDir, nLink);
+    memcpy(p + CAP_REC_HDR_LEN, pBuf, nLen);
+
+    g_nCapLen[g_nCapFill] += CAP_REC_HDR_LEN + nLen;
+
+    return TTrue;
+}
+
+static void CAP_Flush(void)
+{
+    TU8 nOut;
+
+    // Swap the buffers, then write the full one without holding the lock
+    UTIL_Lock(g_hCapLock);
+    nOut = g_nCapFill;
+    g_nCapFill = (TU8)(1 - g_nCapFill);
+    UTIL_Unlock(g_hCapLock);
+
+    if (g_nCapLen[nOut] > 0)
+    {
+        fwrite(g_cCapBuf[nOut], 1, g_nCapLen[nOut], g_fpCap);
+        fflush(g_fpCap);
+        g_nCapLen[nOut] = 0;
+    }
+}
+
+static void * CAP_WriterThread(void *pParam)
+{
+    while (g_bCapRun)
+    {
+        UTIL_Sleep(CAP_FLUSH_PERIOD);
+        CAP_Flush();
+    }
+
+    // Both buffers may hold data
+    CAP_Flush();
+    CAP_Flush();
+
+    g_bCapDone = TTrue;
+
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TBool CAP_Init(const char * szFileName)
+{
+    TU8  cHdr[CAP_FILE_HDR_LEN];
+    TU64 nOpenTime = (TU64)time(NULL) * 1000000;
+
+    if (g_bCapOn || !szFileName) return TFalse;
+
+    g_fpCap = fopen(szFileName, "wb");
+    if (!g_fpCap)
+    {
+        printf("open capture file [%s] failed!\n", szFileName);
+        return TFalse;
+    }
+
+    memcpy(&cHdr[0], "XCAP", 4);
+    UTIL_ENC_TU16_LSBF(&cHdr[4], CAP_VERSION);
+    UTIL_ENC_TU16_LSBF(&cHdr[6], CAP_FILE_HDR_LEN);
+    UTIL_ENC_TU32_LSBF(&cHdr[8],  (TU32)(nOpenTime & 0xFFFFFFFF));
+    UTIL_ENC_TU32_LSBF(&cHdr[12], (TU32)(nOpenTime >> 32));
+    fwrite(cHdr, 1, sizeof(cHdr), g_fpCap);
+
+    g_nCapLen[0] = g_nCapLen[1] = 0;
+    g_nCapFill = 0;
+    g_nCapLost = 0;
+
+    if (g_hCapLock == INVALID_UTIL_HANDLE) g_hCapLock = UTIL_CreateLock();
+
+    g_bCapRun  = TTrue;
+    g_bCapDone = TFalse;
+    g_hCapThread = THREAD_Create(CAP_WriterThread, NULL);
+
+    if (g_hCapThread == INVALID_UTIL_HANDLE)
+    {
+        g_bCapRun = TFalse;
+        fclose(g_fpCap);
+        g_fpCap = NULL;
+        return TFalse;
+    }
+
+    g_bCapOn = TTrue;
+
+    return TTrue;
+}
+
+void  CAP_DeInit(void)
+{
+    if (!g_bCapOn) return;
+
+    g_bCapOn  = TFalse;
+    g_bCapRun = TFalse;
+
+    // Let the writer drain both buffers
+    while (!g_bCapDone) UTIL_Sleep(1);
+
+    fclose(g_fpCap);
+    g_fpCap = NULL;
+}
+
+TBool CAP_IsOn(void)
+{
+    return g_bCapOn;
+}
+
+void  CAP_Write(TU8 nDir, TU8 nLink, TU8 *pBuf, TU32 nLen)
+{
+    TU64 nTime;
+    TU8  cLost[4];
+    TU16 nChunk;
+
+    if (!g_bCapOn || nLen == 0) return;
+
+    nTime = TIMER_GetNowUs();
+
+    UTIL_Lock(g_hCapLock);
+
+    // Tell the reader where bytes are missing, as soon as there is room again
+    if (g_nCapLost > 0)
+    {
+        UTIL_ENC_TU32_LSBF(cLost, g_nCapLost);
+        if (CAP_Append(nTime, CAP_DIR_LOST, nLink, cLost, sizeof(cLost))) g_nCapLost = 0;
+    }
+
+    while (nLen > 0)
+    {
+        nChunk = (TU16)UTIL_MIN(nLen, (TU32)TU16_MAX);
+
+        if ((g_nCapLost > 0) || !CAP_Append(nTime, nDir, nLink, pBuf, nChunk))
+        {
+            g_nCapLost += nLen;
+            break;
+        }
+
+        pBuf += nChunk;
+        nLen -= nChunk;
+    }
+
+    UTIL_Unlock(g_hCapLock);
+}
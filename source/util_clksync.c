@@ -0,0 +1,151 @@
+#include "util.h"
+#include <string.h>
+
+/// Clock sync
+///
+/// The device stamps frames with a free running 32-bit ms counter. Each frame
+/// gives a pair (device time, host arrival time). The arrival lags the stamp
+/// by a delay which is never negative and often larger than the least one,
+/// e.g. when the host is busy or the USB adapter holds the bytes. So only the
+/// pairs with the least delay are kept: one per bucket of device time. A line
+/// fitted through them by least squares gives the drift; it is then moved
+/// down onto the lowest of them, the one with the least delay.
+///
+/// The error bound is the ms resolution of the device counter plus the
+/// largest distance of a kept pair from the line.
+#define CLKSYNC_BUCKET_MS       (1000)
+#define CLKSYNC_TICK_US         (1000)
+
+// Crystals drift by some 10 ppm: a slope more than 1% off is noise
+#define CLKSYNC_NOMINAL_SLOPE   (1000.0)
+#define CLKSYNC_MAX_SLOPE_DEV   (0.01)
+
+////////////////////////////////////////////////////////////////////////////////
+// Host time of a pair, less the device time at the nominal rate
+static TDouble CLKSYNC_Delay(const TClkSyncPoint *p)
+{
+    return (TDouble)p->nHost - (TDouble)p->nDev * CLKSYNC_NOMINAL_SLOPE;
+}
+
+static TDouble CLKSYNC_Diff(TU64 a, TU64 b)
+{
+    return (a >= b) ? (TDouble)(a - b) : -(TDouble)(b - a);
+}
+
+static void CLKSYNC_Fit(TClkSync *pSync)
+{
+    const TClkSyncPoint *pRef = &pSync->tPoint[pSync->nHead];
+    TDouble fX, fY, fMeanX = 0, fMeanY = 0, fSxx = 0, fSxy = 0;
+    TDouble fRes, fResMin = 0, fResMax = 0;
+    TU32 i;
+
+    // Relative to the newest pair, so that doubles keep the us
+    for (i=0; i<pSync->nCount; i++)
+    {
+        fMeanX += CLKSYNC_Diff(pSync->tPoint[i].nDev, pRef->nDev);
+        fMeanY += CLKSYNC_Diff(pSync->tPoint[i].nHost, pRef->nHost);
+    }
+    fMeanX /= pSync->nCount;
+    fMeanY /= pSync->nCount;
+
+    for (i=0; i<pSync->nCount; i++)
+    {
+        fX = CLKSYNC_Diff(pSync->tPoint[i].nDev, pRef->nDev) - fMeanX;
+        fY = CLKSYNC_Diff(pSync->tPoint[i].nHost, pRef->nHost) - fMeanY;
+        fSxx += fX * fX;
+        fSxy += fX * fY;
+    }
+
+    pSync->fSlope = (fSxx > 0) ? (fSxy / fSxx) : CLKSYNC_NOMINAL_SLOPE;
+
+    if (pSync->fSlope < CLKSYNC_NOMINAL_SLOPE * (1 - CLKSYNC_MAX_SLOPE_DEV)
+     || pSync->fSlope > CLKSYNC_NOMINAL_SLOPE * (1 + CLKSYNC_MAX_SLOPE_DEV))
+    {
+        pSync->fSlope = CLKSYNC_NOMINAL_SLOPE;
+    }
+
+    pSync->fOffset = fMeanY - pSync->fSlope * fMeanX;
+
+    // Move the line onto the pair with the least delay
+    for (i=0; i<pSync->nCount; i++)
+    {
+        fRes = CLKSYNC_Diff(pSync->tPoint[i].nHost, pRef->nHost)
+             - (pSync->fOffset + pSync->fSlope * CLKSYNC_Diff(pSync->tPoint[i].nDev, pRef->nDev));
+
+        if (i == 0 || fRes < fResMin) fResMin = fRes;
+        if (i == 0 || fRes > fResMax) fResMax = fRes;
+    }
+
+    pSync->fOffset += fResMin;
+    pSync->nErrUs = (TU32)(CLKSYNC_TICK_US + (fResMax - fResMin) + 0.5);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void  CLKSYNC_Init(TClkSync *pSync)
+{
+    memset(pSync, 0, sizeof(TClkSync));
+    pSync->fSlope = CLKSYNC_NOMINAL_SLOPE;
+}
+
+TU64  CLKSYNC_Update(TClkSync *pSync, TU32 nDevMs, TU64 nHostUs)
+{
+    TClkSyncPoint tNew;
+    TClkSyncPoint *pCur;
+
+    if (pSync->bStarted && nDevMs < pSync->nDevLast)
+    {
+        if (pSync->nDevLast - nDevMs > (TU32)TS32_MAX)
+        {
+            // Wrapped around
+            pSync->nDevHigh += (TU64)1 << 32;
+        }
+        else
+        {
+            // Counter went back: the device restarted, its old fit is void
+            CLKSYNC_Init(pSync);
+        }
+    }
+
+    pSync->bStarted = TTrue;
+    pSync->nDevLast = nDevMs;
+
+    tNew.nDev  = pSync->nDevHigh + nDevMs;
+    tNew.nHost = nHostUs;
+
+    pCur = &pSync->tPoint[pSync->nHead];
+
+    if (pSync->nCount == 0)
+    {
+        pSync->nCount = 1;
+        *pCur = tNew;
+    }
+    else if (tNew.nDev / CLKSYNC_BUCKET_MS == pCur->nDev / CLKSYNC_BUCKET_MS)
+    {
+        if (CLKSYNC_Delay(&tNew) < CLKSYNC_Delay(pCur)) *pCur = tNew;
+    }
+    else
+    {
+        pSync->nHead = (pSync->nHead + 1) % CLKSYNC_BUCKETS;
+        if (pSync->nCount < CLKSYNC_BUCKETS) pSync->nCount++;
+        pSync->tPoint[pSync->nHead] = tNew;
+    }
+
+    CLKSYNC_Fit(pSync);
+
+    return tNew.nDev;
+}
+
+TBool CLKSYNC_ToHost(TClkSync *pSync, TU64 nDevMs, TU64 *pHostUs, TU32 *pErrUs)
+{
+    const TClkSyncPoint *pRef = &pSync->tPoint[pSync->nHead];
+    TDouble fHost;
+
+    if (pSync->nCount == 0) return TFalse;
+
+    fHost = (TDouble)pRef->nHost + pSync->fOffset + pSync->fSlope * CLKSYNC_Diff(nDevMs, pRef->nDev);
+
+    if (pHostUs) *pHostUs = (fHost > 0) ? (TU64)(fHost + 0.5) : 0;
+    if (pErrUs)  *pErrUs  = pSync->nErrUs;
+
+    return TTrue;
+}
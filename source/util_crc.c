@@ -1,28 +1,286 @@
 #include "util.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC8_HAS_CLMUL
+#include <immintrin.h>
+#endif
 
 /// CRC8_ATM
 /// standard CRC8-ATM
 /// POLY: 0x07 (x8+x2+x+1)
-/// START CRC VAL: 0x00 
-/// END XOR: 0x00 
-/// DATA INVERTED: NO 
+/// START CRC VAL: 0x00
+/// END XOR: 0x00
+/// DATA INVERTED: NO
 /// CRC INVERTED: NO
-TU8 CRC_CalCrc8(TU8 *pBuf, TU16 nLen, TU8 nPrev)
+#define CRC8_POLY               (0x07)
+#define CRC8_SLICE_NUM          (8)
+#define CRC8_CLMUL_MIN_LEN      (64)
+
+typedef TU8 (*CRC8_FUNC)(TU8 *pBuf, TU16 nLen, TU8 nPrev);
+
+static TU8   g_tCrc8Tab[CRC8_SLICE_NUM][256];
+static TU8   g_nCrc8Impl = CRC8_IMPL_AUTO;
+static UTIL_ONCE g_tCrc8Once = UTIL_ONCE_INIT;
+
+////////////////////////////////////////////////////////////////////////////////
+static TU8 Crc8_Bitwise(TU8 *pBuf, TU16 nLen, TU8 nPrev)
 {
-    TU8 nCrc8 = nPrev; 
+    TU8 nCrc8 = nPrev;
     TU8 i;
-    
+
     while(nLen--)
     {
         nCrc8 ^= *pBuf++;
         for (i=0; i<8; i++)
         {
             if (nCrc8 & 0x80)
-                nCrc8 = (nCrc8 << 1) ^ 0x07;
+                nCrc8 = (nCrc8 << 1) ^ CRC8_POLY;
             else
                 nCrc8 <<= 1;
         }
     }
-    
+
     return nCrc8;
-}
\ No newline at end of file
+}
+
+static void Crc8_TabInit(void)
+{
+    TU32 i, k;
+    TU8  nByte;
+
+    // Table 0 is the classic byte-wise table
+    for (i=0; i<256; i++)
+    {
+        nByte = (TU8)i;
+        g_tCrc8Tab[0][i] = Crc8_Bitwise(&nByte, 1, 0);
+    }
+
+    // Table k is the CRC of the byte followed by k zero bytes
+    for (k=1; k<CRC8_SLICE_NUM; k++)
+    {
+        for (i=0; i<256; i++)
+        {
+            g_tCrc8Tab[k][i] = g_tCrc8Tab[0][g_tCrc8Tab[k-1][i]];
+        }
+    }
+}
+
+static TU8 Crc8_Slice8(TU8 *pBuf, TU16 nLen, TU8 nPrev)
+{
+    TU8 nCrc8 = nPrev;
+
+    // Eight bytes per step, all lookups independent of each other
+    while (nLen >= CRC8_SLICE_NUM)
+    {
+        nCrc8 = (TU8)(g_tCrc8Tab[7][nCrc8 ^ pBuf[0]]
+                    ^ g_tCrc8Tab[6][pBuf[1]]
+                    ^ g_tCrc8Tab[5][pBuf[2]]
+                    ^ g_tCrc8Tab[4][pBuf[3]]
+                    ^ g_tCrc8Tab[3][pBuf[4]]
+                    ^ g_tCrc8Tab[2][pBuf[5]]
+                    ^ g_tCrc8Tab[1][pBuf[6]]
+                    ^ g_tCrc8Tab[0][pBuf[7]]);
+
+        pBuf += CRC8_SLICE_NUM;
+        nLen -= CRC8_SLICE_NUM;
+    }
+
+    while (nLen--)
+    {
+        nCrc8 = g_tCrc8Tab[0][nCrc8 ^ *pBuf++];
+    }
+
+    return nCrc8;
+}
+
+#ifdef CRC8_HAS_CLMUL
+/// The message is a polynomial with the MSB of the first byte as the highest
+/// term, and CRC = M(x) * x^8 mod P(x). Blocks of 16 bytes are byte-reversed
+/// so that bit i of the 128-bit lane is the coefficient of x^i, then folded
+/// with A * x^N = H * (x^(N+64) mod P) + L * (x^N mod P). The folded 128-bit
+/// remainder is congruent to the processed prefix and is finished by table.
+static TU64 g_nCrc8K128 = 0;    // x^128 mod P
+static TU64 g_nCrc8K192 = 0;    // x^192 mod P
+static TU64 g_nCrc8K512 = 0;    // x^512 mod P
+static TU64 g_nCrc8K576 = 0;    // x^576 mod P
+
+static TU64 Crc8_XPowMod(TU32 nPow)
+{
+    TU32 nRem = 1;
+
+    while (nPow--)
+    {
+        nRem <<= 1;
+        if (nRem & 0x100) nRem ^= (0x100 | CRC8_POLY);
+    }
+
+    return (TU64)nRem;
+}
+
+__attribute__((target("pclmul,ssse3")))
+static __m128i Crc8_Fold(__m128i tAcc, __m128i tK, __m128i tData)
+{
+    // tK: low qword = x^N mod P, high qword = x^(N+64) mod P
+    __m128i tLo = _mm_clmulepi64_si128(tAcc, tK, 0x00);
+    __m128i tHi = _mm_clmulepi64_si128(tAcc, tK, 0x11);
+
+    return _mm_xor_si128(_mm_xor_si128(tLo, tHi), tData);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static TU8 Crc8_Clmul(TU8 *pBuf, TU16 nLen, TU8 nPrev)
+{
+    const __m128i tBswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i tK128 = _mm_set_epi64x((long long)g_nCrc8K192, (long long)g_nCrc8K128);
+    __m128i tK512 = _mm_set_epi64x((long long)g_nCrc8K576, (long long)g_nCrc8K512);
+    __m128i tAcc0, tAcc1, tAcc2, tAcc3;
+    TU8     cRem[16];
+
+    if (nLen < CRC8_CLMUL_MIN_LEN) return Crc8_Slice8(pBuf, nLen, nPrev);
+
+    // CRC of (prev, data) equals CRC of data with prev added to its first byte
+    tAcc0 = _mm_loadu_si128((const __m128i *)(pBuf +  0));
+    tAcc0 = _mm_xor_si128(tAcc0, _mm_cvtsi32_si128(nPrev));
+    tAcc0 = _mm_shuffle_epi8(tAcc0, tBswap);
+    tAcc1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf + 16)), tBswap);
+    tAcc2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf + 32)), tBswap);
+    tAcc3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf + 48)), tBswap);
+    pBuf += 64;
+    nLen -= 64;
+
+    // Four independent lanes, 64 bytes per step
+    while (nLen >= 64)
+    {
+        tAcc0 = Crc8_Fold(tAcc0, tK512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf +  0)), tBswap));
+        tAcc1 = Crc8_Fold(tAcc1, tK512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf + 16)), tBswap));
+        tAcc2 = Crc8_Fold(tAcc2, tK512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf + 32)), tBswap));
+        tAcc3 = Crc8_Fold(tAcc3, tK512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pBuf + 48)), tBswap));
+        pBuf += 64;
+        nLen -= 64;
+    }
+
+    // Merge the lanes into one
+    tAcc0 = Crc8_Fold(tAcc0, tK128, tAcc1);
+    tAcc0 = Crc8_Fold(tAcc0, tK128, tAcc2);
+    tAcc0 = Crc8_Fold(tAcc0, tK128, tAcc3);
+
+    while (nLen >= 16)
+    {
+        tAcc0 = Crc8_Fold(tAcc0, tK128, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)pBuf), tBswap));
+        pBuf += 16;
+        nLen -= 16;
+    }
+
+    // Back to message byte order, then reduce the remainder and the tail by table
+    _mm_storeu_si128((__m128i *)cRem, _mm_shuffle_epi8(tAcc0, tBswap));
+
+    return Crc8_Slice8(pBuf, nLen, Crc8_Slice8(cRem, 16, 0));
+}
+
+static TBool Crc8_ClmulSupported(void)
+{
+    __builtin_cpu_init();
+
+    return (TBool)(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"));
+}
+
+static void Crc8_ClmulInit(void)
+{
+    g_nCrc8K128 = Crc8_XPowMod(128);
+    g_nCrc8K192 = Crc8_XPowMod(192);
+    g_nCrc8K512 = Crc8_XPowMod(512);
+    g_nCrc8K576 = Crc8_XPowMod(576);
+}
+#endif // CRC8_HAS_CLMUL
+
+static CRC8_FUNC g_pCrc8Func = Crc8_Bitwise;
+
+static void Crc8_Use(TU8 nImpl)
+{
+    if (nImpl == CRC8_IMPL_AUTO)
+    {
+        nImpl = CRC_IsImplSupported(CRC8_IMPL_CLMUL) ? CRC8_IMPL_CLMUL : CRC8_IMPL_SLICE8;
+    }
+
+    switch (nImpl)
+    {
+    case CRC8_IMPL_BITWISE:
+        g_pCrc8Func = Crc8_Bitwise;
+        break;
+#ifdef CRC8_HAS_CLMUL
+    case CRC8_IMPL_CLMUL:
+        g_pCrc8Func = Crc8_Clmul;
+        break;
+#endif
+    default:
+        g_pCrc8Func = Crc8_Slice8;
+        break;
+    }
+
+    g_nCrc8Impl = nImpl;
+}
+
+// Tables and the fastest implementation, set up once for all threads
+static void Crc8_Init(void)
+{
+    Crc8_TabInit();
+#ifdef CRC8_HAS_CLMUL
+    Crc8_ClmulInit();
+#endif
+    Crc8_Use(CRC8_IMPL_AUTO);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TBool CRC_IsImplSupported(TU8 nImpl)
+{
+    switch (nImpl)
+    {
+    case CRC8_IMPL_AUTO:
+    case CRC8_IMPL_BITWISE:
+    case CRC8_IMPL_SLICE8:
+        return TTrue;
+#ifdef CRC8_HAS_CLMUL
+    case CRC8_IMPL_CLMUL:
+        return Crc8_ClmulSupported();
+#endif
+    default:
+        return TFalse;
+    }
+}
+
+TBool CRC_SelectImpl(TU8 nImpl)
+{
+    if (!CRC_IsImplSupported(nImpl)) return TFalse;
+
+    ONCE_Run(&g_tCrc8Once, Crc8_Init);
+    Crc8_Use(nImpl);
+
+    return TTrue;
+}
+
+TU8 CRC_GetImpl(void)
+{
+    ONCE_Run(&g_tCrc8Once, Crc8_Init);
+
+    return g_nCrc8Impl;
+}
+
+const char * CRC_GetImplName(TU8 nImpl)
+{
+    switch (nImpl)
+    {
+    case CRC8_IMPL_AUTO:    return "auto";
+    case CRC8_IMPL_BITWISE: return "bitwise";
+    case CRC8_IMPL_SLICE8:  return "slice8";
+    case CRC8_IMPL_CLMUL:   return "clmul";
+    default:                return "unknown";
+    }
+}
+
+TU8 CRC_CalCrc8(TU8 *pBuf, TU16 nLen, TU8 nPrev)
+{
+    ONCE_Run(&g_tCrc8Once, Crc8_Init);
+
+    return g_pCrc8Func(pBuf, nLen, nPrev);
+}
@@ -6,16 +6,21 @@ TBool TIMER_SetDelay_ms(Timer_t *timer, Counter_t delay)
 {
     if (delay > MAX_TIMER_DELAY_TICK) return TFalse;
     
-    timer->start = TIMER_GetNow();
-    timer->delay = delay;
-    timer->flag = 0;
+    TIMER_SetDelay_us(timer, (TU64)delay * 1000);
     
     return TTrue;
 }
 
+void  TIMER_SetDelay_us(Timer_t *timer, TU64 delay)
+{
+    timer->start = TIMER_GetNowUs();
+    timer->delay = delay;
+    timer->flag = 0;
+}
+
 void  TIMER_Start(Timer_t *timer)
 {
-    timer->start = TIMER_GetNow();
+    timer->start = TIMER_GetNowUs();
     
     timer->flag = 1;
 }
@@ -27,13 +32,9 @@ void  TIMER_Stop(Timer_t *timer)
 
 TBool TIMER_Elapsed(Timer_t *timer)
 {
-    Counter_t   nTar;
-    
     if (timer->flag == 0) return TFalse;
     
-    nTar = (Counter_t)(timer->start + timer->delay);
-    
-    return (TBool)((Counter_t)(TIMER_GetNow() - nTar) < (((TU32)1)<<30));
+    return (TBool)(TIMER_GetNowUs() - timer->start >= timer->delay);
 }
 
 TBool TIMER_isStarted(Timer_t *timer)
@@ -41,8 +42,24 @@ TBool TIMER_isStarted(Timer_t *timer)
     return (TBool)(timer->flag != 0);
 }
 
+TU64  TIMER_RemainingUs(Timer_t *timer)
+{
+    TU64 nPassed;
+    
+    if (timer->flag == 0) return timer->delay;
+    
+    nPassed = TIMER_GetNowUs() - timer->start;
+    
+    return (nPassed >= timer->delay) ? 0 : (timer->delay - nPassed);
+}
+
+Counter_t TIMER_Remaining(Timer_t *timer)
+{
+    return (Counter_t)((TIMER_RemainingUs(timer) + 999) / 1000);
+}
+
 void  TIMER_Delay(Counter_t nMs)
 {
-    Counter_t nStart = TIMER_GetNow();
-    while (((Counter_t)(TIMER_GetNow() - nStart)) < nMs);
-}
\ No newline at end of file
+    TU64 nStart = TIMER_GetNowUs();
+    while ((TIMER_GetNowUs() - nStart) < (TU64)nMs * 1000);
+}
@@ -1,5 +1,7 @@
 #include "hal.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <windows.h>
 
 #define _LOG_   printf
@@ -11,6 +13,23 @@ TU32 TIMER_GetNow(void)
     return (TU32)GetTickCount();
 }
 
+TU64 TIMER_GetNowUs(void)
+{
+    return TIMER_GetNowNs() / 1000;
+}
+
+TU64 TIMER_GetNowNs(void)
+{
+    static LARGE_INTEGER tFreq = {0};
+    LARGE_INTEGER tNow;
+
+    if (tFreq.QuadPart == 0) QueryPerformanceFrequency(&tFreq);
+    QueryPerformanceCounter(&tNow);
+
+    return (TU64)(tNow.QuadPart / tFreq.QuadPart) * 1000000000
+         + (TU64)(tNow.QuadPart % tFreq.QuadPart) * 1000000000 / tFreq.QuadPart;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Process control
 void UTIL_Sleep(TU32 nTmInMs)
@@ -29,11 +48,20 @@ void UTIL_Exit(void)
 #define UART_TXRX_BUF       (4096)
 
 UTIL_HANDLE UART_Init(const char *szName)
+{
+    return UART_InitEx(szName, NULL, NULL);
+}
+
+// The latency timer of USB adapters is a driver setting in the registry and
+// the read wakeup is polled, so no tuning applies here
+UTIL_HANDLE UART_InitEx(const char *szName, const UART_CONFIG *pCfg, TU32 *pApplied)
 {
     HANDLE  hComFile;
     DCB     commDCB;
     COMMTIMEOUTS    ComTmouts;
     
+    if (pApplied) *pApplied = 0;
+    
     if (szName == NULL) return INVALID_UTIL_HANDLE;
     
     hComFile = CreateFileA(szName, GENERIC_READ|GENERIC_WRITE, \
@@ -52,7 +80,7 @@ UTIL_HANDLE UART_Init(const char *szName)
         return INVALID_UTIL_HANDLE;
     }
     // set com parameter
-    commDCB.BaudRate = UART_BAUD_RATE;
+    commDCB.BaudRate = (pCfg && pCfg->nBaud) ? pCfg->nBaud : UART_BAUD_RATE;
     commDCB.ByteSize = 8;
     commDCB.Parity   = NOPARITY;  
     commDCB.StopBits = ONESTOPBIT;
@@ -122,6 +150,26 @@ TU32  UART_Write(UTIL_HANDLE nHandle, TU8 * pBuf, TU32 nLen)
     return (TU32)dwByteWritten;
 }
 
+TU32  UART_WriteV(UTIL_HANDLE nHandle, const UART_IOVEC * pVec, TU32 nVecCnt)
+{
+    TU32    i;
+    TU32    nTotal = 0;
+    TU32    nWritten;
+    
+    // No gathered write on a COM handle: send the fragments in turn, stop at a short write
+    for (i=0; i<nVecCnt; i++)
+    {
+        if (pVec[i].nLen == 0) continue;
+
+        nWritten = UART_Write(nHandle, pVec[i].pBuf, pVec[i].nLen);
+        nTotal += nWritten;
+        
+        if (nWritten < pVec[i].nLen) break;
+    }
+    
+    return nTotal;
+}
+
 TBool UART_GetIO(UTIL_HANDLE nHandle, TU32 nIO, TBool *pIsHigh)
 {
     DWORD   dwState;
@@ -150,6 +198,81 @@ void  UART_FlushRX(UTIL_HANDLE nHandle)
     PurgeComm((HANDLE)nHandle, PURGE_RXABORT | PURGE_RXCLEAR);
 }
 
+TBool UART_SetBaud(UTIL_HANDLE nHandle, TU32 nBaud)
+{
+    DCB     commDCB;
+
+    memset(&commDCB, 0, sizeof(DCB));
+    commDCB.DCBlength = sizeof(DCB);
+    if (!GetCommState((HANDLE)nHandle, &commDCB)) return TFalse;
+
+    // The driver decides which rates it takes
+    commDCB.BaudRate = nBaud;
+
+    return (TBool)(SetCommState((HANDLE)nHandle, &commDCB) != 0);
+}
+
+TU32  UART_GetBaud(UTIL_HANDLE nHandle)
+{
+    DCB     commDCB;
+
+    memset(&commDCB, 0, sizeof(DCB));
+    commDCB.DCBlength = sizeof(DCB);
+    if (!GetCommState((HANDLE)nHandle, &commDCB)) return 0;
+
+    return (TU32)commDCB.BaudRate;
+}
+
+TBool UART_SetWakeLen(UTIL_HANDLE nHandle, TU16 nLen)
+{
+    return TFalse;
+}
+
+TU32  UART_Wait(UTIL_HANDLE nHandle, TU32 nEvents, TU32 nTimeoutUs)
+{
+    return UART_WaitEx(nHandle, INVALID_UTIL_HANDLE, nEvents, nTimeoutUs);
+}
+
+// The port is opened for synchronous I/O, so the queues are polled. Between
+// polls it waits on the wakeup event, which ends the wait when set.
+TU32  UART_WaitEx(UTIL_HANDLE nHandle, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    COMSTAT tStat;
+    DWORD   dwErrors;
+    DWORD   dwStart = GetTickCount();
+    TU32    nReady;
+
+    while (TTrue)
+    {
+        if (!ClearCommError((HANDLE)nHandle, &dwErrors, &tStat)) return UART_EV_ERROR;
+
+        nReady = 0;
+        if ((nEvents & UART_EV_READ)  && tStat.cbInQue > 0) nReady |= UART_EV_READ;
+        if ((nEvents & UART_EV_WRITE) && tStat.cbOutQue < UART_TXRX_BUF) nReady |= UART_EV_WRITE;
+
+        if (nReady || (GetTickCount() - dwStart) * 1000 >= nTimeoutUs) return nReady;
+
+        if (hWake == INVALID_UTIL_HANDLE)
+        {
+            Sleep(1);
+        }
+        else if (WaitForSingleObject((HANDLE)hWake, 1) == WAIT_OBJECT_0)
+        {
+            return nReady | UART_EV_WAKE;
+        }
+    }
+}
+
+TBool UART_WaitReadable(UTIL_HANDLE nHandle, TU32 nTimeoutUs)
+{
+    return (TBool)((UART_Wait(nHandle, UART_EV_READ, nTimeoutUs) & UART_EV_READ) != 0);
+}
+
+TBool UART_WaitWritable(UTIL_HANDLE nHandle, TU32 nTimeoutUs)
+{
+    return (TBool)((UART_Wait(nHandle, UART_EV_WRITE, nTimeoutUs) & UART_EV_WRITE) != 0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // localize objects table, like thread, mutex, ...
 #define TAB_ALLOC(t)        ( TabAlloc((t), sizeof(t)/sizeof(t[0])) )
@@ -190,6 +313,29 @@ static TBool TabisEmpty(TU8 * pTab, TU32 nLen)
     return TTrue;
 }
 
+// The COM ports that have a DOS device name
+#define UART_MAX_COM_NUM    (255)
+
+TU32  UART_List(char szNames[][UART_MAX_NAME_LEN], TU32 nMax)
+{
+    char szDevice[16];
+    char szTarget[MAX_PATH];
+    TU32 nCount = 0;
+    TU32 i;
+
+    for (i=1; i<=UART_MAX_COM_NUM && nCount<nMax; i++)
+    {
+        sprintf(szDevice, "COM%lu", i);
+
+        if (QueryDosDeviceA(szDevice, szTarget, sizeof(szTarget)) != 0)
+        {
+            sprintf(szNames[nCount++], "\\\\.\\%s", szDevice);
+        }
+    }
+
+    return nCount;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Locker
 #define UTIL_MAX_LOCKER     (64)
@@ -257,21 +403,167 @@ void UTIL_DeleteLock(UTIL_HANDLE hLock)
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Mutex, condition and wakeup
+UTIL_HANDLE MUTEX_Create(void)
+{
+    CRITICAL_SECTION *pMutex = (CRITICAL_SECTION *)malloc(sizeof(CRITICAL_SECTION));
+
+    if (!pMutex) return INVALID_UTIL_HANDLE;
+
+    InitializeCriticalSection(pMutex);
+
+    return (UTIL_HANDLE)pMutex;
+}
+
+void  MUTEX_Lock(UTIL_HANDLE hMutex)
+{
+    EnterCriticalSection((CRITICAL_SECTION *)hMutex);
+}
+
+void  MUTEX_Unlock(UTIL_HANDLE hMutex)
+{
+    LeaveCriticalSection((CRITICAL_SECTION *)hMutex);
+}
+
+void  MUTEX_Delete(UTIL_HANDLE hMutex)
+{
+    if (hMutex == INVALID_UTIL_HANDLE) return;
+
+    DeleteCriticalSection((CRITICAL_SECTION *)hMutex);
+    free((CRITICAL_SECTION *)hMutex);
+}
+
+UTIL_HANDLE COND_Create(void)
+{
+    CONDITION_VARIABLE *pCond = (CONDITION_VARIABLE *)malloc(sizeof(CONDITION_VARIABLE));
+
+    if (!pCond) return INVALID_UTIL_HANDLE;
+
+    InitializeConditionVariable(pCond);
+
+    return (UTIL_HANDLE)pCond;
+}
+
+// The wait is in whole ms: a shorter one is rounded up
+TBool COND_Wait(UTIL_HANDLE hCond, UTIL_HANDLE hMutex, TU32 nTimeoutUs)
+{
+    return (TBool)SleepConditionVariableCS((CONDITION_VARIABLE *)hCond, (CRITICAL_SECTION *)hMutex,
+                                           (nTimeoutUs + 999) / 1000);
+}
+
+void  COND_Signal(UTIL_HANDLE hCond)
+{
+    WakeConditionVariable((CONDITION_VARIABLE *)hCond);
+}
+
+void  COND_Broadcast(UTIL_HANDLE hCond)
+{
+    WakeAllConditionVariable((CONDITION_VARIABLE *)hCond);
+}
+
+// A condition variable holds no resource
+void  COND_Delete(UTIL_HANDLE hCond)
+{
+    if (hCond != INVALID_UTIL_HANDLE) free((CONDITION_VARIABLE *)hCond);
+}
+
+UTIL_HANDLE WAKE_Create(void)
+{
+    HANDLE hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    return (hEvent == NULL) ? INVALID_UTIL_HANDLE : (UTIL_HANDLE)hEvent;
+}
+
+void  WAKE_Set(UTIL_HANDLE hWake)
+{
+    SetEvent((HANDLE)hWake);
+}
+
+void  WAKE_Clear(UTIL_HANDLE hWake)
+{
+    ResetEvent((HANDLE)hWake);
+}
+
+TBool WAKE_Wait(UTIL_HANDLE hWake, TU32 nTimeoutUs)
+{
+    DWORD dwMs = (DWORD)((nTimeoutUs + 999) / 1000);
+
+    if (hWake == INVALID_UTIL_HANDLE)
+    {
+        Sleep(dwMs);
+        return TFalse;
+    }
+
+    return (TBool)(WaitForSingleObject((HANDLE)hWake, dwMs) == WAIT_OBJECT_0);
+}
+
+void  WAKE_Delete(UTIL_HANDLE hWake)
+{
+    if (hWake != INVALID_UTIL_HANDLE) CloseHandle((HANDLE)hWake);
+}
+
+static SRWLOCK g_tOnceLock = SRWLOCK_INIT;
+
+void  ONCE_Run(UTIL_ONCE *pOnce, void (*pFunc)(void))
+{
+    // Seen done, what pFunc wrote is seen too
+    if (InterlockedCompareExchange(pOnce, 0, 0)) return;
+
+    AcquireSRWLockExclusive(&g_tOnceLock);
+
+    if (!*pOnce)
+    {
+        pFunc();
+        InterlockedExchange(pOnce, 1);
+    }
+
+    ReleaseSRWLockExclusive(&g_tOnceLock);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Thread
 UTIL_HANDLE THREAD_Create(UTIL_CB_FUNC pCbFunc, void * pParam)
+{
+    return THREAD_CreateEx(pCbFunc, pParam, NULL, NULL);
+}
+
+// The real-time policies map to the top priorities of the process class.
+// Thread names need a newer API than this project targets.
+UTIL_HANDLE THREAD_CreateEx(UTIL_CB_FUNC pCbFunc, void * pParam, const THREAD_CONFIG * pCfg, TU32 * pApplied)
 {
     HANDLE hThread = NULL;
     DWORD  dwThreadId = 0;
+    TU32   nApplied = 0;
+    int    nPriority;
+    
+    if (pApplied) *pApplied = 0;
     
     hThread = CreateThread(
         NULL,                   // default security attributes
-        0,                      // use default stack size
+        pCfg ? pCfg->nStackSize : 0,                // 0: default stack size
         (LPTHREAD_START_ROUTINE)pCbFunc,            // thread function name
         pParam,                 // argument to thread function
-        0,                      // use default creation flags
+        CREATE_SUSPENDED,       // settings first
         &dwThreadId);           // returns the thread identifier
     
+    if (hThread == NULL) return INVALID_UTIL_HANDLE;
+    
+    if (pCfg && pCfg->nPolicy != THREAD_SCHED_NORMAL)
+    {
+        nPriority = (pCfg->nPriority >= 50) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+        if (SetThreadPriority(hThread, nPriority)) nApplied |= THREAD_SET_SCHED;
+    }
+    
+    if (pCfg && pCfg->nCpuMask != 0)
+    {
+        if (SetThreadAffinityMask(hThread, (DWORD_PTR)pCfg->nCpuMask) != 0) nApplied |= THREAD_SET_AFFINITY;
+    }
+    
+    ResumeThread(hThread);
+    
+    if (pApplied) *pApplied = nApplied;
+    
     return (TU32)hThread;
 }
 
@@ -289,6 +581,87 @@ void  THREAD_Terminate(UTIL_HANDLE nHandle)
     TerminateThread((HANDLE)nHandle, 0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// UART input line events
+// The port is opened for synchronous I/O: a WaitCommEvent pending on it
+// would hold up every read and write, so the lines are not watched.
+UTIL_HANDLE UART_WatchIO(UTIL_HANDLE nHandle, TU32 nIO, UART_IO_CB pCbFunc, void *pParam, const THREAD_CONFIG *pCfg)
+{
+    return INVALID_UTIL_HANDLE;
+}
+
+void  UART_UnwatchIO(UTIL_HANDLE hWatch)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Device node watch
+// COM ports are polled through their DOS device name, e.g. COM3 for \\.\COM3
+#define DEV_POLL_MS         (10)
+
+typedef struct {
+    char  szDevice[64];
+    TBool bPresent;
+} TDevWatch;
+
+static TBool DEV_Check(TDevWatch *pWatch)
+{
+    char szTarget[MAX_PATH];
+
+    return (TBool)(QueryDosDeviceA(pWatch->szDevice, szTarget, sizeof(szTarget)) != 0);
+}
+
+UTIL_HANDLE DEV_Watch(const char *szName)
+{
+    TDevWatch *pWatch;
+
+    if (!szName) return INVALID_UTIL_HANDLE;
+
+    if (strncmp(szName, "\\\\.\\", 4) == 0) szName += 4;
+    if (strlen(szName) >= sizeof(pWatch->szDevice)) return INVALID_UTIL_HANDLE;
+
+    pWatch = (TDevWatch *)calloc(1, sizeof(TDevWatch));
+    if (!pWatch) return INVALID_UTIL_HANDLE;
+
+    strcpy(pWatch->szDevice, szName);
+    pWatch->bPresent = DEV_Check(pWatch);
+
+    return (UTIL_HANDLE)pWatch;
+}
+
+// A removal shorter than the poll period is not seen
+TU32  DEV_Wait(UTIL_HANDLE hWatch, TU32 nTimeoutUs)
+{
+    TDevWatch *pWatch = (TDevWatch *)hWatch;
+    DWORD dwStart = GetTickCount();
+    TBool bPresent;
+
+    while (TTrue)
+    {
+        bPresent = DEV_Check(pWatch);
+
+        if (bPresent != pWatch->bPresent)
+        {
+            pWatch->bPresent = bPresent;
+            return bPresent ? DEV_EV_ADDED : DEV_EV_REMOVED;
+        }
+
+        if ((GetTickCount() - dwStart) * 1000 >= nTimeoutUs) return 0;
+
+        Sleep(DEV_POLL_MS);
+    }
+}
+
+TBool DEV_IsPresent(UTIL_HANDLE hWatch)
+{
+    return ((TDevWatch *)hWatch)->bPresent;
+}
+
+void  DEV_Unwatch(UTIL_HANDLE hWatch)
+{
+    if (hWatch != INVALID_UTIL_HANDLE) free((TDevWatch *)hWatch);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Socket
 #pragma comment(lib, "wsock32.lib")
@@ -296,12 +669,14 @@ void  THREAD_Terminate(UTIL_HANDLE nHandle)
 typedef struct {
     int                 is_inited;
     int                 is_svr;
+    int                 type;       // SOCK_STREAM or SOCK_DGRAM
     struct sockaddr_in  addr;
+    struct sockaddr_in  peer;       // UDP server: sender of the last datagram
     SOCKET              fd_listen;
     SOCKET              fd_conn;
 }TSockVar;
 
-#define UTIL_MAX_SOCKET     (4)
+#define UTIL_MAX_SOCKET     (64)        // as many as the other tables, one per port or bridge
 #define SOCK_TIMEOUT        (0)
 #define SOCK_WELL_CLOSED    (-1)
 #define SOCK_ERROR_OCCUR    (-2)
@@ -341,16 +716,109 @@ static TSockVar * SOCK_GetVar(UTIL_HANDLE hSock)
     return &g_tSocketHandleTab[hSock];
 }
 
-static int SOCK_SvrOpen(TSockVar * pVar)
+// A UDP server answers the sender of the last datagram
+static int SOCK_RecvFrom(TSockVar * pVar, char * pBuf, int nLen)
+{
+    int nPeerLen = sizeof(pVar->peer);
+    
+    if (pVar->is_svr && pVar->type == SOCK_DGRAM)
+    {
+        return recvfrom(pVar->fd_conn, pBuf, nLen, 0, (struct sockaddr*)&pVar->peer, &nPeerLen);
+    }
+    
+    return recv(pVar->fd_conn, pBuf, nLen, 0);
+}
+
+static int SOCK_SendTo(TSockVar * pVar, const char * pBuf, int nLen)
+{
+    if (pVar->is_svr && pVar->type == SOCK_DGRAM)
+    {
+        return sendto(pVar->fd_conn, pBuf, nLen, 0, (struct sockaddr*)&pVar->peer, sizeof(pVar->peer));
+    }
+    
+    return send(pVar->fd_conn, pBuf, nLen, 0);
+}
+
+// Buffer sizes go on the socket before connect() or listen(): TCP picks its
+// window scale from them in the handshake, and accepted sockets inherit them
+static TU32 SOCK_TuneBuf(SOCKET fd, const SOCK_CONFIG *pCfg)
+{
+    int nRx, nTx;
+
+    if (!pCfg || !(pCfg->nTunings & SOCK_TUNE_BUF_SIZE)) return 0;
+
+    nRx = (int)pCfg->nRxBufSize;
+    nTx = (int)pCfg->nTxBufSize;
+
+    if ((nRx == 0 || setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char *)&nRx, sizeof(nRx)) == 0)
+     && (nTx == 0 || setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char *)&nTx, sizeof(nTx)) == 0))
+    {
+        return SOCK_TUNE_BUF_SIZE;
+    }
+
+    return 0;
+}
+
+// Per connection, once it is up
+static TU32 SOCK_TuneConn(TSockVar * pVar, const SOCK_CONFIG *pCfg)
+{
+    BOOL bOn = TRUE;
+
+    if (pCfg && (pCfg->nTunings & SOCK_TUNE_NODELAY) && pVar->type == SOCK_STREAM
+     && setsockopt(pVar->fd_conn, IPPROTO_TCP, TCP_NODELAY, (const char *)&bOn, sizeof(bOn)) == 0)
+    {
+        return SOCK_TUNE_NODELAY;
+    }
+
+    return 0;
+}
+
+// UDP has no accept: the peer is the sender of the first datagram, then
+// of the last one, so that a client may come back from another port
+static int SOCK_SvrOpenUdp(TSockVar * pVar)
+{
+    u_long blocking = 1;
+    int nPeerLen = sizeof(pVar->peer);
+    char c;
+
+    pVar->fd_conn = pVar->fd_listen;
+    pVar->fd_listen = INVALID_SOCKET;
+
+    _LOG_("SOCK_SVR: waiting for a datagram on port (%d) ...\n", ntohs(pVar->addr.sin_port));
+
+    // WSAEMSGSIZE only says the datagram is longer than the peeked byte
+    if (recvfrom(pVar->fd_conn, &c, 1, MSG_PEEK, (struct sockaddr*)&pVar->peer, &nPeerLen) == SOCKET_ERROR
+     && WSAGetLastError() != WSAEMSGSIZE)
+    {
+        _LOG_("udp peer error: %d \n", WSAGetLastError());
+        return -1;
+    }
+
+    if (ioctlsocket(pVar->fd_conn, FIONBIO, &blocking) == SOCKET_ERROR)
+    {
+        _LOG_("set non-block socket failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int SOCK_SvrOpen(TSockVar * pVar, const SOCK_CONFIG *pCfg, TU32 *pApplied)
 { 
     u_long blocking = 1;
+    BOOL   bOn = TRUE;
     // create socket
-    if ( (pVar->fd_listen = socket(AF_INET, SOCK_STREAM, 0)) == -1 )
+    if ( (pVar->fd_listen = socket(AF_INET, pVar->type, 0)) == -1 )
     {
         _LOG_("create socket error: %s (errno: %d) \n", strerror(errno), errno);
         return -1;
     }
     
+    *pApplied |= SOCK_TuneBuf(pVar->fd_listen, pCfg);
+
+    // a restarted server gets its port back at once
+    setsockopt(pVar->fd_listen, SOL_SOCKET, SO_REUSEADDR, (const char *)&bOn, sizeof(bOn));
+    
     // bind
     if ( bind(pVar->fd_listen, (struct sockaddr*)&pVar->addr, sizeof(pVar->addr)) == -1 )
     {
@@ -358,6 +826,8 @@ static int SOCK_SvrOpen(TSockVar * pVar)
         return -1;
     }
     
+    if (pVar->type == SOCK_DGRAM) return SOCK_SvrOpenUdp(pVar);
+    
     // listen
     if ( listen(pVar->fd_listen, 10) == -1 )
     {
@@ -386,18 +856,20 @@ static int SOCK_SvrOpen(TSockVar * pVar)
     return 0;
 }
 
-static int SOCK_CltOpen(TSockVar * pVar)
+static int SOCK_CltOpen(TSockVar * pVar, const SOCK_CONFIG *pCfg, TU32 *pApplied)
 {
     u_long blocking = 1;
     
     _LOG_("\nConnecting sock to <%s : %d> ... ", inet_ntoa(pVar->addr.sin_addr), ntohs(pVar->addr.sin_port));    
     
     // create socket
-    if ( (pVar->fd_conn = socket(AF_INET, SOCK_STREAM, 0))  == -1 )
+    if ( (pVar->fd_conn = socket(AF_INET, pVar->type, 0))  == -1 )
     {
         _LOG_("create socket error: %s (errno: %d) \n", strerror(errno), errno);
         return -1;
     }   
+    *pApplied |= SOCK_TuneBuf(pVar->fd_conn, pCfg);
+
     // connect
     if ( connect(pVar->fd_conn, (struct sockaddr*)&pVar->addr, sizeof(pVar->addr)) < 0 )
     {
@@ -416,11 +888,19 @@ static int SOCK_CltOpen(TSockVar * pVar)
 }
 
 UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
+{
+    return SOCK_OpenEx(nAddr, nPort, NULL, NULL);
+}
+
+UTIL_HANDLE SOCK_OpenEx(TU32 nAddr, TU16 nPort, const SOCK_CONFIG *pCfg, TU32 *pApplied)
 {
     int     ret = -1;
     TU32    idx;
+    TU32    nApplied = 0;
     TSockVar    * pVar;
     
+    if (pApplied) *pApplied = 0;
+    
     if (!g_bSocketTabInited) SocketTabInit();
     
     idx = TAB_ALLOC(g_tSocketAllocTab);
@@ -433,6 +913,7 @@ UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
     
     // copy the configurations
     pVar->is_svr = (nAddr == 0) ? 1 : 0;
+    pVar->type = (pCfg && pCfg->nType == SOCK_TYPE_UDP) ? SOCK_DGRAM : SOCK_STREAM;
     
     memset(&pVar->addr, 0, sizeof(struct sockaddr_in));
     pVar->addr.sin_family = AF_INET;
@@ -449,7 +930,7 @@ UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
     pVar->fd_listen = -1;
     pVar->fd_conn = -1;
     
-    ret = (pVar->is_svr ? SOCK_SvrOpen(pVar) : SOCK_CltOpen(pVar));
+    ret = (pVar->is_svr ? SOCK_SvrOpen(pVar, pCfg, &nApplied) : SOCK_CltOpen(pVar, pCfg, &nApplied));
     if (ret < 0)
     {
         SOCK_Close(idx);
@@ -458,9 +939,34 @@ UTIL_HANDLE SOCK_Open(TU32 nAddr, TU16 nPort)
     
     pVar->is_inited = 1;
     
+    nApplied |= SOCK_TuneConn(pVar, pCfg);
+    if (pApplied) *pApplied = nApplied;
+    
     return (UTIL_HANDLE)idx;
 }
 
+TBool SOCK_Resolve(const char *szHost, TU32 *pAddr)
+{
+    struct hostent * pHost;
+    unsigned long    nAddr;
+    
+    if (!g_bSocketTabInited) SocketTabInit();
+    
+    nAddr = inet_addr(szHost);
+    if (nAddr != INADDR_NONE)
+    {
+        *pAddr = ntohl(nAddr);
+        return TTrue;
+    }
+    
+    pHost = gethostbyname(szHost);
+    if (pHost == NULL || pHost->h_addrtype != AF_INET) return TFalse;
+    
+    *pAddr = ntohl(*(unsigned long *)pHost->h_addr_list[0]);
+    
+    return TTrue;
+}
+
 TS32  SOCK_GetRxBufLen(UTIL_HANDLE hSock)
 {
     TSockVar    * pVar = SOCK_GetVar(hSock);
@@ -500,7 +1006,7 @@ TS32  SOCK_Read(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen, TU32 nTmout)
     else if ( nRet > 0 && FD_ISSET(pVar->fd_conn, &read_fd))
     {
         // start receive
-        nRet = recv(pVar->fd_conn, (char *)pBuf, nBufLen, 0);
+        nRet = SOCK_RecvFrom(pVar, (char *)pBuf, nBufLen);
         
         if (nRet > 0) return nRet;
         else if (nRet == 0) return SOCK_WELL_CLOSED;
@@ -528,7 +1034,7 @@ TS32  SOCK_Write(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen)
     
     while (nSent < nBufLen)
     {
-        nRet = send(pVar->fd_conn, (char *)(pBuf + nSent), nBufLen - nSent, 0);
+        nRet = SOCK_SendTo(pVar, (char *)(pBuf + nSent), nBufLen - nSent);
         
         if (nRet == SOCKET_ERROR)
         {
@@ -553,6 +1059,58 @@ TS32  SOCK_Write(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen)
     return nBufLen;
 }
 
+TS32  SOCK_Send(UTIL_HANDLE hSock, TU8 * pBuf, TS32 nBufLen)
+{
+    int         nRet;
+    TSockVar  * pVar = SOCK_GetVar(hSock);
+    
+    if (pVar == NULL) return SOCK_ERROR_OCCUR;
+    
+    nRet = SOCK_SendTo(pVar, (char *)pBuf, nBufLen);
+    if (nRet != SOCKET_ERROR) return nRet;
+    
+    return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : SOCK_ERROR_OCCUR;
+}
+
+// select() cannot wait on an event, so the wake is looked at between slices
+TU32  SOCK_Wait(UTIL_HANDLE hSock, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    TSockVar  * pVar = SOCK_GetVar(hSock);
+    TU64        nStart = TIMER_GetNowUs(), nElapsed;
+    TU32        nSlice, nReady;
+    fd_set      tRd, tWr, tEx;
+    struct timeval tTmout;
+    
+    if (pVar == NULL) return UART_EV_ERROR;
+    
+    while (TTrue)
+    {
+        FD_ZERO(&tRd);
+        FD_ZERO(&tWr);
+        FD_ZERO(&tEx);
+        if (nEvents & UART_EV_READ)  FD_SET(pVar->fd_conn, &tRd);
+        if (nEvents & UART_EV_WRITE) FD_SET(pVar->fd_conn, &tWr);
+        FD_SET(pVar->fd_conn, &tEx);
+        
+        nElapsed = TIMER_GetNowUs() - nStart;
+        nSlice   = (nElapsed >= nTimeoutUs) ? 0 : (TU32)(nTimeoutUs - nElapsed);
+        if (nSlice > 1000) nSlice = 1000;
+        tTmout.tv_sec  = 0;
+        tTmout.tv_usec = nSlice;
+        
+        if (select(0, &tRd, &tWr, &tEx, &tTmout) == SOCKET_ERROR) return UART_EV_ERROR;
+        
+        nReady = 0;
+        if (FD_ISSET(pVar->fd_conn, &tRd)) nReady |= UART_EV_READ;
+        if (FD_ISSET(pVar->fd_conn, &tWr)) nReady |= UART_EV_WRITE;
+        if (FD_ISSET(pVar->fd_conn, &tEx)) nReady |= UART_EV_ERROR;
+        
+        if (hWake != INVALID_UTIL_HANDLE && WaitForSingleObject((HANDLE)hWake, 0) == WAIT_OBJECT_0) nReady |= UART_EV_WAKE;
+        
+        if (nReady || TIMER_GetNowUs() - nStart >= nTimeoutUs) return nReady;
+    }
+}
+
 void  SOCK_Close(UTIL_HANDLE hSock)
 {
     TSockVar    * pVar;
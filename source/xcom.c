@@ -3,8 +3,10 @@
 #include "xcom_port.h"
 #include <string.h>
 
-// Config the max payload len 
-#define CFG_MAX_PAYLOAD_LEN     (2100)
+#if defined(__SSE2__) && defined(__GNUC__)
+#define XCOM_HAS_SSE2
+#include <emmintrin.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Message: SYNC | VER | ID | CMD | LEN LSB | LEN MSB | PAYLOAD[LENGTH] | CRC8
@@ -21,18 +23,19 @@
 #define MSG_CHAR_SYNC       (0xA5)
 #define MSG_CHAR_VER        (0x04)
 
-#define MAX_PAYLOAD_LEN     (CFG_MAX_PAYLOAD_LEN)
-#define MAX_MSG_LEN         (MSG_HEADER_LEN + MAX_PAYLOAD_LEN + MSG_CRC_LEN)
+// Bits on the wire per byte: start + 8 data + stop
+#define UART_BITS_PER_BYTE  (10)
 
-////////////////////////////////////////////////////////////////////////////////
-static XCOM_RECV_CB g_xcom_recv_msg_cb = NULL;
+#define MAX_PAYLOAD_LEN     (XCOM_MAX_PAYLOAD_LEN)
+#define MAX_MSG_LEN         (XCOM_MAX_MSG_LEN)
 
-static TBool g_bTxBusy = TFalse;
-static TU16  g_nCurTx = 0;
-static TU16  g_nCurRx = 0;
+// RX ring: bytes are pulled from the port in bulk and frames are parsed in
+// place. The write index always leaves room for a whole message, so every
+// frame stays contiguous and can be handed to the callback without a copy.
+#define RX_RING_SIZE        (XCOM_RX_RING_SIZE)
 
-static TU8   g_cTxBuf[MAX_MSG_LEN] = {0};
-static TU8   g_cRxBuf[MAX_MSG_LEN] = {0};
+// TX queue: encoded messages waiting to be sent, in order
+#define TX_QUEUE_LEN        (XCOM_TX_QUEUE_LEN)
 
 ////////////////////////////////////////////////////////////////////////////////
 static TBool CheckHeader(TU8 *pBuf, TU16 nLen)
@@ -63,136 +66,360 @@ static TBool CheckCrc8(TU8 *pBuf, TU16 nLen)
     return (TBool)(pBuf[nLen-1] == CRC_CalCrc8(pBuf, (TU16)(nLen-1), 0));
 }
 
-static void xcom_rx_fsm(void)
+// Return the offset of the first SYNC+VER pair in the buffer, or of a SYNC in
+// the last byte which may still start one, or nLen if there is no candidate
+static TU16 FindSync(const TU8 *pBuf, TU16 nLen)
 {
-    TU16 nRx = 0;
+    TU16 i = 0;
+    const TU8 *p;
+#ifdef XCOM_HAS_SSE2
+    const __m128i tSync = _mm_set1_epi8((char)MSG_CHAR_SYNC);
+    const __m128i tVer  = _mm_set1_epi8((char)MSG_CHAR_VER);
+    int nMask;
+
+    // Match SYNC at i and VER at i+1 for 16 positions at once
+    for (; i + 16 < nLen; i += 16)
+    {
+        nMask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pBuf + i)), tSync),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pBuf + i + 1)), tVer)));
+
+        if (nMask) return (TU16)(i + __builtin_ctz(nMask));
+    }
+#endif
+
+    while (i < nLen)
+    {
+        p = (const TU8 *)memchr(pBuf + i, MSG_CHAR_SYNC, nLen - i);
+        if (!p) return nLen;
+
+        i = (TU16)(p - pBuf);
+        if (i + 1 == nLen || pBuf[i+1] == MSG_CHAR_VER) return i;
+
+        i++;
+    }
+
+    return nLen;
+}
+
+static void xcom_rx_parse(TXcomCtx *pCtx)
+{
+    TU8 *pMsg;
     TU16 nLenInHeader = 0;
-    TU16 nRxExpected  = 0;
-    
-    if (g_nCurRx < MSG_HEADER_LEN)
+    TU16 nMsgLen = 0;
+    TU16 nSkip = 0;
+
+    // Parse every complete message buffered in the ring
+    while (pCtx->nRxWr - pCtx->nRxRd >= MSG_HEADER_LEN)
     {
-        // Receive the header
-        nRx = xcom_port_recv(&g_cRxBuf[g_nCurRx], (TU16)(MSG_HEADER_LEN-g_nCurRx));
-        
-        g_nCurRx += nRx;
-        
-        if (g_nCurRx == MSG_HEADER_LEN)
+        pMsg = &pCtx->cRxRing[pCtx->nRxRd];
+
+        if (!CheckHeader(pMsg, MSG_HEADER_LEN))
         {
-            if (!CheckHeader(g_cRxBuf, MSG_HEADER_LEN))
+            // If the header is wrong, jump to the next SYNC+VER candidate and
+            // check it, instead of stepping a single byte at a time
+            nSkip = (TU16)(1 + FindSync(pMsg + 1, (TU16)(pCtx->nRxWr - pCtx->nRxRd - 1)));
+
+            pCtx->tStats.nRxHeaderRejects++;
+            pCtx->tStats.nRxSkipBytes += nSkip;
+
+            pCtx->nRxRd = (TU16)(pCtx->nRxRd + nSkip);
+            continue;
+        }
+
+        nLenInHeader = UTIL_DEC_TU16_LSBF(&pMsg[MSG_OFFSET_LEN]);
+        nMsgLen      = (TU16)(nLenInHeader + MSG_HEADER_LEN + MSG_CRC_LEN);
+
+        // Wait for the rest bytes of the message, including PAYLOAD and CRC8
+        if (pCtx->nRxWr - pCtx->nRxRd < nMsgLen) break;
+
+        if (CheckCrc8(pMsg, nMsgLen))
+        {
+            pCtx->tStats.nRxFrames++;
+
+            // Callback to notifier the caller, the payload is still in the ring
+            if (pCtx->pRecvCb)
             {
-                // If the header is wrong, remove the first byte, then check again
-                g_nCurRx--;
-                memmove(g_cRxBuf, g_cRxBuf+1, g_nCurRx);
+                pCtx->pRecvCb(pCtx->pRecvParam,
+                              pMsg[MSG_OFFSET_ID], 
+                              pMsg[MSG_OFFSET_CMD], 
+                              &pMsg[MSG_OFFSET_PAYLOAD], 
+                              nLenInHeader);
             }
+
+            pCtx->nRxRd = (TU16)(pCtx->nRxRd + nMsgLen);
+        }
+        else
+        {
+            // CRC not correct: the header may be a false SYNC inside noise or
+            // a broken frame, so resync right after it rather than dropping
+            // LEN bytes which may hold the next good frames
+            pCtx->tStats.nRxCrcErrors++;
+            pCtx->tStats.nRxSkipBytes++;
+
+            pCtx->nRxRd++;
         }
     }
-    else
+
+    // Ring drained: rewind for free
+    if (pCtx->nRxRd == pCtx->nRxWr)
+    {
+        pCtx->nRxRd = 0;
+        pCtx->nRxWr = 0;
+    }
+}
+
+// Bytes the parser needs before it can make progress: the rest of the frame
+// whose header is in, else enough for the shortest frame. Never more, so a
+// reader woken on this count cannot sleep past a frame.
+static TU16 xcom_rx_need(TXcomCtx *pCtx)
+{
+    TU16 nHave = (TU16)(pCtx->nRxWr - pCtx->nRxRd);
+    TU16 nMsgLen = MSG_HEADER_LEN + MSG_CRC_LEN;
+
+    if (CheckHeader(&pCtx->cRxRing[pCtx->nRxRd], nHave))
+    {
+        nMsgLen = (TU16)(UTIL_DEC_TU16_LSBF(&pCtx->cRxRing[pCtx->nRxRd + MSG_OFFSET_LEN]) + MSG_HEADER_LEN + MSG_CRC_LEN);
+    }
+
+    if (nHave >= nMsgLen) return 1;
+
+    return (TU16)UTIL_MIN(nMsgLen - nHave, TU8_MAX);
+}
+
+static void xcom_rx_fsm(TXcomCtx *pCtx)
+{
+    TU16 nRx = 0;
+    TU16 nFree = 0;
+
+    do
     {
-        nLenInHeader = UTIL_DEC_TU16_LSBF(&g_cRxBuf[MSG_OFFSET_LEN]);
-        nRxExpected  = (TU16)(nLenInHeader + MSG_HEADER_LEN + MSG_CRC_LEN);
-        
-        // Receive all rest bytes of the message, including PAYLOAD and CRC8
-        nRx = xcom_port_recv(&g_cRxBuf[g_nCurRx], (TU16)(nRxExpected-g_nCurRx));
-        
-        g_nCurRx += nRx;
-        
-        // The whole message has been received
-        if (g_nCurRx == nRxExpected)
+        // Keep room for a whole message behind the write index
+        if (RX_RING_SIZE - pCtx->nRxWr < MAX_MSG_LEN)
         {
-            if (CheckCrc8(g_cRxBuf, g_nCurRx) && g_xcom_recv_msg_cb)  ////==============g_cRxBuf??
-            {
-                // Callback to notifier the caller
-                g_xcom_recv_msg_cb(g_cRxBuf[MSG_OFFSET_ID], 
-                                   g_cRxBuf[MSG_OFFSET_CMD], 
-                                   &g_cRxBuf[MSG_OFFSET_PAYLOAD], 
-                                   nLenInHeader);
-            }
-            else
-            {
-                // Just discard the message, if CRC not correct!
-            }
-            
-            // Clear the receive buffer, for the next frame
-            g_nCurRx = 0;
+            memmove(pCtx->cRxRing, &pCtx->cRxRing[pCtx->nRxRd], pCtx->nRxWr - pCtx->nRxRd);
+            pCtx->tStats.nRxCopyBytes += pCtx->nRxWr - pCtx->nRxRd;
+
+            pCtx->nRxWr = (TU16)(pCtx->nRxWr - pCtx->nRxRd);
+            pCtx->nRxRd = 0;
         }
-    }
+
+        // Pull everything the driver has, up to the free space
+        nFree = (TU16)(RX_RING_SIZE - pCtx->nRxWr);
+        nRx   = xcom_port_recv(pCtx->pPort, &pCtx->cRxRing[pCtx->nRxWr], nFree);
+
+        pCtx->tStats.nRxCalls++;
+
+        if (nRx == 0) break;
+
+        pCtx->nRxTimeUs = TIMER_GetNowUs();
+        pCtx->tStats.nRxBytes += nRx;
+        pCtx->nRxWr = (TU16)(pCtx->nRxWr + nRx);
+
+        xcom_rx_parse(pCtx);
+
+    // The ring was filled up: the driver may hold more
+    } while (nRx == nFree);
 }
 
-static void xcom_tx_fsm(void)
+static void xcom_tx_fsm(TXcomCtx *pCtx)
 {
+    TU8 *pMsg = NULL;
     TU16 nLenInHeader = 0;
     TU16 nTxExpected  = 0;
     TU16 nTx = 0;
 
-    // No message in the buffer to be sent
-    if (!g_bTxBusy) return;
-    
-    nLenInHeader = UTIL_DEC_TU16_LSBF(&g_cTxBuf[MSG_OFFSET_LEN]);
-    nTxExpected  = (TU16)(nLenInHeader + MSG_HEADER_LEN + MSG_CRC_LEN);
-    
-    // Try to send the message
-    nTx = xcom_port_send(&g_cTxBuf[g_nCurTx], (TU16)(nTxExpected-g_nCurTx));
+    // Send the queued messages back to back, until the port is full
+    while (pCtx->nTxCount > 0)
+    {
+        pMsg = pCtx->cTxQueue[pCtx->nTxHead];
 
-    g_nCurTx += nTx;
+        nLenInHeader = UTIL_DEC_TU16_LSBF(&pMsg[MSG_OFFSET_LEN]);
+        nTxExpected  = (TU16)(nLenInHeader + MSG_HEADER_LEN + MSG_CRC_LEN);
 
-    // The whole message has been sent
-    if (g_nCurTx == nTxExpected)
-    {
-        // Clear the send buffer, for the next frame
-        g_nCurTx  = 0;
+        // Try to send the message
+        nTx = xcom_port_send(pCtx->pPort, &pMsg[pCtx->nCurTx], (TU16)(nTxExpected-pCtx->nCurTx));
+
+        pCtx->nCurTx += nTx;
+        pCtx->tStats.nTxBytes += nTx;
+
+        // Port busy: go on with the rest in next call
+        if (pCtx->nCurTx < nTxExpected) break;
 
-        // Reset the TX buffer flag 
-        g_bTxBusy = TFalse;
+        // The whole message has been sent, release the queue slot
+        pCtx->nCurTx   = 0;
+        pCtx->nTxHead  = (TU8)((pCtx->nTxHead + 1) % TX_QUEUE_LEN);
+        pCtx->nTxCount--;
+        pCtx->tStats.nTxFrames++;
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TBool xcom_init(XCOM_RECV_CB pCbFunc)
+TBool xcom_init(TXcomCtx *pCtx, TXcomPortCtx *pPort, XCOM_RECV_CB pCbFunc, void *pCbParam)
 {
-    g_xcom_recv_msg_cb = pCbFunc;
+    if (!pCtx || !pPort) return TFalse;
+
+    pCtx->pPort = pPort;
+    pCtx->pRecvCb = pCbFunc;
+    pCtx->pRecvParam = pCbParam;
+    pCtx->nBaud = XCOM_DEF_BAUD;
     
-    g_bTxBusy = TFalse;
-    g_nCurTx = 0;
-    g_nCurRx = 0;
+    pCtx->nTxHead = 0;
+    pCtx->nTxCount = 0;
+    pCtx->nCurTx = 0;
+    pCtx->nRxRd = 0;
+    pCtx->nRxWr = 0;
+    pCtx->nWakeLen = 0;
+    pCtx->hWake = INVALID_UTIL_HANDLE;
+    pCtx->nRxTimeUs = 0;
 
-    memset(g_cTxBuf, 0, MAX_MSG_LEN);
-    memset(g_cRxBuf, 0, MAX_MSG_LEN);
+    xcom_reset_stats(pCtx);
 
     return TTrue;
 }
 
-TBool xcom_send(TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
+TBool xcom_send(TXcomCtx *pCtx, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen)
 {
-    if (nLen > MAX_PAYLOAD_LEN) return TFalse;
+    TU8  cHeader[MSG_HEADER_LEN];
+    TU8  nCrc;
+    TU8 *pMsg = NULL;
+    TU16 nTx = 0;
+    UART_IOVEC tVec[3];
+
+    if (nLen > MAX_PAYLOAD_LEN || (nLen > 0 && !pBuf)) return TFalse;
     
-    // Send failed if the TX is ongoing
-    if (g_bTxBusy) return TFalse;
-
-    // Add the message header
-    g_cTxBuf[MSG_OFFSET_SYNC]   = MSG_CHAR_SYNC;
-    g_cTxBuf[MSG_OFFSET_VER]    = MSG_CHAR_VER;
-    g_cTxBuf[MSG_OFFSET_ID]     = nId;
-    g_cTxBuf[MSG_OFFSET_CMD]    = nCmd;
-    g_cTxBuf[MSG_OFFSET_LEN]    = (TU8)((nLen     ) & 0xFF);
-    g_cTxBuf[MSG_OFFSET_LEN+1]  = (TU8)((nLen >> 8) & 0xFF);
- 
-    // Copy the payload to the send buffer
-    if (pBuf && nLen > 0)
+    // Send failed if the TX queue is full
+    if (pCtx->nTxCount == TX_QUEUE_LEN) return TFalse;
+
+    // Build the message header and the CRC apart from the payload
+    cHeader[MSG_OFFSET_SYNC]   = MSG_CHAR_SYNC;
+    cHeader[MSG_OFFSET_VER]    = MSG_CHAR_VER;
+    cHeader[MSG_OFFSET_ID]     = nId;
+    cHeader[MSG_OFFSET_CMD]    = nCmd;
+    cHeader[MSG_OFFSET_LEN]    = (TU8)((nLen     ) & 0xFF);
+    cHeader[MSG_OFFSET_LEN+1]  = (TU8)((nLen >> 8) & 0xFF);
+
+    nCrc = CRC_CalCrc8(cHeader, MSG_HEADER_LEN, 0);
+    nCrc = CRC_CalCrc8(pBuf, nLen, nCrc);
+
+    // Nothing queued before: send header, payload and CRC straight from
+    // where they are, with one gathered write
+    if (pCtx->nTxCount == 0)
     {
-        memcpy(&g_cTxBuf[MSG_OFFSET_PAYLOAD], pBuf, nLen);
+        tVec[0].pBuf = cHeader;
+        tVec[0].nLen = MSG_HEADER_LEN;
+        tVec[1].pBuf = pBuf;
+        tVec[1].nLen = nLen;
+        tVec[2].pBuf = &nCrc;
+        tVec[2].nLen = MSG_CRC_LEN;
+
+        nTx = xcom_port_sendv(pCtx->pPort, tVec, 3);
+        pCtx->tStats.nTxBytes += nTx;
+
+        if (nTx == MSG_HEADER_LEN + nLen + MSG_CRC_LEN)
+        {
+            pCtx->tStats.nTxFrames++;
+            return TTrue;
+        }
     }
-    
-    // Set CRC at the end of the message
-    g_cTxBuf[MSG_HEADER_LEN+nLen]= CRC_CalCrc8(g_cTxBuf, (TU16)(MSG_HEADER_LEN+nLen), 0);
 
-    // Set the TX buffer flag
-    g_bTxBusy = TTrue;
+    // Port busy or earlier messages pending: queue the message, the caller
+    // buffer may not live until it is sent
+    pMsg = pCtx->cTxQueue[(pCtx->nTxHead + pCtx->nTxCount) % TX_QUEUE_LEN];
+
+    memcpy(pMsg, cHeader, MSG_HEADER_LEN);
+    if (nLen > 0)
+    {
+        memcpy(&pMsg[MSG_OFFSET_PAYLOAD], pBuf, nLen);
+    }
+    pMsg[MSG_HEADER_LEN+nLen] = nCrc;
+
+    // Bytes already on the wire, only possible for the head of the queue
+    pCtx->nCurTx = (TU16)(pCtx->nTxCount == 0 ? nTx : pCtx->nCurTx);
+
+    pCtx->nTxCount++;
 
     return TTrue;
 }
 
-void  xcom_fsm(void)
+TU8   xcom_tx_pending(TXcomCtx *pCtx)
+{
+    return pCtx->nTxCount;
+}
+
+void  xcom_fsm(TXcomCtx *pCtx)
+{
+    xcom_tx_fsm(pCtx);
+    xcom_rx_fsm(pCtx);
+}
+
+void  xcom_flush(TXcomCtx *pCtx)
+{
+    xcom_tx_fsm(pCtx);
+}
+
+// Sleep until the port has data, or room for a pending TX, or the timeout.
+// TFalse if the port failed.
+TBool xcom_wait(TXcomCtx *pCtx, TU32 nTimeoutUs)
+{
+    TU32 nEvents = UART_EV_READ;
+    TU16 nNeed;
+
+    if (pCtx->nTxCount > 0) nEvents |= UART_EV_WRITE;
+
+    // Sleep through partial frames instead of waking on every USB packet
+    if (pCtx->pPort->nTunings & UART_TUNE_WAKE_LEN)
+    {
+        nNeed = xcom_rx_need(pCtx);
+        if (nNeed != pCtx->nWakeLen && xcom_port_set_wake_len(pCtx->pPort, nNeed))
+        {
+            pCtx->nWakeLen = nNeed;
+        }
+    }
+
+    return (TBool)((xcom_port_wait_ex(pCtx->pPort, pCtx->hWake, nEvents, nTimeoutUs) & UART_EV_ERROR) == 0);
+}
+
+// The wakeup lets another thread end xcom_wait, e.g. once it queued a frame
+void  xcom_set_wake(TXcomCtx *pCtx, UTIL_HANDLE hWake)
+{
+    pCtx->hWake = hWake;
+}
+
+void  xcom_set_baud(TXcomCtx *pCtx, TU32 nBaud)
+{
+    pCtx->nBaud = nBaud;
+}
+
+void  xcom_get_stats(TXcomCtx *pCtx, TXcomStats *pStats)
 {
-    xcom_tx_fsm();
-    xcom_rx_fsm();
-}
\ No newline at end of file
+    TFloat fBytesPerMs;
+
+    if (!pStats) return;
+
+    *pStats = pCtx->tStats;
+
+    // Utilization is derived here, the hot path only counts bytes
+    pStats->nBaud    = pCtx->nBaud;
+    pStats->nElapsed = TIMER_GetNow() - pCtx->nStatsStart;
+
+    fBytesPerMs = (TFloat)pCtx->nBaud / UART_BITS_PER_BYTE / 1000;
+
+    if (pStats->nElapsed > 0 && fBytesPerMs > 0)
+    {
+        pStats->fRxUtil = (TFloat)pStats->nRxBytes / (fBytesPerMs * pStats->nElapsed);
+        pStats->fTxUtil = (TFloat)pStats->nTxBytes / (fBytesPerMs * pStats->nElapsed);
+    }
+    else
+    {
+        pStats->fRxUtil = 0;
+        pStats->fTxUtil = 0;
+    }
+}
+
+void  xcom_reset_stats(TXcomCtx *pCtx)
+{
+    memset(&pCtx->tStats, 0, sizeof(pCtx->tStats));
+
+    pCtx->nStatsStart = TIMER_GetNow();
+}
@@ -6,12 +6,82 @@ extern "C" {
 #endif
 
 #include "hal.h"
+#include "xcom_port.h"
 
-typedef void (*XCOM_RECV_CB)(TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen);
+// Config the max payload len 
+#define XCOM_MAX_PAYLOAD_LEN    (2100)
 
-TBool xcom_init(XCOM_RECV_CB pCbFunc);
-TBool xcom_send(TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen);
-void  xcom_fsm(void);
+// SYNC | VER | ID | CMD | LEN LSB | LEN MSB | PAYLOAD[LENGTH] | CRC8
+#define XCOM_MAX_MSG_LEN        (6 + XCOM_MAX_PAYLOAD_LEN + 1)
+
+// Max number of encoded messages waiting in the TX queue
+#define XCOM_TX_QUEUE_LEN       (8)
+
+// RX ring: room for a few messages, parsed in place
+#define XCOM_RX_RING_SIZE       (4 * XCOM_MAX_MSG_LEN)
+
+// pBuf points into the RX ring and is only valid during the callback
+typedef void (*XCOM_RECV_CB)(void *pParam, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen);
+
+// Default line rate, for the utilization figures
+#define XCOM_DEF_BAUD           (115200)
+
+// Link counters, since xcom_init() or xcom_reset_stats()
+typedef struct {
+    TU32 nRxCalls;          // reads issued to xcom_port_recv, including empty ones
+    TU32 nRxBytes;          // bytes received from the port
+    TU32 nRxFrames;         // frames with a good CRC, handed to the callback
+    TU32 nRxCrcErrors;      // frames with a good header but a bad CRC
+    TU32 nRxHeaderRejects;  // headers rejected: bad SYNC/VER or LEN over the max
+    TU32 nRxSkipBytes;      // bytes skipped while resyncing
+    TU32 nRxCopyBytes;      // bytes moved inside the RX ring to keep frames contiguous
+    TU32 nTxBytes;          // bytes accepted by the port
+    TU32 nTxFrames;         // frames completely sent
+
+    // Filled by xcom_get_stats()
+    TU32   nBaud;           // configured line rate
+    TU32   nElapsed;        // ms covered by the counters
+    TFloat fRxUtil;         // share of the line rate used by RX, 0..1
+    TFloat fTxUtil;         // share of the line rate used by TX, 0..1
+} TXcomStats;
+
+// State of one link, owned by the caller. Links share nothing, so a process
+// may run as many of them as it likes.
+typedef struct {
+    TXcomPortCtx  * pPort;
+    XCOM_RECV_CB    pRecvCb;
+    void          * pRecvParam;
+    TU32            nBaud;
+
+    TU8     nTxHead;
+    TU8     nTxCount;
+    TU16    nCurTx;
+    TU16    nRxRd;
+    TU16    nRxWr;
+    TU16    nWakeLen;       // wake length last set on the port, 0 if not set
+    UTIL_HANDLE hWake;      // WAKE_ handle that ends xcom_wait early, or INVALID_UTIL_HANDLE
+
+    TU8     cTxQueue[XCOM_TX_QUEUE_LEN][XCOM_MAX_MSG_LEN];
+    TU8     cRxRing[XCOM_RX_RING_SIZE];
+
+    TXcomStats tStats;
+    TU32       nStatsStart;
+
+    // TIMER_GetNowUs of the read that completed the frames being handed to
+    // the callback: their arrival time on the host
+    TU64       nRxTimeUs;
+} TXcomCtx;
+
+TBool xcom_init(TXcomCtx *pCtx, TXcomPortCtx *pPort, XCOM_RECV_CB pCbFunc, void *pCbParam);
+TBool xcom_send(TXcomCtx *pCtx, TU8 nId, TU8 nCmd, TU8 *pBuf, TU16 nLen);
+TU8   xcom_tx_pending(TXcomCtx *pCtx);
+void  xcom_fsm(TXcomCtx *pCtx);
+void  xcom_flush(TXcomCtx *pCtx);     // TX half of xcom_fsm: leaves the RX state alone
+TBool xcom_wait(TXcomCtx *pCtx, TU32 nTimeoutUs);
+void  xcom_set_wake(TXcomCtx *pCtx, UTIL_HANDLE hWake);
+void  xcom_set_baud(TXcomCtx *pCtx, TU32 nBaud);
+void  xcom_get_stats(TXcomCtx *pCtx, TXcomStats *pStats);
+void  xcom_reset_stats(TXcomCtx *pCtx);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,299 @@
+#include "xcom_loop.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LOOP_HOST               (0)
+#define LOOP_DEVICE             (1)
+#define LOOP_BITS_PER_BYTE      (10)
+#define LOOP_WARM_UP            (16)
+#define LOOP_NEVER              ((TU64)1 << 62)     // ns, or a count of bytes or bits
+
+// One direction of the line, named by the side which sends. Times in ns.
+typedef struct {
+    TU8    cBuf[XCOM_LOOP_PIPE_SIZE];
+    TU64   nArrival[XCOM_LOOP_PIPE_SIZE];  // when each byte is in
+    TU32   nHead;
+    TU32   nCount;
+    TU64   nLineFree;       // end of the last byte on the line
+    TU64   nLastArrival;
+
+    // Left before the next fault of each kind
+    TU64   nBitsToError;
+    TU64   nBytesToDrop;
+    TU64   nBytesToStall;
+} TLoopPipe;
+
+struct TLoopCtx;
+
+typedef struct {
+    struct TLoopCtx * pLoop;
+    TU8               nSide;
+} TLoopEnd;
+
+typedef struct TLoopCtx {
+    XCOM_LOOP_CONFIG tCfg;
+    TLoopPipe      tPipe[2];
+    TLoopEnd       tEnd[2];
+    TU8            nOpenEnds;
+    TU64           nNow;
+    TU64           nDeviceDue;
+    TU32           nRand;
+    TBool          bInDevice;
+    TXcomLoopStats tStats;
+} TLoopCtx;
+
+static TU16  LOOP_Send(void *pBackend, const TU8 *pBuf, TU16 nLen);
+static TU16  LOOP_Recv(void *pBackend, TU8 *pBuf, TU16 nBufLen);
+static TU32  LOOP_Wait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);
+static TBool LOOP_SetBaud(void *pBackend, TU32 nBaud);
+static void  LOOP_Close(void *pBackend);
+
+static const TXcomPortOps g_tLoopOps = {
+    LOOP_Send,
+    LOOP_Recv,
+    LOOP_Wait,
+    LOOP_SetBaud,
+    LOOP_Close
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// xorshift32: the same faults for the same seed, on any platform. TU32 is
+// 64 bits wide on LP64, hence the masks.
+static TU32 LOOP_Rand(TLoopCtx *p)
+{
+    p->nRand ^= (p->nRand << 13) & TU32_MAX;
+    p->nRand ^= p->nRand >> 17;
+    p->nRand ^= (p->nRand << 5) & TU32_MAX;
+
+    return p->nRand;
+}
+
+// Trials before the next event of a rate, geometric: one draw per event
+// rather than one per byte
+static TU64 LOOP_Skip(TLoopCtx *p, TFloat fRate)
+{
+    TDouble fSkip;
+
+    if (fRate <= 0) return LOOP_NEVER;
+    if (fRate >= 1) return 0;
+
+    fSkip = log(((TDouble)LOOP_Rand(p) + 1) / 4294967296.0) / log(1 - (TDouble)fRate);
+
+    return (fSkip < (TDouble)LOOP_NEVER) ? (TU64)fSkip : LOOP_NEVER;
+}
+
+static void LOOP_ResetFaults(TLoopCtx *p, TLoopPipe *pPipe)
+{
+    pPipe->nBitsToError  = LOOP_Skip(p, p->tCfg.fBitErrorRate);
+    pPipe->nBytesToDrop  = LOOP_Skip(p, p->tCfg.fDropRate);
+    pPipe->nBytesToStall = LOOP_Skip(p, p->tCfg.fStallRate);
+}
+
+// The side reads the pipe of the other one
+static TU32 LOOP_Ready(TLoopCtx *p, TU8 nSide)
+{
+    const TLoopPipe *pIn  = &p->tPipe[1 - nSide];
+    TU32 nReady = 0;
+
+    if (pIn->nCount > 0 && pIn->nArrival[pIn->nHead] <= p->nNow) nReady |= UART_EV_READ;
+    if (p->tPipe[nSide].nCount < XCOM_LOOP_PIPE_SIZE) nReady |= UART_EV_WRITE;
+
+    return nReady;
+}
+
+static void LOOP_RunDevice(TLoopCtx *p)
+{
+    TU64 nDue;
+
+    if (!p->tCfg.fnDevice || p->bInDevice) return;
+
+    p->bInDevice = TTrue;
+    nDue = p->tCfg.fnDevice(p->tCfg.pDeviceParam, p->nNow / 1000);
+    p->bInDevice = TFalse;
+
+    p->nDeviceDue = (nDue < LOOP_NEVER / 1000) ? nDue * 1000 : LOOP_NEVER;
+}
+
+// Next byte of a pipe coming in after now
+static TU64 LOOP_NextArrival(TLoopCtx *p, const TLoopPipe *pPipe)
+{
+    if (pPipe->nCount == 0 || pPipe->nArrival[pPipe->nHead] <= p->nNow) return LOOP_NEVER;
+
+    return pPipe->nArrival[pPipe->nHead];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static TU16 LOOP_Send(void *pBackend, const TU8 *pBuf, TU16 nLen)
+{
+    TLoopEnd  *pEnd  = (TLoopEnd *)pBackend;
+    TLoopCtx  *p     = pEnd->pLoop;
+    TLoopPipe *pPipe = &p->tPipe[pEnd->nSide];
+    TU64 nByteNs = p->tCfg.nBaud ? ((TU64)LOOP_BITS_PER_BYTE * 1000000000 / p->tCfg.nBaud) : 0;
+    TU64 nStart, nArrival;
+    TU32 nTail;
+    TU16 i;
+    TU8  c;
+
+    for (i=0; i<nLen && pPipe->nCount < XCOM_LOOP_PIPE_SIZE; i++)
+    {
+        c = pBuf[i];
+        nStart = UTIL_MAX(p->nNow, pPipe->nLineFree);
+        p->tStats.nBytes++;
+
+        if (pPipe->nBytesToStall == 0)
+        {
+            nStart += (TU64)p->tCfg.nStallUs * 1000;
+            pPipe->nBytesToStall = LOOP_Skip(p, p->tCfg.fStallRate);
+            p->tStats.nStalls++;
+        }
+        else
+        {
+            pPipe->nBytesToStall--;
+        }
+
+        pPipe->nLineFree = nStart + nByteNs;
+
+        // The 8 data bits
+        while (pPipe->nBitsToError < 8)
+        {
+            c ^= (TU8)(1 << pPipe->nBitsToError);
+            pPipe->nBitsToError += 1 + LOOP_Skip(p, p->tCfg.fBitErrorRate);
+            p->tStats.nBitErrors++;
+        }
+        pPipe->nBitsToError -= 8;
+
+        // Took the line time, but never comes in
+        if (pPipe->nBytesToDrop == 0)
+        {
+            pPipe->nBytesToDrop = LOOP_Skip(p, p->tCfg.fDropRate);
+            p->tStats.nDropped++;
+            continue;
+        }
+        pPipe->nBytesToDrop--;
+
+        nArrival = pPipe->nLineFree + (TU64)p->tCfg.nLatencyUs * 1000;
+        if (p->tCfg.nJitterUs > 0) nArrival += (TU64)(LOOP_Rand(p) % (p->tCfg.nJitterUs + 1)) * 1000;
+
+        // Bytes keep their order
+        nArrival = UTIL_MAX(nArrival, pPipe->nLastArrival);
+        pPipe->nLastArrival = nArrival;
+
+        nTail = (pPipe->nHead + pPipe->nCount) % XCOM_LOOP_PIPE_SIZE;
+        pPipe->cBuf[nTail]     = c;
+        pPipe->nArrival[nTail] = nArrival;
+        pPipe->nCount++;
+    }
+
+    return i;
+}
+
+static TU16 LOOP_Recv(void *pBackend, TU8 *pBuf, TU16 nBufLen)
+{
+    TLoopEnd  *pEnd = (TLoopEnd *)pBackend;
+    TLoopCtx  *p    = pEnd->pLoop;
+    TLoopPipe *pIn  = &p->tPipe[1 - pEnd->nSide];
+    TU16 nLen = 0;
+
+    while (nLen < nBufLen && pIn->nCount > 0 && pIn->nArrival[pIn->nHead] <= p->nNow)
+    {
+        pBuf[nLen++] = pIn->cBuf[pIn->nHead];
+        pIn->nHead = (pIn->nHead + 1) % XCOM_LOOP_PIPE_SIZE;
+        pIn->nCount--;
+    }
+
+    return nLen;
+}
+
+// The clock only moves in waits on the host end. The device end reports
+// what is ready at once: its model runs within the host waits.
+static TU32 LOOP_Wait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    TLoopEnd *pEnd = (TLoopEnd *)pBackend;
+    TLoopCtx *p    = pEnd->pLoop;
+    TU64 nEnd = p->nNow + (TU64)nTimeoutUs * 1000;
+    TU64 nNext;
+    TU32 nReady;
+
+    if (pEnd->nSide == LOOP_DEVICE) return LOOP_Ready(p, LOOP_DEVICE) & nEvents;
+
+    while (TTrue)
+    {
+        LOOP_RunDevice(p);
+
+        nReady = LOOP_Ready(p, LOOP_HOST) & nEvents;
+        if (nReady || p->nNow >= nEnd) return nReady;
+
+        // On to the next thing that happens, if before the timeout
+        nNext = UTIL_MIN(nEnd, LOOP_NextArrival(p, &p->tPipe[LOOP_DEVICE]));
+        nNext = UTIL_MIN(nNext, LOOP_NextArrival(p, &p->tPipe[LOOP_HOST]));
+        if (p->nDeviceDue > p->nNow) nNext = UTIL_MIN(nNext, p->nDeviceDue);
+
+        p->nNow = nNext;
+    }
+}
+
+static TBool LOOP_SetBaud(void *pBackend, TU32 nBaud)
+{
+    ((TLoopEnd *)pBackend)->pLoop->tCfg.nBaud = nBaud;
+
+    return TTrue;
+}
+
+static void LOOP_Close(void *pBackend)
+{
+    TLoopCtx *p = ((TLoopEnd *)pBackend)->pLoop;
+
+    if (--p->nOpenEnds == 0) free(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TBool xcom_loop_open(TXcomPortCtx *pHost, TXcomPortCtx *pDevice, const XCOM_LOOP_CONFIG *pCfg)
+{
+    TLoopCtx *p = (TLoopCtx *)calloc(1, sizeof(TLoopCtx));
+    TU8 i;
+
+    if (!p) return TFalse;
+
+    p->tCfg  = *pCfg;
+    // Small seeds give xorshift small first draws: spread them, then warm up.
+    // xorshift stays at 0, hence the low bit.
+    p->nRand = ((pCfg->nSeed * 0x9E3779B9u) & TU32_MAX) | 1;
+    for (i=0; i<LOOP_WARM_UP; i++) LOOP_Rand(p);
+    p->nDeviceDue = 0;
+    p->nOpenEnds  = 2;
+
+    for (i=0; i<2; i++)
+    {
+        p->tEnd[i].pLoop = p;
+        p->tEnd[i].nSide = i;
+        LOOP_ResetFaults(p, &p->tPipe[i]);
+    }
+
+    if (pHost->hPort != INVALID_UTIL_HANDLE || pHost->pOps)     xcom_port_close(pHost);
+    if (pDevice->hPort != INVALID_UTIL_HANDLE || pDevice->pOps) xcom_port_close(pDevice);
+
+    pHost->pOps       = &g_tLoopOps;
+    pHost->pBackend   = &p->tEnd[LOOP_HOST];
+    pDevice->pOps     = &g_tLoopOps;
+    pDevice->pBackend = &p->tEnd[LOOP_DEVICE];
+
+    return TTrue;
+}
+
+TU64  xcom_loop_now(TXcomPortCtx *pPort)
+{
+    if (pPort->pOps != &g_tLoopOps) return 0;
+
+    return ((TLoopEnd *)pPort->pBackend)->pLoop->nNow / 1000;
+}
+
+TBool xcom_loop_get_stats(TXcomPortCtx *pPort, TXcomLoopStats *pStats)
+{
+    if (pPort->pOps != &g_tLoopOps) return TFalse;
+
+    *pStats = ((TLoopEnd *)pPort->pBackend)->pLoop->tStats;
+
+    return TTrue;
+}
@@ -0,0 +1,64 @@
+#ifndef __XCOM_LOOP_H__
+#define __XCOM_LOOP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xcom_port.h"
+
+// Two ports joined by an emulated line in memory, the host end and the
+// device end, for a device model running in the same process.
+//
+// The line runs on a clock of its own: waiting on the host end moves it on
+// to the next byte or device event instead of sleeping, so a benchmark goes
+// through link-seconds in microseconds. The device model runs from within
+// those waits, in the same thread: it owns the device end and reads and
+// writes it like the host does its own. Faults come from a seeded generator
+// and repeat from run to run.
+//
+// Both directions share the settings:
+// - each byte takes 10 bits at nBaud on the line, 0 for no limit
+// - it arrives nLatencyUs after that, plus 0..nJitterUs, in order
+// - fBitErrorRate is per bit, fDropRate and fStallRate are per byte
+// - a stall holds the line for nStallUs before the byte
+#define XCOM_LOOP_PIPE_SIZE     (8192)      // bytes in flight or unread, per direction
+
+// Lets the device model run at nNowUs; returns when it wants to run next,
+// TU64_MAX for only when bytes come in
+typedef TU64 (*XCOM_LOOP_DEVICE_FUNC)(void *pParam, TU64 nNowUs);
+
+typedef struct {
+    TU32   nBaud;
+    TU32   nLatencyUs;
+    TU32   nJitterUs;
+    TFloat fBitErrorRate;
+    TFloat fDropRate;
+    TFloat fStallRate;
+    TU32   nStallUs;
+    TU32   nSeed;
+
+    XCOM_LOOP_DEVICE_FUNC fnDevice;
+    void * pDeviceParam;
+} XCOM_LOOP_CONFIG;
+
+// Faults injected so far, both directions
+typedef struct {
+    TU32 nBytes;            // sent onto the line
+    TU32 nBitErrors;
+    TU32 nDropped;
+    TU32 nStalls;
+} TXcomLoopStats;
+
+// Opens both ends, set up by xcom_port_init; each is closed with xcom_port_close
+TBool xcom_loop_open(TXcomPortCtx *pHost, TXcomPortCtx *pDevice, const XCOM_LOOP_CONFIG *pCfg);
+
+// Clock of the line, in us from the open; either end
+TU64  xcom_loop_now(TXcomPortCtx *pPort);
+TBool xcom_loop_get_stats(TXcomPortCtx *pPort, TXcomLoopStats *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XCOM_LOOP_H__
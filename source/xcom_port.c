@@ -1,40 +1,242 @@
 #include "xcom_port.h"
+#include "xcom_trace.h"
+#include "xcom_sock.h"
 #include "util.h"
+#include <string.h>
 
-static UTIL_HANDLE g_hPort = INVALID_UTIL_HANDLE;
+#define PORT_GATHER_SIZE        (4096)      // a frame of xcom, header, payload and CRC
 
-TBool xcom_port_open(const TU8 *szPort)
+typedef struct {
+    const char *        szPrefix;
+    XCOM_PORT_OPEN_FUNC fnOpen;
+} TXcomPortBackend;
+
+// Port names with these prefixes are not UARTs
+static const TXcomPortBackend g_tBackends[] = {
+    { "trace:", xcom_trace_open },
+    { "tcp://", xcom_sock_open_tcp },
+    { "udp://", xcom_sock_open_udp },
+};
+
+// Capture link IDs, handed out in turn as ports open, from any thread
+static UTIL_ONCE   g_tCapLinkOnce = UTIL_ONCE_INIT;
+static UTIL_HANDLE g_hCapLinkLock = INVALID_UTIL_HANDLE;
+static TU8         g_nCapLinkNext = 0;
+
+static void CapLinkInit(void)
+{
+    g_hCapLinkLock = MUTEX_Create();
+}
+
+static TU8 CapLinkNext(void)
+{
+    TU8 nLink;
+
+    ONCE_Run(&g_tCapLinkOnce, CapLinkInit);
+
+    // Without the lock, IDs may repeat but the capture goes on
+    if (g_hCapLinkLock != INVALID_UTIL_HANDLE) MUTEX_Lock(g_hCapLinkLock);
+    nLink = g_nCapLinkNext++;
+    if (g_hCapLinkLock != INVALID_UTIL_HANDLE) MUTEX_Unlock(g_hCapLinkLock);
+
+    return nLink;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void  xcom_port_init(TXcomPortCtx *pCtx)
+{
+    pCtx->hPort = INVALID_UTIL_HANDLE;
+    pCtx->nTunings = 0;
+    pCtx->pOps = NULL;
+    pCtx->pBackend = NULL;
+    pCtx->nCapLink = 0;
+}
+
+TBool xcom_port_open(TXcomPortCtx *pCtx, const TU8 *szPort)
 {
-    if (g_hPort != INVALID_UTIL_HANDLE)
+    return xcom_port_open_ex(pCtx, szPort, NULL);
+}
+
+TBool xcom_port_open_ex(TXcomPortCtx *pCtx, const TU8 *szPort, const UART_CONFIG *pCfg)
+{
+    TU32 i, nLen;
+
+    if (pCtx->hPort != INVALID_UTIL_HANDLE || pCtx->pOps)
     {
-        UART_Close(g_hPort);
-        g_hPort = INVALID_UTIL_HANDLE;
+        xcom_port_close(pCtx);
     }
 
-    g_hPort = UART_Init((const char *)szPort);
-    
-    return (TBool)(g_hPort != INVALID_UTIL_HANDLE);    
+    for (i=0; i<UTIL_TAB_SIZE(g_tBackends); i++)
+    {
+        nLen = (TU32)strlen(g_tBackends[i].szPrefix);
+
+        if (strncmp((const char *)szPort, g_tBackends[i].szPrefix, nLen) == 0)
+        {
+            // The UART tunings do not apply: nTunings stays 0
+            pCtx->pBackend = g_tBackends[i].fnOpen((const char *)szPort + nLen, &pCtx->pOps);
+            if (!pCtx->pBackend)
+            {
+                pCtx->pOps = NULL;
+                return TFalse;
+            }
+
+            pCtx->nCapLink = CapLinkNext();
+            return TTrue;
+        }
+    }
+
+    pCtx->hPort = UART_InitEx((const char *)szPort, pCfg, &pCtx->nTunings);
+    if (pCtx->hPort == INVALID_UTIL_HANDLE) return TFalse;
+
+    pCtx->nCapLink = CapLinkNext();
+    return TTrue;
 }
 
-TU16  xcom_port_send(TU8 * pBuf, TU16 nLen)
+TBool xcom_port_is_open(TXcomPortCtx *pCtx)
 {
-    TU16 nRet = (TU16)UART_Write(g_hPort, pBuf, (TU32)nLen);
+    return (TBool)(pCtx->hPort != INVALID_UTIL_HANDLE || pCtx->pOps != NULL);
+}
 
-    if (nRet > 0) LOG_Frame("UART TX: ", pBuf, nRet);
+TU16  xcom_port_send(TXcomPortCtx *pCtx, TU8 * pBuf, TU16 nLen)
+{
+    TU16 nRet = pCtx->pOps ? pCtx->pOps->Send(pCtx->pBackend, pBuf, nLen)
+                           : (TU16)UART_Write(pCtx->hPort, pBuf, (TU32)nLen);
+
+    if (nRet > 0)
+    {
+        CAP_Write(CAP_DIR_TX, pCtx->nCapLink, pBuf, nRet);
+        LOG_Frame("UART TX: ", pBuf, nRet);
+    }
     
     return nRet;
 }
 
-TU16  xcom_port_recv(TU8 * pBuf, TU16 nBufLen)
+TU16  xcom_port_sendv(TXcomPortCtx *pCtx, const UART_IOVEC * pVec, TU8 nVecCnt)
+{
+    TU16 nRet = 0;
+    TU16 nLeft;
+    TU32 nTotal = 0;
+    TU8  i;
+
+    if (pCtx->pOps)
+    {
+        TU8 cGather[PORT_GATHER_SIZE];
+
+        for (i=0; i<nVecCnt; i++) nTotal += pVec[i].nLen;
+
+        // In one piece: one TCP segment or datagram per frame
+        if (nTotal <= PORT_GATHER_SIZE)
+        {
+            for (i=0; i<nVecCnt; i++)
+            {
+                memcpy(&cGather[nRet], pVec[i].pBuf, pVec[i].nLen);
+                nRet = (TU16)(nRet + pVec[i].nLen);
+            }
+
+            return xcom_port_send(pCtx, cGather, nRet);
+        }
+
+        // One fragment after the other, up to the first short one
+        for (i=0; i<nVecCnt; i++)
+        {
+            nLeft = xcom_port_send(pCtx, pVec[i].pBuf, (TU16)pVec[i].nLen);
+            nRet  = (TU16)(nRet + nLeft);
+            if (nLeft < pVec[i].nLen) break;
+        }
+
+        return nRet;
+    }
+
+    nRet  = (TU16)UART_WriteV(pCtx->hPort, pVec, (TU32)nVecCnt);
+    nLeft = nRet;
+
+    // One write, one record: the bytes went out together
+    if (nRet > 0 && nRet <= PORT_GATHER_SIZE)
+    {
+        TU8  cGather[PORT_GATHER_SIZE];
+        TU16 nFrag;
+
+        for (i=0; i<nVecCnt && nLeft > 0; i++)
+        {
+            nFrag = (TU16)UTIL_MIN(pVec[i].nLen, (TU32)nLeft);
+            memcpy(&cGather[nRet - nLeft], pVec[i].pBuf, nFrag);
+            nLeft = (TU16)(nLeft - nFrag);
+        }
+
+        CAP_Write(CAP_DIR_TX, pCtx->nCapLink, cGather, nRet);
+        LOG_Frame("UART TX: ", cGather, nRet);
+
+        return nRet;
+    }
+
+    for (i=0; i<nVecCnt && nLeft > 0; i++)
+    {
+        TU16 nFrag = (TU16)UTIL_MIN(pVec[i].nLen, (TU32)nLeft);
+
+        if (nFrag > 0)
+        {
+            CAP_Write(CAP_DIR_TX, pCtx->nCapLink, pVec[i].pBuf, nFrag);
+            LOG_Frame("UART TX: ", pVec[i].pBuf, nFrag);
+        }
+        nLeft = (TU16)(nLeft - nFrag);
+    }
+
+    return nRet;
+}
+
+TU16  xcom_port_recv(TXcomPortCtx *pCtx, TU8 * pBuf, TU16 nBufLen)
 {
-    TU16 nRet = (TU16)UART_Read(g_hPort, pBuf, (TU32)nBufLen);
+    TU16 nRet = pCtx->pOps ? pCtx->pOps->Recv(pCtx->pBackend, pBuf, nBufLen)
+                           : (TU16)UART_Read(pCtx->hPort, pBuf, (TU32)nBufLen);
 
-    if (nRet > 0) LOG_Frame("UART RX: ", pBuf, nRet);
+    if (nRet > 0)
+    {
+        CAP_Write(CAP_DIR_RX, pCtx->nCapLink, pBuf, nRet);
+        LOG_Frame("UART RX: ", pBuf, nRet);
+    }
 
     return nRet;
 }
 
-void  xcom_port_close(void)
+TBool xcom_port_set_baud(TXcomPortCtx *pCtx, TU32 nBaud)
 {
-    UART_Close(g_hPort);
-}
\ No newline at end of file
+    if (pCtx->pOps) return pCtx->pOps->SetBaud(pCtx->pBackend, nBaud);
+
+    return UART_SetBaud(pCtx->hPort, nBaud);
+}
+
+TBool xcom_port_set_wake_len(TXcomPortCtx *pCtx, TU16 nLen)
+{
+    if (pCtx->pOps) return TFalse;
+
+    return UART_SetWakeLen(pCtx->hPort, nLen);
+}
+
+TU32  xcom_port_wait(TXcomPortCtx *pCtx, TU32 nEvents, TU32 nTimeoutUs)
+{
+    return xcom_port_wait_ex(pCtx, INVALID_UTIL_HANDLE, nEvents, nTimeoutUs);
+}
+
+TU32  xcom_port_wait_ex(TXcomPortCtx *pCtx, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    if (pCtx->pOps) return pCtx->pOps->Wait(pCtx->pBackend, hWake, nEvents, nTimeoutUs);
+
+    return UART_WaitEx(pCtx->hPort, hWake, nEvents, nTimeoutUs);
+}
+
+void  xcom_port_close(TXcomPortCtx *pCtx)
+{
+    if (pCtx->pOps)
+    {
+        pCtx->pOps->Close(pCtx->pBackend);
+    }
+    else
+    {
+        UART_Close(pCtx->hPort);
+    }
+
+    pCtx->hPort = INVALID_UTIL_HANDLE;
+    pCtx->nTunings = 0;
+    pCtx->pOps = NULL;
+    pCtx->pBackend = NULL;
+}
@@ -7,13 +7,43 @@ extern "C" {
 
 #include "hal.h"
 
-TBool xcom_port_open(const TU8 *szPort);
-TU16  xcom_port_send(TU8 * pBuf, TU16 nLen);
-TU16  xcom_port_recv(TU8 * pBuf, TU16 nBufLen);
-void  xcom_port_close(void);
+// A transport in place of the UART, picked by the prefix of the port name,
+// e.g. "trace:a.txt". Like a UART handle, it is used by one thread at a time.
+typedef struct {
+    TU16  (*Send)(void *pBackend, const TU8 *pBuf, TU16 nLen);
+    TU16  (*Recv)(void *pBackend, TU8 *pBuf, TU16 nBufLen);
+    TU32  (*Wait)(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);  // as UART_WaitEx
+    TBool (*SetBaud)(void *pBackend, TU32 nBaud);
+    void  (*Close)(void *pBackend);
+} TXcomPortOps;
+
+// Opens a backend on the rest of the port name, NULL if it fails
+typedef void * (*XCOM_PORT_OPEN_FUNC)(const char *szArg, const TXcomPortOps **ppOps);
+
+// State of one port, owned by the caller
+typedef struct {
+    UTIL_HANDLE hPort;
+    TU32        nTunings;   // UART_TUNE_* that took effect on open
+    const TXcomPortOps *pOps;   // NULL on a UART
+    void      * pBackend;
+    TU8         nCapLink;   // link ID of its bytes in the capture, one per open port
+} TXcomPortCtx;
+
+void  xcom_port_init(TXcomPortCtx *pCtx);
+TBool xcom_port_open(TXcomPortCtx *pCtx, const TU8 *szPort);
+TBool xcom_port_open_ex(TXcomPortCtx *pCtx, const TU8 *szPort, const UART_CONFIG *pCfg);
+TBool xcom_port_is_open(TXcomPortCtx *pCtx);
+TU16  xcom_port_send(TXcomPortCtx *pCtx, TU8 * pBuf, TU16 nLen);
+TU16  xcom_port_sendv(TXcomPortCtx *pCtx, const UART_IOVEC * pVec, TU8 nVecCnt);
+TU16  xcom_port_recv(TXcomPortCtx *pCtx, TU8 * pBuf, TU16 nBufLen);
+TBool xcom_port_set_baud(TXcomPortCtx *pCtx, TU32 nBaud);
+TBool xcom_port_set_wake_len(TXcomPortCtx *pCtx, TU16 nLen);
+TU32  xcom_port_wait(TXcomPortCtx *pCtx, TU32 nEvents, TU32 nTimeoutUs);
+TU32  xcom_port_wait_ex(TXcomPortCtx *pCtx, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);
+void  xcom_port_close(TXcomPortCtx *pCtx);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // __XCOM_PORT_H__
\ No newline at end of file
+#endif // __XCOM_PORT_H__
@@ -0,0 +1,195 @@
+#include "xcom_sock.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOCK_MAX_HOST_LEN       (256)
+
+typedef struct {
+    UTIL_HANDLE hSock;
+    TBool       bUdp;
+    TBool       bFailed;    // hung up or broke: Wait reports UART_EV_ERROR
+    TU32        nApplied;   // SOCK_TUNE_*
+
+    // A datagram is read whole, then handed out in pieces
+    TU8       * pDgram;
+    TU32        nDgramPos;
+    TU32        nDgramLen;
+} TSockCtx;
+
+static TU16  XSOCK_Send(void *pBackend, const TU8 *pBuf, TU16 nLen);
+static TU16  XSOCK_Recv(void *pBackend, TU8 *pBuf, TU16 nBufLen);
+static TU32  XSOCK_Wait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);
+static TBool XSOCK_SetBaud(void *pBackend, TU32 nBaud);
+static void  XSOCK_Close(void *pBackend);
+
+static const TXcomPortOps g_tSockOps = {
+    XSOCK_Send,
+    XSOCK_Recv,
+    XSOCK_Wait,
+    XSOCK_SetBaud,
+    XSOCK_Close
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static TU16 XSOCK_Send(void *pBackend, const TU8 *pBuf, TU16 nLen)
+{
+    TSockCtx *p = (TSockCtx *)pBackend;
+    TS32 nRet;
+
+    if (p->bFailed) return 0;
+
+    nRet = SOCK_Send(p->hSock, (TU8 *)pBuf, (TS32)nLen);
+    if (nRet < 0)
+    {
+        p->bFailed = TTrue;
+        return 0;
+    }
+
+    return (TU16)nRet;
+}
+
+static TU16 XSOCK_Recv(void *pBackend, TU8 *pBuf, TU16 nBufLen)
+{
+    TSockCtx *p = (TSockCtx *)pBackend;
+    TS32 nRet;
+    TU16 nLen;
+
+    if (p->bFailed) return 0;
+
+    if (p->bUdp && p->nDgramPos == p->nDgramLen)
+    {
+        nRet = SOCK_Read(p->hSock, p->pDgram, XCOM_SOCK_DGRAM_SIZE, 0);
+        if (nRet < 0) p->bFailed = TTrue;
+        if (nRet <= 0) return 0;
+
+        p->nDgramPos = 0;
+        p->nDgramLen = (TU32)nRet;
+    }
+
+    if (p->bUdp)
+    {
+        nLen = (TU16)UTIL_MIN((TU32)nBufLen, p->nDgramLen - p->nDgramPos);
+        memcpy(pBuf, p->pDgram + p->nDgramPos, nLen);
+        p->nDgramPos += nLen;
+
+        return nLen;
+    }
+
+    // TCP is a stream: straight into the caller's buffer
+    nRet = SOCK_Read(p->hSock, pBuf, (TS32)nBufLen, 0);
+    if (nRet < 0) p->bFailed = TTrue;
+
+    return (nRet > 0) ? (TU16)nRet : 0;
+}
+
+static TU32 XSOCK_Wait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    TSockCtx *p = (TSockCtx *)pBackend;
+
+    if (p->bFailed) return UART_EV_ERROR;
+
+    // The rest of a datagram needs no wait
+    if ((nEvents & UART_EV_READ) && p->nDgramPos < p->nDgramLen) return UART_EV_READ;
+
+    return SOCK_Wait(p->hSock, hWake, nEvents, nTimeoutUs);
+}
+
+static TBool XSOCK_SetBaud(void *pBackend, TU32 nBaud)
+{
+    return TTrue;
+}
+
+static void XSOCK_Close(void *pBackend)
+{
+    TSockCtx *p = (TSockCtx *)pBackend;
+
+    SOCK_Close(p->hSock);
+    free(p->pDgram);
+    free(p);
+}
+
+// "host:port", the host by name or address
+static void * XSOCK_Open(const char *szArg, TU8 nType, const TXcomPortOps **ppOps)
+{
+    SOCK_CONFIG tCfg;
+    TSockCtx  * p;
+    const char *pColon = strrchr(szArg, ':');
+    char  szHost[SOCK_MAX_HOST_LEN];
+    TU32  nAddr = 0;
+    long  nPort;
+
+    if (!pColon || (TU32)(pColon - szArg) >= SOCK_MAX_HOST_LEN) return NULL;
+
+    nPort = atol(pColon + 1);
+    if (nPort <= 0 || nPort > 0xFFFF) return NULL;
+
+    memcpy(szHost, szArg, pColon - szArg);
+    szHost[pColon - szArg] = '\0';
+
+    // SOCK_OpenEx listens on nAddr 0 and blocks in accept(): not for a port
+    if (szHost[0] == '\0')
+    {
+        LOG("xcom_sock: no host in %s\n", szArg);
+        return NULL;
+    }
+
+    if (!SOCK_Resolve(szHost, &nAddr) || nAddr == 0)
+    {
+        LOG("xcom_sock: cannot resolve %s\n", szHost);
+        return NULL;
+    }
+
+    p = (TSockCtx *)calloc(1, sizeof(TSockCtx));
+    if (!p) return NULL;
+
+    p->bUdp = (TBool)(nType == SOCK_TYPE_UDP);
+    if (p->bUdp)
+    {
+        p->pDgram = (TU8 *)malloc(XCOM_SOCK_DGRAM_SIZE);
+        if (!p->pDgram)
+        {
+            free(p);
+            return NULL;
+        }
+    }
+
+    memset(&tCfg, 0, sizeof(tCfg));
+    tCfg.nType      = nType;
+    tCfg.nTunings   = SOCK_TUNE_ALL;
+    tCfg.nRxBufSize = XCOM_SOCK_RX_BUF_SIZE;
+    tCfg.nTxBufSize = XCOM_SOCK_TX_BUF_SIZE;
+
+    p->hSock = SOCK_OpenEx(nAddr, (TU16)nPort, &tCfg, &p->nApplied);
+    if (p->hSock == INVALID_UTIL_HANDLE)
+    {
+        free(p->pDgram);
+        free(p);
+        return NULL;
+    }
+
+    *ppOps = &g_tSockOps;
+
+    return p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void * xcom_sock_open_tcp(const char *szArg, const TXcomPortOps **ppOps)
+{
+    return XSOCK_Open(szArg, SOCK_TYPE_TCP, ppOps);
+}
+
+void * xcom_sock_open_udp(const char *szArg, const TXcomPortOps **ppOps)
+{
+    return XSOCK_Open(szArg, SOCK_TYPE_UDP, ppOps);
+}
+
+TBool  xcom_sock_get_tunings(TXcomPortCtx *pPort, TU32 *pApplied)
+{
+    if (pPort->pOps != &g_tSockOps) return TFalse;
+
+    *pApplied = ((TSockCtx *)pPort->pBackend)->nApplied;
+
+    return TTrue;
+}
@@ -0,0 +1,36 @@
+#ifndef __XCOM_SOCK_H__
+#define __XCOM_SOCK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xcom_port.h"
+
+// A device behind a network bridge, as a port: radar_open("tcp://host:port")
+// or radar_open("udp://host:port"). The host is required: the port always
+// connects out to the bridge, it never waits for one with no timeout.
+//
+// TCP goes with TCP_NODELAY, so that each request leaves at once instead
+// of after the Nagle wait on the previous one; xcom_port_sendv hands a
+// frame over in one piece, so one frame goes in one segment. UDP takes the
+// frames as they come, one datagram each way per send: a lost datagram is
+// a CRC error to xcom, as a corrupted byte on the UART would be.
+//
+// The baud rate is the one of the device end of the bridge: setting it
+// does nothing here.
+#define XCOM_SOCK_RX_BUF_SIZE   (256 * 1024)    // SO_RCVBUF: a debug image in flight
+#define XCOM_SOCK_TX_BUF_SIZE   (16 * 1024)     // SO_SNDBUF: requests are small
+#define XCOM_SOCK_DGRAM_SIZE    (65536)         // largest UDP datagram, read whole
+
+void * xcom_sock_open_tcp(const char *szArg, const TXcomPortOps **ppOps);
+void * xcom_sock_open_udp(const char *szArg, const TXcomPortOps **ppOps);
+
+// SOCK_TUNE_* that took effect, TFalse if the port is no socket
+TBool  xcom_sock_get_tunings(TXcomPortCtx *pPort, TU32 *pApplied);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XCOM_SOCK_H__
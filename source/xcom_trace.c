@@ -0,0 +1,363 @@
+#include "xcom_trace.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_TX_TAG            "UART TX:"
+#define TRACE_RX_TAG            "UART RX:"
+#define TRACE_TAG_LEN           (8)
+#define TRACE_BITS_PER_BYTE     (10)
+#define TRACE_DEF_BAUD          (115200)
+
+// One chunk of RX bytes, as one line of the trace
+typedef struct {
+    TU32  nEnd;             // end offset in pRx
+    TU32  nTxBefore;        // TX bytes logged before it
+    TU64  nGapUs;           // logged time since the line before it
+} TTraceRx;
+
+typedef struct {
+    TU8      * pRx;
+    TU8      * pTx;
+    TTraceRx * pRec;
+    TU32       nRecs;
+    TU32       nRxLen;
+    TU32       nTxLen;
+    TBool      bTimed;      // the lines have times, else the line rate paces
+    TBool      bPaced;
+    TU32       nBaud;
+
+    TU32       nRec;        // next chunk to hand out
+    TU32       nRxAvail;    // end of the chunks handed out
+    TU32       nRxPos;      // bytes read
+    TU32       nTxPos;      // bytes sent
+    TU32       nTxDiffs;
+    TU32       nTxFirstDiff;
+    TU64       nLastUs;     // last chunk handed out, or request sent
+} TTraceCtx;
+
+static TU16  TRACE_Send(void *pBackend, const TU8 *pBuf, TU16 nLen);
+static TU16  TRACE_Recv(void *pBackend, TU8 *pBuf, TU16 nBufLen);
+static TU32  TRACE_Wait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs);
+static TBool TRACE_SetBaud(void *pBackend, TU32 nBaud);
+static void  TRACE_Close(void *pBackend);
+
+static const TXcomPortOps g_tTraceOps = {
+    TRACE_Send,
+    TRACE_Recv,
+    TRACE_Wait,
+    TRACE_SetBaud,
+    TRACE_Close
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Room for nNeed items, doubling
+static TBool TRACE_Grow(void **pp, TU32 *pRoom, TU32 nNeed, TU32 nSize)
+{
+    void *pNew;
+    TU32  nRoom = *pRoom ? *pRoom : 1024;
+
+    if (nNeed <= *pRoom) return TTrue;
+
+    while (nRoom < nNeed) nRoom *= 2;
+
+    pNew = realloc(*pp, (size_t)nRoom * nSize);
+    if (!pNew) return TFalse;
+
+    *pp = pNew;
+    *pRoom = nRoom;
+
+    return TTrue;
+}
+
+static char * TRACE_ReadFile(const char *szName)
+{
+    FILE *fp = fopen(szName, "rb");
+    char *pText = NULL;
+    long  nSize;
+
+    if (!fp) return NULL;
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (nSize = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        pText = (char *)malloc((size_t)nSize + 1);
+        if (pText && fread(pText, 1, (size_t)nSize, fp) == (size_t)nSize)
+        {
+            pText[nSize] = '\0';
+        }
+        else
+        {
+            free(pText);
+            pText = NULL;
+        }
+    }
+
+    fclose(fp);
+
+    return pText;
+}
+
+static TBool TRACE_Load(TTraceCtx *p, char *pText)
+{
+    char *pLine, *pNext, *pTag, *pHex, *pEnd;
+    TU32  nRxRoom = 0, nTxRoom = 0, nRecRoom = 0;
+    TU64  nTimeUs, nPrevUs = 0;
+    unsigned long nByte;
+    double fTime;
+    TBool bTx;
+
+    for (pLine = pText; *pLine; pLine = pNext)
+    {
+        pNext = strchr(pLine, '\n');
+        if (pNext) *pNext++ = '\0';
+        else pNext = pLine + strlen(pLine);
+
+        // The rest of the log, e.g. "MSG SENT: ..."
+        bTx  = TTrue;
+        pTag = strstr(pLine, TRACE_TX_TAG);
+        if (!pTag)
+        {
+            bTx  = TFalse;
+            pTag = strstr(pLine, TRACE_RX_TAG);
+        }
+        if (!pTag) continue;
+
+        // cap_dump puts the time in s first
+        fTime = strtod(pLine, &pEnd);
+        if (pEnd != pLine && pEnd < pTag)
+        {
+            nTimeUs = (fTime > 0) ? (TU64)(fTime * 1e6 + 0.5) : 0;
+            p->bTimed = TTrue;
+        }
+        else
+        {
+            nTimeUs = nPrevUs;
+        }
+
+        for (pHex = pTag + TRACE_TAG_LEN; ; pHex = pEnd)
+        {
+            nByte = strtoul(pHex, &pEnd, 16);
+            if (pEnd == pHex || nByte > 0xFF) break;
+
+            if (bTx)
+            {
+                if (!TRACE_Grow((void **)&p->pTx, &nTxRoom, p->nTxLen + 1, 1)) return TFalse;
+                p->pTx[p->nTxLen++] = (TU8)nByte;
+            }
+            else
+            {
+                if (!TRACE_Grow((void **)&p->pRx, &nRxRoom, p->nRxLen + 1, 1)) return TFalse;
+                p->pRx[p->nRxLen++] = (TU8)nByte;
+            }
+        }
+
+        if (!bTx && (p->nRecs == 0 || p->pRec[p->nRecs - 1].nEnd != p->nRxLen))
+        {
+            if (!TRACE_Grow((void **)&p->pRec, &nRecRoom, p->nRecs + 1, sizeof(TTraceRx))) return TFalse;
+
+            p->pRec[p->nRecs].nEnd      = p->nRxLen;
+            p->pRec[p->nRecs].nTxBefore = p->nTxLen;
+            p->pRec[p->nRecs].nGapUs    = (nTimeUs > nPrevUs) ? (nTimeUs - nPrevUs) : 0;
+            p->nRecs++;
+        }
+
+        nPrevUs = nTimeUs;
+    }
+
+    return (TBool)(p->nRxLen > 0 || p->nTxLen > 0);
+}
+
+// Time to hand out a chunk after the last event
+static TU64 TRACE_Gap(TTraceCtx *p, TU32 nRec)
+{
+    TU32 nLen = p->pRec[nRec].nEnd - ((nRec > 0) ? p->pRec[nRec - 1].nEnd : 0);
+
+    if (p->bTimed) return p->pRec[nRec].nGapUs;
+
+    return (TU64)nLen * TRACE_BITS_PER_BYTE * 1000000 / p->nBaud;
+}
+
+static TBool TRACE_IsAsked(TTraceCtx *p)
+{
+    return (TBool)(p->nRec < p->nRecs && p->nTxPos >= p->pRec[p->nRec].nTxBefore);
+}
+
+static void TRACE_Release(TTraceCtx *p, TU64 nNow)
+{
+    TU64 nGap;
+
+    while (TRACE_IsAsked(p))
+    {
+        nGap = p->bPaced ? TRACE_Gap(p, p->nRec) : 0;
+        if (p->nLastUs + nGap > nNow) break;
+
+        // From the due time, not from now, so that late reads do not drift
+        p->nLastUs  = p->bPaced ? (p->nLastUs + nGap) : nNow;
+        p->nRxAvail = p->pRec[p->nRec].nEnd;
+        p->nRec++;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static TU16 TRACE_Send(void *pBackend, const TU8 *pBuf, TU16 nLen)
+{
+    TTraceCtx *p = (TTraceCtx *)pBackend;
+    TBool bWasAsked = TRACE_IsAsked(p);
+    TU16  i;
+
+    for (i=0; i<nLen; i++, p->nTxPos++)
+    {
+        if (p->nTxPos >= p->nTxLen || pBuf[i] == p->pTx[p->nTxPos]) continue;
+
+        if (p->nTxDiffs == 0)
+        {
+            p->nTxFirstDiff = p->nTxPos;
+            LOG("trace: TX byte %lu is %02X, %02X in the trace\n", p->nTxPos, pBuf[i], p->pTx[p->nTxPos]);
+        }
+        p->nTxDiffs++;
+    }
+
+    // The response is timed from its request
+    if (!bWasAsked && TRACE_IsAsked(p)) p->nLastUs = TIMER_GetNowUs();
+
+    return nLen;
+}
+
+static TU16 TRACE_Recv(void *pBackend, TU8 *pBuf, TU16 nBufLen)
+{
+    TTraceCtx *p = (TTraceCtx *)pBackend;
+    TU16 nLen;
+
+    TRACE_Release(p, TIMER_GetNowUs());
+
+    nLen = (TU16)UTIL_MIN((TU32)nBufLen, p->nRxAvail - p->nRxPos);
+    memcpy(pBuf, p->pRx + p->nRxPos, nLen);
+    p->nRxPos += nLen;
+
+    return nLen;
+}
+
+static TU32 TRACE_Wait(void *pBackend, UTIL_HANDLE hWake, TU32 nEvents, TU32 nTimeoutUs)
+{
+    TTraceCtx *p = (TTraceCtx *)pBackend;
+    TU64 nNow = TIMER_GetNowUs();
+    TU64 nEnd = nNow + nTimeoutUs;
+    TU64 nDue;
+    TU32 nReady;
+
+    while (TTrue)
+    {
+        TRACE_Release(p, nNow);
+
+        nReady = 0;
+        if ((nEvents & UART_EV_READ) && p->nRxPos < p->nRxAvail) nReady |= UART_EV_READ;
+        if (nEvents & UART_EV_WRITE) nReady |= UART_EV_WRITE;
+
+        // Nothing more to come: hang up, as an unplugged device
+        if (p->nRec == p->nRecs && p->nRxPos == p->nRxAvail) nReady |= UART_EV_ERROR;
+
+        if (nReady || nNow >= nEnd) return nReady;
+
+        // Unless the next chunk is only waiting for its time, only a
+        // request from another thread can change things
+        nDue = nEnd;
+        if (TRACE_IsAsked(p)) nDue = UTIL_MIN(nDue, p->nLastUs + TRACE_Gap(p, p->nRec));
+
+        if (nDue > nNow && WAKE_Wait(hWake, (TU32)(nDue - nNow))) return UART_EV_WAKE;
+
+        nNow = TIMER_GetNowUs();
+    }
+}
+
+static TBool TRACE_SetBaud(void *pBackend, TU32 nBaud)
+{
+    if (nBaud == 0) return TFalse;
+
+    ((TTraceCtx *)pBackend)->nBaud = nBaud;
+
+    return TTrue;
+}
+
+static void TRACE_Close(void *pBackend)
+{
+    TTraceCtx *p = (TTraceCtx *)pBackend;
+
+    free(p->pRx);
+    free(p->pTx);
+    free(p->pRec);
+    free(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void * xcom_trace_open(const char *szArg, const TXcomPortOps **ppOps)
+{
+    TTraceCtx *p = (TTraceCtx *)calloc(1, sizeof(TTraceCtx));
+    TU32  nLen = (TU32)strlen(szArg);
+    TU32  nOptLen = (TU32)strlen(XCOM_TRACE_PACED);
+    char *szName = (char *)malloc(nLen + 1);
+    char *pText = NULL;
+
+    if (p && szName)
+    {
+        strcpy(szName, szArg);
+
+        if (nLen > nOptLen && strcmp(szName + nLen - nOptLen, XCOM_TRACE_PACED) == 0)
+        {
+            szName[nLen - nOptLen] = '\0';
+            p->bPaced = TTrue;
+        }
+
+        pText = TRACE_ReadFile(szName);
+    }
+
+    if (!pText || !TRACE_Load(p, pText))
+    {
+        if (p) TRACE_Close(p);
+        free(szName);
+        free(pText);
+        return NULL;
+    }
+
+    free(szName);
+    free(pText);
+
+    p->nBaud = TRACE_DEF_BAUD;
+    p->nTxFirstDiff = TU32_MAX;
+    p->nLastUs = TIMER_GetNowUs();
+
+    *ppOps = &g_tTraceOps;
+
+    return p;
+}
+
+TBool  xcom_trace_get_stats(TXcomPortCtx *pPort, TXcomTraceStats *pStats)
+{
+    TTraceCtx *p = (TTraceCtx *)pPort->pBackend;
+
+    if (pPort->pOps != &g_tTraceOps) return TFalse;
+
+    pStats->nRxBytes     = p->nRxPos;
+    pStats->nRxLeft      = p->nRxLen - p->nRxPos;
+    pStats->nTxBytes     = p->nTxPos;
+    pStats->nTxDiffs     = p->nTxDiffs;
+    pStats->nTxFirstDiff = p->nTxFirstDiff;
+    pStats->nTxExtra     = (p->nTxPos > p->nTxLen) ? (p->nTxPos - p->nTxLen) : 0;
+
+    return TTrue;
+}
+
+TU16   xcom_trace_next_tx(TXcomPortCtx *pPort, const TU8 **ppBuf)
+{
+    TTraceCtx *p = (TTraceCtx *)pPort->pBackend;
+    TU32 nUntil;
+
+    if (pPort->pOps != &g_tTraceOps) return 0;
+
+    nUntil = (p->nRec < p->nRecs) ? p->pRec[p->nRec].nTxBefore : p->nTxLen;
+    if (p->nTxPos >= nUntil) return 0;
+
+    *ppBuf = p->pTx + p->nTxPos;
+
+    return (TU16)UTIL_MIN(nUntil - p->nTxPos, (TU32)TU16_MAX);
+}
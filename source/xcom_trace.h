@@ -0,0 +1,47 @@
+#ifndef __XCOM_TRACE_H__
+#define __XCOM_TRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xcom_port.h"
+
+// Replays a "UART TX:"/"UART RX:" trace, as LOG_Frame writes it or cap_dump
+// prints it, as a port: radar_open("trace:a.txt").
+//
+// Each chunk of RX bytes is handed out once the TX bytes logged before it
+// were sent, so that no response comes before its request. Chunks come as
+// fast as they are read or, with ",paced" after the file name, at the
+// pacing of the trace: the cap_dump times if it has them, the line rate
+// otherwise. The TX bytes are checked against the logged ones. The port
+// hangs up once the last RX byte is read.
+//
+// The replay only goes on while the host sends the logged requests: a
+// client has to make the same calls, in the same order, as the recorded
+// session. A chunk held for a request which never comes is never handed
+// out, and the host then sees timeouts instead of a hang-up.
+#define XCOM_TRACE_PACED        ",paced"
+
+typedef struct {
+    TU32 nRxBytes;          // handed out so far
+    TU32 nRxLeft;           // still to hand out
+    TU32 nTxBytes;          // sent, including the extra ones
+    TU32 nTxDiffs;          // sent bytes which differ from the logged ones
+    TU32 nTxFirstDiff;      // offset of the first, TU32_MAX if none
+    TU32 nTxExtra;          // sent past the end of the logged TX
+} TXcomTraceStats;
+
+void * xcom_trace_open(const char *szArg, const TXcomPortOps **ppOps);
+
+// TFalse if the port is no trace
+TBool  xcom_trace_get_stats(TXcomPortCtx *pPort, TXcomTraceStats *pStats);
+
+// Logged TX bytes still due before the next RX chunk, to play the host too
+TU16   xcom_trace_next_tx(TXcomPortCtx *pPort, const TU8 **ppBuf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XCOM_TRACE_H__